@@ -27,57 +27,401 @@
  */
 
 #include "A7105.h"
+#include "Trace.h"
 
-uint8_t a7105_packet[21];
-
-#define USE_PORT_DIRECT
-#if defined(USE_PORT_DIRECT)
-// For D0-D7 only
-#define CS_HI() PORTD |= (1 << CS_PIN)
-#define CS_LO() PORTD &= ~(1 << CS_PIN)
-#define SCK_HI() PORTD |= (1 << SCLK_PIN)
-#define SCK_LO() PORTD &= ~(1 << SCLK_PIN)
-#define SDIO_HI() PORTD |= (1 << SDIO_PIN)
-#define SDIO_LO() PORTD &= ~(1 << SDIO_PIN)
-#define SDIO_IS_HI() (PIND & (1 << SDIO_PIN)) == (1 << SDIO_PIN)
+volatile bool a7105_wtr_event;
+void (*a7105_wtr_handler)();
+A7105_ShadowStats a7105_shadow_stats;
+
+#if A7105_SPI_MODE == A7105_SPI_BITBANG
+#define SPI_DELAY() halDelayMicroseconds(1)
+#define READ_DELAY() halDelayMicroseconds(4) // could be less?
+#else
+// The peripheral clocks at F_CPU / 2, well inside the A7105's 10MHz limit
+#define SPI_DELAY()
+#define READ_DELAY()
+#endif
+
+#if defined(GIO1_PIN)
+#define DEFAULT_GIO1_PIN GIO1_PIN
+#else
+#define DEFAULT_GIO1_PIN HAL_NO_PIN
+#endif
+
+/*
+ * The transport shared by all radios, picked by A7105_SPI_MODE: spiBegin()
+ * sets it up, spiWrite() and spiRead() move a byte in a transaction.
+ */
+#if A7105_SPI_MODE == A7105_SPI_HARDWARE
+#if !defined(SPCR)
+#error "A7105_SPI_HARDWARE requires an AVR SPI peripheral"
+#endif
+static void spiBegin()
+{
+  // SS must be an output to stay in master mode
+  halPinMode(SS, OUTPUT);
+  halPinMode(SCK, OUTPUT);
+  halPinMode(MOSI, OUTPUT);
+  halPinMode(MISO, INPUT);
+
+  // Master, mode 0, MSB first, F_CPU / 2
+  SPCR = (1 << SPE) | (1 << MSTR);
+  SPSR = (1 << SPI2X);
+}
+
+static inline void spiWrite(uint8_t c)
+{
+  SPDR = c;
+  while (!(SPSR & (1 << SPIF)))
+    ;
+}
+
+static inline uint8_t spiRead()
+{
+  // Release SDIO so the A7105 can drive MISO
+  HalPin<MOSI>::input();
+  SPDR = 0xFF;
+  while (!(SPSR & (1 << SPIF)))
+    ;
+  HalPin<MOSI>::output();
+  return SPDR;
+}
+#elif A7105_SPI_MODE == A7105_SPI_USART
+#if !defined(UDR0)
+#error "A7105_SPI_USART requires USART0"
+#endif
+#if SCLK_PIN != 4
+#error "A7105_SPI_USART requires SCLK_PIN to be XCK0 (pin 4)"
+#endif
+static void spiBegin()
+{
+  UBRR0 = 0;
+  halPinMode(SCLK_PIN, OUTPUT); // XCK0
+
+  // Master SPI mode, mode 0, MSB first, F_CPU / 2
+  UCSR0C = (1 << UMSEL01) | (1 << UMSEL00);
+  UCSR0B = (1 << RXEN0) | (1 << TXEN0);
+  UBRR0 = 0;
+}
+
+static inline void spiWrite(uint8_t c)
+{
+  while (!(UCSR0A & (1 << UDRE0)))
+    ;
+  UDR0 = c;
+  // Drain the receiver so that the next read gets its own byte
+  while (!(UCSR0A & (1 << RXC0)))
+    ;
+  (void)UDR0;
+}
+
+static inline uint8_t spiRead()
+{
+  // TXD idles high through the series resistor, the A7105 overdrives it
+  while (!(UCSR0A & (1 << UDRE0)))
+    ;
+  UDR0 = 0xFF;
+  while (!(UCSR0A & (1 << RXC0)))
+    ;
+  return UDR0;
+}
+#else
+static void spiBegin()
+{
+  HalPin<SDIO_PIN>::output();
+  HalPin<SCLK_PIN>::output();
+  HalPin<SDIO_PIN>::high();
+  HalPin<SCLK_PIN>::low();
+}
+
+static inline void spiWrite(uint8_t c)
+{
+  uint8_t n = 8;
+
+  HalPin<SCLK_PIN>::low();
+  HalPin<SDIO_PIN>::low();
+  while (n--)
+  {
+    if (c & 0x80)
+      HalPin<SDIO_PIN>::high();
+    else
+      HalPin<SDIO_PIN>::low();
+    HalPin<SCLK_PIN>::high();
+    halDelayMicroseconds(1);
+    HalPin<SCLK_PIN>::low();
+    c = c << 1;
+  }
+  HalPin<SDIO_PIN>::high();
+}
+
+static inline uint8_t spiRead()
+{
+  uint8_t d = 0;
+  uint8_t i;
+
+  HalPin<SDIO_PIN>::input();
+  for (i = 0; i < 8; i++)
+  {
+    if (HalPin<SDIO_PIN>::read())
+      d = (d << 1) | 0x01;
+    else
+      d = d << 1;
+    HalPin<SCLK_PIN>::high();
+    halDelayMicroseconds(1);
+    HalPin<SCLK_PIN>::low();
+    halDelayMicroseconds(1);
+  }
+  HalPin<SDIO_PIN>::output();
+  return (d);
+}
+#endif
+
+/**
+ * @brief Type of the radio on CS_PIN and GIO1_PIN.
+ */
+typedef A7105Radio<CS_PIN, DEFAULT_GIO1_PIN> DefaultRadio;
+
+DefaultRadio a7105_default_radio;
+
+/**
+ * @var a7105_radio
+ * @brief Radio the a7105*() functions act on.
+ */
+A7105RadioBase *a7105_radio = &a7105_default_radio;
+
+/**
+ * @brief Drives CS of the selected radio low, the default radio's inline.
+ */
+static inline void radioSelect()
+{
+  if (a7105_radio == &a7105_default_radio)
+    DefaultRadio::select();
+  else
+    a7105_radio->select();
+}
+
+/**
+ * @brief Drives CS of the selected radio high, the default radio's inline.
+ */
+static inline void radioDeselect()
+{
+  if (a7105_radio == &a7105_default_radio)
+    DefaultRadio::deselect();
+  else
+    a7105_radio->deselect();
+}
+
+#if defined(GIO1_PIN)
+#if defined(ARDUINO)
+#if !defined(HAL_PIN_PCINT)
+#error "GIO1_PIN needs the pin change interrupts of this MCU mapped in HalPin.h"
+#elif HAL_PIN_PCINT(GIO1_PIN) == 0
+#define GIO1_PCINT_vect PCINT0_vect
+#elif HAL_PIN_PCINT(GIO1_PIN) == 1
+#define GIO1_PCINT_vect PCINT1_vect
+#elif HAL_PIN_PCINT(GIO1_PIN) == 2
+#define GIO1_PCINT_vect PCINT2_vect
 #else
-#define CS_HI() digitalWrite(CS_PIN, HIGH)
-#define CS_LO() digitalWrite(CS_PIN, LOW)
-#define SCK_HI() digitalWrite(SCLK_PIN, HIGH)
-#define SCK_LO() digitalWrite(SCLK_PIN, LOW)
-#define SDIO_HI() digitalWrite(SDIO_PIN, HIGH)
-#define SDIO_LO() digitalWrite(SDIO_PIN, LOW)
-#define SDIO_IS_HI() digitalRead(SDIO_PIN) == HIGH
+#error "GIO1_PIN has no pin change interrupt"
+#endif
+#endif
+
+/**
+ * @brief Called on a change of GIO1, flags the falling edge of WTR.
+ */
+void gio1Change()
+{
+  if (!HalPin<GIO1_PIN>::read())
+  {
+    a7105_wtr_event = true;
+    if (a7105_wtr_handler)
+      a7105_wtr_handler();
+  }
+}
+
+#if defined(ARDUINO)
+ISR(GIO1_PCINT_vect)
+{
+  gio1Change();
+}
+#endif
+#endif
+
+/**
+ * @brief Creates a radio, called by A7105Radio with its pin functions.
+ * @param csPin Pin connected to the A7105 SCS
+ * @param gio1Pin Pin connected to the A7105 GIO1, HAL_NO_PIN if unconnected
+ * @param select Drives CS low
+ * @param deselect Drives CS high
+ * @param gio1High Reads GIO1
+ */
+A7105RadioBase::A7105RadioBase(uint8_t csPin, uint8_t gio1Pin,
+                               void (*select)(), void (*deselect)(),
+                               bool (*gio1High)())
+    : m_csPin(csPin)
+    , m_gio1Pin(gio1Pin)
+    , m_select(select)
+    , m_deselect(deselect)
+    , m_gio1High(gio1High)
+{
+  invalidateShadow();
+}
+
+/**
+ * @brief Sets up the pins and transport, leaving the radio deselected.
+ */
+void A7105RadioBase::begin()
+{
+  halPinMode(m_csPin, OUTPUT);
+  m_deselect();
+  if (m_gio1Pin != HAL_NO_PIN)
+    halPinMode(m_gio1Pin, INPUT);
+
+  spiBegin();
+}
+
+#if defined(A7105_SHADOW_REGISTERS)
+/**
+ * @brief Updates the register shadow with a write.
+ * @param a Register address
+ * @param d Value to be written
+ * @return True if the write must be sent to the A7105
+ *
+ * Registers that trigger an action or are modified by the A7105 (FIFO, ID,
+ * ADC, calibration and battery detect) are never shadowed.
+ */
+bool A7105RadioBase::shadowUpdate(uint8_t a, uint8_t d)
+{
+  if (a < A7105_SHADOW_FIRST || a > A7105_SHADOW_LAST || a == A7105_1E_ADC ||
+      (a >= A7105_22_IF_CALIB_I && a <= A7105_27_BATTERY_DET))
+    return true;
+
+  uint8_t idx = a - A7105_SHADOW_FIRST;
+  uint8_t mask = 1 << (idx & 7);
+
+  if ((m_shadowValid[idx >> 3] & mask) && m_shadow[idx] == d)
+    return false;
+
+  m_shadow[idx] = d;
+  m_shadowValid[idx >> 3] |= mask;
+  return true;
+}
 #endif
 
-#define SPI_DELAY() delayMicroseconds(1)
+/**
+ * @brief Forgets all shadowed register values.
+ */
+void A7105RadioBase::invalidateShadow()
+{
+#if defined(A7105_SHADOW_REGISTERS)
+  memset(m_shadowValid, 0, sizeof(m_shadowValid));
+#endif
+}
 
-void a7105Reset()
+/**
+ * @brief Picks the radio the a7105*() functions act on.
+ *
+ * Only changes which CS is driven, the GIO1 interrupt and a7105_wtr_event
+ * stay with the default radio.
+ */
+void a7105Select(A7105RadioBase &radio)
+{
+  a7105_radio = &radio;
+}
+
+/**
+ * @brief Gets the radio the a7105*() functions act on.
+ */
+A7105RadioBase &a7105Selected()
+{
+  return *a7105_radio;
+}
+
+/**
+ * @brief Gets the radio on CS_PIN, SCLK_PIN, SDIO_PIN and GIO1_PIN, in the
+ * transport selected by A7105_SPI_MODE.
+ */
+A7105RadioBase &a7105Default()
+{
+  return a7105_default_radio;
+}
+
+/**
+ * @brief Soft resets the A7105.
+ * @param wait Wait A7105_RESET_US for the reset, false if the caller waits
+ */
+void a7105Reset(bool wait)
 {
-  delay(20); // wait for A7105 wakeup
   a7105WriteReg(0, 0);
-  delay(1);
+  a7105InvalidateShadow();
+  if (wait)
+    halDelay(A7105_RESET_US / 1000);
 }
 
-void a7105SetupSPI()
+/**
+ * @brief Forgets all shadowed register values.
+ *
+ * Called by a7105Reset(), must be called if the A7105 registers are changed
+ * without going through a7105WriteReg().
+ */
+void a7105InvalidateShadow()
 {
-  pinMode(SDIO_PIN, OUTPUT);
-  pinMode(SCLK_PIN, OUTPUT);
-  pinMode(CS_PIN, OUTPUT);
-  CS_HI();
-  SDIO_HI();
-  SCK_LO();
+  a7105_radio->invalidateShadow();
+}
+
+/**
+ * @brief Sets up the pins and SPI used to talk to the A7105.
+ * @param wait Wait A7105_WAKEUP_US for the A7105 to wake up, false if the
+ * caller waits
+ */
+void a7105SetupSPI(bool wait)
+{
+  a7105_radio->begin();
+
+  if (wait)
+    halDelay(A7105_WAKEUP_US / 1000);
+}
+
+/**
+ * @brief Configures GIO1 as WTR and enables its pin change interrupt.
+ *
+ * Must be called after every a7105Reset(). Does nothing if the radio has no
+ * GIO1 pin, only the default radio's (GIO1_PIN) has the interrupt.
+ */
+void a7105SetupGIO1()
+{
+  a7105_wtr_event = false;
+
+  if (a7105_radio->gio1Pin() == HAL_NO_PIN)
+    return;
+
+  a7105WriteReg(A7105_0B_GPIO1_PIN1, A7105_GIO_WTR);
+
+#if defined(GIO1_PIN)
+  if (a7105_radio != &a7105_default_radio)
+    return;
+
+#if defined(ARDUINO)
+  *digitalPinToPCMSK(GIO1_PIN) |= bit(digitalPinToPCMSKbit(GIO1_PIN));
+  PCIFR = bit(digitalPinToPCICRbit(GIO1_PIN));
+  *digitalPinToPCICR(GIO1_PIN) |= bit(digitalPinToPCICRbit(GIO1_PIN));
+#else
+  halAttachInterrupt(GIO1_PIN, gio1Change, CHANGE);
+#endif
+#endif
 }
 
 void a7105WriteID(uint32_t id)
 {
-  CS_LO();
+  TRACE(TRACE_WRITE_ID, (id >> 8) & 0xff, id & 0xff);
+
+  radioSelect();
   a7105Write(A7105_06_ID_DATA);
   a7105Write((id >> 24) & 0xff);
   a7105Write((id >> 16) & 0xff);
   a7105Write((id >> 8) & 0xff);
   a7105Write((id)&0xff);
-  CS_HI();
+  radioDeselect();
 }
 
 uint32_t a7105ReadID()
@@ -85,119 +429,126 @@ uint32_t a7105ReadID()
   uint8_t i;
   uint32_t id = 0;
 
-  CS_LO();
+  radioSelect();
   a7105Write(0x40 | A7105_06_ID_DATA);
   for (i = 0; i < 4; i++)
     id = (id << 8) | a7105Read();
-  CS_HI();
+  radioDeselect();
   return (id);
 }
 
 void a7105Write(uint8_t c)
 {
-  uint8_t n = 8;
-
-  SCK_LO();
-  SDIO_LO();
-  while (n--)
-  {
-    if (c & 0x80)
-      SDIO_HI();
-    else
-      SDIO_LO();
-    SCK_HI();
-    SPI_DELAY();
-    SCK_LO();
-    c = c << 1;
-  }
-  SDIO_HI();
+  spiWrite(c);
 }
 
 void a7105WriteReg(uint8_t a, uint8_t d)
 {
-  CS_LO();
+#if defined(A7105_SHADOW_REGISTERS)
+  if (!a7105_radio->shadowUpdate(a, d))
+  {
+    a7105_shadow_stats.skipped++;
+    return;
+  }
+#endif
+  a7105_shadow_stats.writes++;
+  TRACE(TRACE_WRITE_REG, a, d);
+
+  radioSelect();
   a7105Write(a);
   SPI_DELAY();
   a7105Write(d);
-  CS_HI();
+  radioDeselect();
 }
 
 void a7105WriteData(uint8_t *b, uint8_t len, uint8_t chan)
 {
   uint8_t i;
 
+  TRACE(TRACE_WRITE_DATA, len, chan);
+
   // pinMode(SDIO, OUTPUT);
   // digitalWrite(SDIO, LOW);
-  CS_LO();
+  radioSelect();
   a7105Write(A7105_RST_WRPTR);
   a7105Write(A7105_05_FIFO_DATA);
   for (i = 0; i < len; i++)
     a7105Write(b[i]);
-  SCK_LO();
-  CS_HI();
+  radioDeselect();
   // pinMode(SDIO, INPUT);
 
   a7105WriteReg(0x0f, chan);
 
-  CS_LO();
+  radioSelect();
   a7105Write(A7105_TX);
   // digitalWrite(SCK, LOW);
-  CS_HI();
+  radioDeselect();
 }
 
-void a7105CRCUpdate(uint8_t len)
+/**
+ * @brief Writes a register profile to the A7105.
+ * @param profile (register, value) pairs in PROGMEM
+ * @param len Length of profile in bytes
+ *
+ * The A7105 only auto increments within the ID and FIFO registers, so each
+ * control register is a separate transaction.
+ */
+void a7105WriteProfile(const uint8_t *profile, uint8_t len)
+{
+  uint8_t i;
+
+  for (i = 0; i < len; i += 2)
+    a7105WriteReg(pgm_read_byte(&profile[i]), pgm_read_byte(&profile[i + 1]));
+}
+
+/**
+ * @brief Sets the last byte of a packet to its checksum.
+ * @param packet Packet
+ * @param len Length of the packet including the checksum
+ */
+void a7105CRCUpdate(uint8_t *packet, uint8_t len)
 {
   int16_t sum = 0;
   uint8_t i;
 
   for (i = 0; i < (len - 1); i++)
-    sum += a7105_packet[i];
-  a7105_packet[len - 1] = (256 - (sum % 256)) & 0xff;
+    sum += packet[i];
+  packet[len - 1] = (256 - (sum % 256)) & 0xff;
 }
 
-bool a7105CRCCheck(uint8_t len)
+/**
+ * @brief Checks the last byte of a packet is its checksum.
+ * @param packet Packet
+ * @param len Length of the packet including the checksum
+ * @return True if the checksum matches
+ */
+bool a7105CRCCheck(const uint8_t *packet, uint8_t len)
 {
   int16_t sum = 0;
   uint8_t i;
 
   for (i = 0; i < (len - 1); i++)
-    sum += a7105_packet[i];
+    sum += packet[i];
 
-  return (a7105_packet[len - 1] == ((256 - (sum % 256)) & 0xff));
+  return (packet[len - 1] == ((256 - (sum % 256)) & 0xff));
 }
 
 uint8_t a7105Read()
 {
-  uint8_t d = 0;
-  uint8_t i;
-
-  pinMode(SDIO_PIN, INPUT);
-  // SDIO_HI();
-  for (i = 0; i < 8; i++)
-  {
-    if (SDIO_IS_HI())
-      d = (d << 1) | 0x01;
-    else
-      d = d << 1;
-    SCK_HI();
-    SPI_DELAY();
-    SCK_LO();
-    SPI_DELAY();
-  }
-  pinMode(SDIO_PIN, OUTPUT);
-  return (d);
+  return spiRead();
 }
 
 uint8_t a7105ReadReg(uint8_t a)
 {
   uint8_t d;
 
-  CS_LO();
+  radioSelect();
   a7105Write(0x40 | a);
-  delayMicroseconds(4); // could be less?
+  READ_DELAY();
   d = a7105Read();
-  CS_HI();
+  radioDeselect();
 
+  TRACE(TRACE_READ_REG, a, d);
   return d;
 }
 
@@ -206,20 +557,43 @@ void a7105ReadData(uint8_t *b, uint8_t len)
   uint8_t i;
 
   a7105Strobe(A7105_RST_RDPTR);
+
+  // The FIFO address does not auto increment, each read pops the next byte
+  radioSelect();
+  a7105Write(0x40 | A7105_05_FIFO_DATA);
+  READ_DELAY();
   for (i = 0; i < len; i++)
-    b[i] = a7105ReadReg(A7105_05_FIFO_DATA);
+    b[i] = a7105Read();
+  radioDeselect();
+
+  TRACE(TRACE_READ_DATA, len, len ? b[0] : 0);
 }
 
+/**
+ * @brief Checks if a TX or RX is in progress.
+ *
+ * Reads GIO1 if the radio has it, otherwise the mode register.
+ */
 bool a7105Busy()
 {
-  return (a7105ReadReg(A7105_00_MODE) & 1);
+  bool gio1 = a7105_radio->gio1Pin() != HAL_NO_PIN;
+  bool busy = gio1 ? a7105_radio->gio1High()
+                   : (a7105ReadReg(A7105_00_MODE) & 1);
+
+  TRACE(TRACE_BUSY, busy, gio1);
+  return busy;
 }
 
 void a7105Strobe(uint8_t state)
 {
-  CS_LO();
+  TRACE(TRACE_STROBE, state, 0);
+
+  radioSelect();
   a7105Write(state);
-  CS_HI();
+  radioDeselect();
+
+  // A new operation supersedes a completion that has not been serviced
+  a7105_wtr_event = false;
 }
 
 void a7105SetPower(uint8_t p)
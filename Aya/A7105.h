@@ -3,15 +3,130 @@
 #ifndef _A7105_AYA_H_
 #define _A7105_AYA_H_
 
-#include <Arduino.h>
+#include "HAL.h"
 
-extern uint8_t a7105_packet[21];
+/**
+ * @var a7105_wtr_event
+ * @brief Set when GIO1 signals that a TX or RX has completed.
+ *
+ * Cleared by the protocol when it services the radio.
+ */
+extern volatile bool a7105_wtr_event;
 
+/**
+ * @var a7105_wtr_handler
+ * @brief Called from the GIO1 interrupt when a TX or RX completes, may be
+ * NULL.
+ *
+ * e.g. scheduler_wake(), so the radio is serviced without waiting for the
+ * next deadline.
+ */
+extern void (*a7105_wtr_handler)();
+
+/**
+ * @def A7105_SPI_BITBANG
+ * @brief Software SPI on CS_PIN, SCLK_PIN and SDIO_PIN.
+ */
+#define A7105_SPI_BITBANG 0
+
+/**
+ * @def A7105_SPI_HARDWARE
+ * @brief AVR SPI peripheral, 3-wire.
+ *
+ * SCK drives the A7105 SCK, MISO is tied to SDIO and MOSI drives SDIO through
+ * a series resistor (~1k). MOSI is released while reading.
+ */
+#define A7105_SPI_HARDWARE 1
+
+/**
+ * @def A7105_SPI_USART
+ * @brief USART0 in master SPI mode (MSPIM), 3-wire.
+ *
+ * XCK0 (pin 4, the default SCLK_PIN) drives the A7105 SCK, RXD0 is tied to
+ * SDIO and TXD0 drives SDIO through a series resistor (~4k7). Serial can not
+ * be used with this transport.
+ */
+#define A7105_SPI_USART 2
+
+/**
+ * @def A7105_SPI_MODE
+ * @brief Transport used to communicate with the A7105.
+ */
+#ifndef A7105_SPI_MODE
+#define A7105_SPI_MODE A7105_SPI_BITBANG
+#endif
+
+/**
+ * @def A7105_SHADOW_REGISTERS
+ * @brief Keep a copy of written registers and skip writes that change nothing.
+ *
+ * Costs around 60 bytes of RAM, comment out to disable.
+ */
+#define A7105_SHADOW_REGISTERS
+
+/*
+ * Pins of the default radio, see a7105Default(). SCLK_PIN and SDIO_PIN are
+ * shared by all radios, the others are declared with their own CS, e.g.
+ * A7105Radio<7>.
+ */
 #define CS_PIN 2
 #define SCLK_PIN 4
 #define SDIO_PIN 5
 
-#define a7105SetTimeout() timeoutuS = micros() + 1000 // datasheet ~700uS
+/**
+ * @def GIO1_PIN
+ * @brief Pin connected to the A7105 GIO1 output.
+ *
+ * Uncomment if GIO1 is wired: it is configured as WTR and the end of TX/RX
+ * is detected with a pin change interrupt instead of polling the mode
+ * register over SPI. The pin needs a pin change interrupt, its vector is
+ * then taken by the library (not free for e.g. SoftwareSerial).
+ */
+// #define GIO1_PIN 6
+
+/**
+ * @def A7105_WAKEUP_US
+ * @brief Time for the A7105 to wake up after power on, see a7105SetupSPI().
+ */
+#define A7105_WAKEUP_US 20000
+
+/**
+ * @def A7105_RESET_US
+ * @brief Time for the A7105 to come out of a soft reset, see a7105Reset().
+ */
+#define A7105_RESET_US 1000
+
+/**
+ * @def A7105_STANDBY_US
+ * @brief Time from the A7105_STANDBY strobe that wakes the A7105 from
+ * A7105_SLEEP or A7105_IDLE until it can TX or RX, the crystal settling.
+ */
+#define A7105_STANDBY_US 1000
+
+/**
+ * @def a7105SetTimeout
+ * @brief Gets the halMicros() time a calibration times out at, compare with
+ * halTimeAfter().
+ */
+#define a7105SetTimeout() (halMicros() + 1000) // datasheet ~700uS
+
+/**
+ * @struct A7105_ShadowStats
+ * @brief Register write counters maintained by the register shadow.
+ */
+struct A7105_ShadowStats
+{
+  uint32_t writes;  //!< Register writes sent to the A7105
+  uint32_t skipped; //!< Register writes skipped as the value was unchanged
+};
+
+/**
+ * @var a7105_shadow_stats
+ * @brief Counters of sent and skipped register writes.
+ *
+ * May be reset by the application, e.g. once per frame.
+ */
+extern A7105_ShadowStats a7105_shadow_stats;
 
 enum A7105_State
 {
@@ -85,6 +200,14 @@ enum A7105_MASK
 {
   A7105_MASK_FBCF = 1 << 4,
   A7105_MASK_VBCF = 1 << 3,
+  A7105_MASK_MFBS = 1 << 4, // Manual IF filter bank, A7105_22_IF_CALIB_I
+  A7105_MASK_MVCS = 1 << 4, // Manual VCO current, A7105_24_VCO_CURCAL
+  A7105_MASK_MVBS = 1 << 3, // Manual VCO band, A7105_25_VCO_SBCAL_I
+};
+
+enum A7105_GIO
+{
+  A7105_GIO_WTR = 0x01, // WTR output, high while TX/RX is in progress
 };
 
 enum A7105_TxPower
@@ -100,15 +223,147 @@ enum A7105_TxPower
   TXPOWER_LAST
 };
 
-void a7105Reset();
-void a7105SetupSPI();
+#if defined(A7105_SHADOW_REGISTERS)
+#define A7105_SHADOW_FIRST A7105_07_RC_OSC_I
+#define A7105_SHADOW_LAST A7105_32_FILTER_TEST
+#define A7105_SHADOW_SIZE (A7105_SHADOW_LAST - A7105_SHADOW_FIRST + 1)
+#endif
+
+/**
+ * @class A7105RadioBase
+ * @brief An A7105 as picked at run time: its register shadow and the pin
+ * functions of the A7105Radio it belongs to.
+ *
+ * The a7105*() functions act on the radio picked with a7105Select(), the
+ * default radio on CS_PIN and GIO1_PIN to start with. Each radio keeps its
+ * own register shadow.
+ */
+class A7105RadioBase
+{
+public:
+  void begin();
+
+  /**
+   * @brief Starts a transaction, driving CS low.
+   */
+  void select()
+  {
+    m_select();
+  }
+
+  /**
+   * @brief Ends a transaction, driving CS high.
+   */
+  void deselect()
+  {
+    m_deselect();
+  }
+
+  /**
+   * @brief Gets the pin connected to GIO1, HAL_NO_PIN if unconnected.
+   */
+  uint8_t gio1Pin() const
+  {
+    return m_gio1Pin;
+  }
+
+  /**
+   * @brief Reads GIO1, false if unconnected.
+   */
+  bool gio1High() const
+  {
+    return m_gio1High();
+  }
+
+#if defined(A7105_SHADOW_REGISTERS)
+  bool shadowUpdate(uint8_t a, uint8_t d);
+#endif
+  void invalidateShadow();
+
+protected:
+  A7105RadioBase(uint8_t csPin, uint8_t gio1Pin, void (*select)(),
+                 void (*deselect)(), bool (*gio1High)());
+
+private:
+  uint8_t m_csPin;
+  uint8_t m_gio1Pin;
+  void (*m_select)();
+  void (*m_deselect)();
+  bool (*m_gio1High)();
+#if defined(A7105_SHADOW_REGISTERS)
+  uint8_t m_shadow[A7105_SHADOW_SIZE];
+  uint8_t m_shadowValid[(A7105_SHADOW_SIZE + 7) / 8];
+#endif
+};
+
+/**
+ * @class A7105Radio
+ * @brief An A7105 on CS and GIO1 pins fixed when building.
+ *
+ * All radios share the transport of A7105_SPI_MODE: SCLK_PIN and SDIO_PIN
+ * bit-banged, the SPI peripheral or USART0, each radio with its own CS, e.g.
+ * A7105Radio<7> for CS on pin 7. CS and GIO1 are HalPin accesses, a single
+ * instruction on most AVR ports. The a7105*() functions drive the default
+ * radio's CS inline and other radios' through the functions kept in their
+ * A7105RadioBase. Set up all radios with a7105SetupSPI() before talking to
+ * any, a CS left floating would let its radio answer too.
+ *
+ * Only the default radio's GIO1 (GIO1_PIN) has the pin change interrupt and
+ * sets a7105_wtr_event. a7105Busy() reads the GIO1 pin of any other radio
+ * that has one, and polls the mode register over SPI for those without.
+ *
+ * @tparam CsPin Pin connected to the A7105 SCS
+ * @tparam Gio1Pin Pin connected to the A7105 GIO1, HAL_NO_PIN if unconnected
+ */
+template <uint8_t CsPin, uint8_t Gio1Pin = HAL_NO_PIN>
+class A7105Radio : public A7105RadioBase
+{
+public:
+  A7105Radio()
+      : A7105RadioBase(CsPin, Gio1Pin, select, deselect, gio1High)
+  {
+  }
+
+  /**
+   * @brief Starts a transaction, driving CS low.
+   */
+  static void select()
+  {
+    HalPin<CsPin>::low();
+  }
+
+  /**
+   * @brief Ends a transaction, driving CS high.
+   */
+  static void deselect()
+  {
+    HalPin<CsPin>::high();
+  }
+
+  /**
+   * @brief Reads GIO1, false if unconnected.
+   */
+  static bool gio1High()
+  {
+    return HalPin<Gio1Pin>::read();
+  }
+};
+
+void a7105Select(A7105RadioBase &radio);
+A7105RadioBase &a7105Selected();
+A7105RadioBase &a7105Default();
+void a7105Reset(bool wait = true);
+void a7105InvalidateShadow();
+void a7105SetupSPI(bool wait = true);
+void a7105SetupGIO1();
 void a7105WriteID(uint32_t id);
 uint32_t a7105ReadID();
 void a7105Write(uint8_t c);
 void a7105WriteReg(uint8_t a, uint8_t d);
 void a7105WriteData(uint8_t *b, uint8_t len, uint8_t chan);
-void a7105CRCUpdate(uint8_t len);
-bool a7105CRCCheck(uint8_t len);
+void a7105WriteProfile(const uint8_t *profile, uint8_t len);
+void a7105CRCUpdate(uint8_t *packet, uint8_t len);
+bool a7105CRCCheck(const uint8_t *packet, uint8_t len);
 uint8_t a7105Read();
 uint8_t a7105ReadReg(uint8_t a);
 void a7105ReadData(uint8_t *b, uint8_t len);
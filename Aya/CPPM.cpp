@@ -2,12 +2,6 @@
 
 #include "CPPM.h"
 
-/**
- * @def CPPM_US_NEW_FRAME
- * @brief Minimum time between pulses indicating a new CPPM frame.
- */
-#define CPPM_US_NEW_FRAME 2500
-
 /**
  * @def CPPM_US_PULSE_MIN
  * @brief Minimum valid pulse time for a channel value.
@@ -20,14 +14,54 @@
  */
 #define CPPM_US_PULSE_MAX 2200
 
-bool cppm_fresh;
+/**
+ * @def CPPM_US_DEFAULT_FRAME
+ * @brief Frame period assumed until one has been measured.
+ */
+#define CPPM_US_DEFAULT_FRAME 22500
+
+/**
+ * @def CPPM_LOCK_FRAMES
+ * @brief Consecutive frames with the same channel count needed to learn it.
+ */
+#define CPPM_LOCK_FRAMES 3
+
+/**
+ * @def CPPM_STALE_FRAMES
+ * @brief Frame periods without a good frame after which input is stale.
+ */
+#define CPPM_STALE_FRAMES 3
+
+volatile bool cppm_fresh;
 int cppm_channels[CPPM_NUM_CHANNELS];
 
 /**
- * @var cppm_raw
- * @brief Raw pulse widths read by ISR.
+ * @var cppm_buffers
+ * @brief Frames decoded by the ISR.
+ *
+ * The ISR fills cppm_writing, then publishes it as cppm_latest at the frame
+ * boundary and moves on to the buffer that is neither the latest nor claimed
+ * by the reader, so the reader never sees a frame being written.
+ */
+CppmFrame cppm_buffers[3];
+
+/**
+ * @var cppm_writing
+ * @brief Buffer the ISR decodes into.
  */
-int cppm_raw[CPPM_NUM_CHANNELS];
+uint8_t cppm_writing;
+
+/**
+ * @var cppm_latest
+ * @brief Last complete frame.
+ */
+volatile uint8_t cppm_latest;
+
+/**
+ * @var cppm_reading
+ * @brief Buffer claimed by the reader.
+ */
+volatile uint8_t cppm_reading;
 
 /**
  * @var cppm_frame_good
@@ -35,6 +69,42 @@ int cppm_raw[CPPM_NUM_CHANNELS];
  */
 bool cppm_frame_good;
 
+/**
+ * @var cppm_pulses
+ * @brief Channel pulses counted in the current frame.
+ */
+uint8_t cppm_pulses;
+
+/**
+ * @var cppm_synced
+ * @brief Flag to indicate if a frame gap has been seen since initialisation.
+ */
+bool cppm_synced;
+
+/**
+ * @var cppm_last_gap_us
+ * @brief Time of the last frame gap.
+ */
+uint32_t cppm_last_gap_us;
+
+/**
+ * @var cppm_candidate
+ * @brief Channel count of recent frames that differ from the learned count.
+ */
+uint8_t cppm_candidate;
+
+/**
+ * @var cppm_candidate_frames
+ * @brief Consecutive frames with cppm_candidate channels.
+ */
+uint8_t cppm_candidate_frames;
+
+/**
+ * @var cppm_stats
+ * @brief Learned signal parameters and counters, updated at each frame gap.
+ */
+Snapshot<CppmStats> cppm_stats;
+
 /**
  * @var interrupt_to_pin
  * @brief Look up table of interrupt number to pin number.
@@ -42,37 +112,233 @@ bool cppm_frame_good;
 const int interrupt_to_pin[] = {2, 3};
 
 /**
- * @brief Called when pin interrupt is fired, does CPPM counting
+ * @var cppm_edge_level
+ * @brief Level of the pin after the edge the ISR is attached to.
  */
-void cppm_isr()
+bool cppm_edge_level;
+
+/**
+ * @var cppm_glitches
+ * @brief Edges ignored since the last frame gap.
+ */
+uint8_t cppm_glitches;
+
+/**
+ * @brief Publishes the frame in cppm_writing and picks the next buffer.
+ * @param stats Statistics being updated
+ * @param time_us Time the frame ended
+ */
+void cppm_publish(CppmStats &stats, uint32_t time_us)
 {
-  uint32_t time_us;
-  int16_t pulse_width_us;
-  static uint32_t last_time_us = 0;
-  static uint8_t channel = 0;
+  CppmFrame &frame = cppm_buffers[cppm_writing];
+  frame.sequence = ++stats.frames;
+  frame.timeUs = time_us;
+  frame.channelCount = min(cppm_pulses, CPPM_NUM_CHANNELS);
+  for (uint8_t i = frame.channelCount; i < CPPM_NUM_CHANNELS; i++)
+    frame.channels[i] = 1500;
 
-  time_us = micros();
+  halMemoryBarrier();
+  cppm_latest = cppm_writing;
 
-  pulse_width_us = time_us - last_time_us;
-  last_time_us = time_us;
+  uint8_t reading = cppm_reading;
+  do
+    cppm_writing = (cppm_writing + 1) % 3;
+  while (cppm_writing == cppm_latest || cppm_writing == reading);
+
+  cppm_fresh = true;
+}
+
+/**
+ * @brief Checks the frame that just ended against the learned signal.
+ *
+ * A frame is only published once the same channel count has been seen in
+ * CPPM_LOCK_FRAMES consecutive frames, a change of count is learned the same
+ * way. The frame period is averaged over good frames.
+ *
+ * @param time_us Time of the frame gap
+ */
+void cppm_frame_end(uint32_t time_us)
+{
+  // The frame before the first gap is partial
+  if (!cppm_synced)
+  {
+    cppm_synced = true;
+    cppm_last_gap_us = time_us;
+    return;
+  }
+
+  CppmStats &stats = cppm_stats.beginWrite();
+  uint32_t interval_us = time_us - cppm_last_gap_us;
+  uint16_t period_us = stats.frameUs;
+  cppm_last_gap_us = time_us;
+
+  stats.glitches += cppm_glitches;
+  cppm_glitches = 0;
+
+  // Frames missing from the signal
+  bool dropout = period_us && interval_us > period_us + period_us / 2;
+  if (dropout)
+    stats.dropped += (interval_us + period_us / 2) / period_us - 1;
 
+  if (!cppm_frame_good)
+  {
+    stats.badFrames++;
+  }
+  else if (stats.channels && cppm_pulses == stats.channels)
+  {
+    cppm_candidate_frames = 0;
+    cppm_publish(stats, time_us);
+  }
+  else if (cppm_pulses && cppm_pulses == cppm_candidate &&
+           ++cppm_candidate_frames >= CPPM_LOCK_FRAMES)
+  {
+    stats.channels = cppm_pulses;
+    cppm_candidate_frames = 0;
+    cppm_publish(stats, time_us);
+  }
+  else
+  {
+    // Two gaps in a row are never a candidate, and break a run of them
+    if (!cppm_pulses)
+      cppm_candidate_frames = 0;
+    else if (cppm_pulses != cppm_candidate)
+    {
+      cppm_candidate = cppm_pulses;
+      cppm_candidate_frames = 1;
+    }
+    if (stats.channels)
+      stats.badFrames++;
+  }
+
+  // Average the period over good frames that did not follow a dropout
+  if (cppm_frame_good && !dropout && interval_us < UINT16_MAX)
+  {
+    if (!period_us)
+      stats.frameUs = interval_us;
+    else
+      stats.frameUs += ((int32_t)interval_us - period_us) / 8;
+  }
+
+  cppm_stats.endWrite();
+}
+
+/**
+ * @brief Does CPPM counting on the time between two edges.
+ *
+ * Any time longer than a channel pulse is taken as the frame gap, the channel
+ * count tells a short gap apart from a bad pulse.
+ *
+ * @param pulse_width_us Time since the previous edge
+ * @param time_us Time of this edge
+ */
+void cppm_pulse(uint16_t pulse_width_us, uint32_t time_us)
+{
   // Start of new frame
-  if (pulse_width_us > CPPM_US_NEW_FRAME)
+  if (pulse_width_us > CPPM_US_PULSE_MAX)
   {
-    cppm_fresh = cppm_frame_good;
+    cppm_frame_end(time_us);
     cppm_frame_good = true;
-    channel = 0;
+    cppm_pulses = 0;
+    return;
   }
+
   // End of channel pulse
-  else if (channel < CPPM_NUM_CHANNELS)
+  if (pulse_width_us < CPPM_US_PULSE_MIN)
+    cppm_frame_good = false;
+  else if (cppm_pulses < CPPM_NUM_CHANNELS)
+    cppm_buffers[cppm_writing].channels[cppm_pulses] = pulse_width_us;
+
+  if (cppm_pulses < UINT8_MAX)
+    cppm_pulses++;
+}
+
+/**
+ * @brief Called when pin interrupt is fired, timestamps with halMicros().
+ *
+ * An edge the pin has already gone back from was a glitch shorter than the
+ * interrupt latency, it is ignored rather than splitting a channel. The pin is
+ * read through HalPin, a single instruction on the port.
+ *
+ * @tparam Pin Pin of the interrupt
+ */
+template <uint8_t Pin>
+void cppm_isr()
+{
+  static uint32_t last_time_us = 0;
+
+  if (HalPin<Pin>::read() != cppm_edge_level)
   {
-    if (pulse_width_us >= CPPM_US_PULSE_MIN &&
-        pulse_width_us <= CPPM_US_PULSE_MAX)
-      cppm_raw[channel] = pulse_width_us;
-    else
-      cppm_frame_good = false;
-    channel++;
+    if (cppm_glitches < UINT8_MAX)
+      cppm_glitches++;
+    return;
   }
+
+  uint32_t time_us = halMicros();
+  uint32_t pulse_width_us = time_us - last_time_us;
+  last_time_us = time_us;
+
+  cppm_pulse(min(pulse_width_us, 0xFFFFUL), time_us);
+}
+
+#if defined(HAL_CAPTURE_PIN)
+/**
+ * @brief Called on each captured edge, timestamps from the capture timer.
+ */
+void cppm_capture_isr()
+{
+  static uint16_t last_ticks = 0;
+
+  uint16_t ticks = halCaptureTicks();
+  uint16_t pulse_width = ticks - last_ticks;
+  bool lost = false;
+
+  /*
+   * A wrap before this edge (the timer is still in the lower half) with the
+   * timer at or past the last edge means at least a full period has elapsed,
+   * so the signal was lost rather than being a short pulse.
+   */
+  if (halCaptureWrapped() && ticks < 0x8000)
+  {
+    lost = ticks >= last_ticks;
+    halCaptureClearWrapped();
+  }
+  last_ticks = ticks;
+
+  if (lost)
+    cppm_pulse(0xFFFF, halMicros());
+  else
+    cppm_pulse(halCaptureTicksToUs(pulse_width), halMicros());
+}
+#endif
+
+/**
+ * @brief Sets all channels to centre and waits for a new frame.
+ */
+void cppm_reset()
+{
+  cppm_frame_good = false;
+  cppm_synced = false;
+  cppm_candidate = 0;
+  cppm_candidate_frames = 0;
+  cppm_glitches = 0;
+
+  cppm_stats.beginWrite() = CppmStats();
+  cppm_stats.endWrite();
+
+  for (uint8_t b = 0; b < 3; b++)
+  {
+    cppm_buffers[b].sequence = 0;
+    cppm_buffers[b].timeUs = 0;
+    cppm_buffers[b].channelCount = 0;
+    for (size_t i = 0; i < CPPM_NUM_CHANNELS; i++)
+      cppm_buffers[b].channels[i] = 1500;
+  }
+
+  cppm_latest = 0;
+  cppm_reading = 0;
+  cppm_writing = 1;
+
+  cppm_read();
 }
 
 /**
@@ -86,18 +352,69 @@ bool cppm_init(int interrupt, int logic_direction)
   if (logic_direction != FALLING && logic_direction != RISING)
     return false;
 
-  cppm_frame_good = false;
+  cppm_reset();
+  cppm_edge_level = logic_direction == RISING;
 
-  for (size_t i = 0; i < CPPM_NUM_CHANNELS; i++)
-    cppm_channels[i] = 1500;
+  halPinMode(interrupt_to_pin[interrupt], INPUT);
+  halAttachInterrupt(interrupt_to_pin[interrupt],
+                     interrupt ? cppm_isr<3> : cppm_isr<2>, logic_direction);
 
-  cppm_read();
+  return true;
+}
+
+#if defined(HAL_CAPTURE_PIN)
+/**
+ * @brief Initialises CPPM decoder on the input capture pin.
+ *
+ * Edges are timestamped by the timer hardware with sub microsecond
+ * resolution, so values are not affected by micros() resolution or other
+ * interrupts delaying the ISR. The signal must be on HAL_CAPTURE_PIN.
+ * Available with HAL_TIMER1.
+ *
+ * @param logic_direction Logic direction for capture, must match TX
+ * @return True on successful initialisation
+ */
+bool cppm_init_capture(int logic_direction)
+{
+  if (logic_direction != FALLING && logic_direction != RISING)
+    return false;
+
+  cppm_reset();
 
-  pinMode(interrupt_to_pin[interrupt], INPUT);
-  attachInterrupt(interrupt, cppm_isr, logic_direction);
+  halAttachCapture(cppm_capture_isr, logic_direction);
 
   return true;
 }
+#endif
+
+/**
+ * @brief Gets the last complete frame.
+ *
+ * Safe to call at any time, takes constant time and does not disable
+ * interrupts.
+ *
+ * @param frame Frame to copy into
+ * @return True if a frame has been received since initialisation
+ */
+bool cppm_read_frame(CppmFrame &frame)
+{
+  uint8_t latest;
+
+  /*
+   * Claim the latest buffer. If the ISR published between reading and
+   * claiming it may have picked that buffer to write next, so try again.
+   */
+  do
+  {
+    latest = cppm_latest;
+    cppm_reading = latest;
+  } while (latest != cppm_latest);
+
+  halMemoryBarrier();
+  frame = cppm_buffers[latest];
+
+  return frame.sequence != 0;
+}
 
 /**
  * @brief Reads new values from CPPM decoder.
@@ -107,12 +424,43 @@ bool cppm_init(int interrupt, int logic_direction)
  */
 void cppm_read()
 {
-  noInterrupts();
+  CppmFrame frame;
+
+  cppm_fresh = false;
+  cppm_read_frame(frame);
 
   for (size_t i = 0; i < CPPM_NUM_CHANNELS; i++)
-    cppm_channels[i] = cppm_raw[i];
+    cppm_channels[i] = frame.channels[i];
+}
 
-  cppm_fresh = false;
+/**
+ * @brief Gets the learned signal parameters and frame counters.
+ * @param stats Statistics to copy into
+ * @return True if the decoder has been initialised
+ */
+bool cppm_read_stats(CppmStats &stats)
+{
+  return cppm_stats.read(stats);
+}
+
+/**
+ * @brief Checks if the CPPM input is too old to use.
+ *
+ * True before the first frame and when no good frame has arrived for
+ * CPPM_STALE_FRAMES frame periods, e.g. the signal was lost or is being
+ * rejected.
+ *
+ * @return True if the last frame is stale
+ */
+bool cppm_stale()
+{
+  CppmFrame frame;
+  CppmStats stats;
+
+  if (!cppm_read_frame(frame) || !cppm_read_stats(stats))
+    return true;
+
+  uint32_t period_us = stats.frameUs ? stats.frameUs : CPPM_US_DEFAULT_FRAME;
 
-  interrupts();
+  return halMicros() - frame.timeUs > CPPM_STALE_FRAMES * period_us;
 }
@@ -5,11 +5,17 @@
 
 /**
  * @def CPPM_NUM_CHANNELS
- * @brief Number of channels to be read by CPPM
+ * @brief Maximum number of channels to be read by CPPM
+ *
+ * The number actually sent is learned from the signal, further channels are
+ * ignored. Define when building to change it.
  */
-#define CPPM_NUM_CHANNELS 8
+#ifndef CPPM_NUM_CHANNELS
+#define CPPM_NUM_CHANNELS 12
+#endif
 
-#include <Arduino.h>
+#include "HAL.h"
+#include "Snapshot.h"
 
 /**
  * @var cppm_fresh
@@ -17,18 +23,54 @@
  *
  * Automatically reset on every call to cppm_read().
  */
-extern bool cppm_fresh;
+extern volatile bool cppm_fresh;
 
 /**
  * @var cppm_channels
  * @brief Array of timing values read form CPPM.
  *
  * Values are in microseconds and should range from around 1000 - 2000.
+ * Channels not sent by the TX read 1500.
  */
 extern int cppm_channels[CPPM_NUM_CHANNELS];
 
+/**
+ * @struct CppmFrame
+ * @brief A complete CPPM frame.
+ */
+struct CppmFrame
+{
+  uint32_t sequence;               //!< Number of the frame, 0 for none yet
+  uint32_t timeUs;                 //!< halMicros() at the end of the frame
+  uint8_t channelCount;            //!< Channels sent, up to CPPM_NUM_CHANNELS
+  int channels[CPPM_NUM_CHANNELS]; //!< Channel values in microseconds
+};
+
+/**
+ * @struct CppmStats
+ * @brief Parameters learned from the CPPM signal and frame counters.
+ *
+ * The frame rate is 1000000 / frameUs.
+ */
+struct CppmStats
+{
+  uint8_t channels;   //!< Channels per frame, 0 until learned
+  uint16_t frameUs;   //!< Average time between frames, 0 until measured
+  uint32_t frames;    //!< Frames published
+  uint32_t badFrames; //!< Frames rejected for a bad pulse or channel count
+  uint32_t dropped;   //!< Frames missing from the signal
+  uint32_t glitches;  //!< Edges gone before the interrupt handler ran
+};
+
 bool cppm_init(int interrupt, int logic_direction = FALLING);
 
+#if defined(HAL_CAPTURE_PIN)
+bool cppm_init_capture(int logic_direction = FALLING);
+#endif
+
 void cppm_read();
+bool cppm_read_frame(CppmFrame &frame);
+bool cppm_read_stats(CppmStats &stats);
+bool cppm_stale();
 
 #endif
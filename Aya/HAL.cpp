@@ -0,0 +1,101 @@
+/** @file */
+
+#include "HAL.h"
+
+#if defined(ARDUINO) && defined(HAL_CAPTURE_PIN)
+
+/**
+ * @var capture_isr
+ * @brief Handler called for each captured edge.
+ */
+void (*capture_isr)();
+
+ISR(TIMER1_CAPT_vect)
+{
+  capture_isr();
+}
+
+/**
+ * @brief Starts timestamping edges on HAL_CAPTURE_PIN.
+ * @param isr Handler called for each edge, reads halCaptureTicks()
+ * @param mode Edge to capture (RISING or FALLING)
+ */
+void halAttachCapture(void (*isr)(), int mode)
+{
+  capture_isr = isr;
+  pinMode(HAL_CAPTURE_PIN, INPUT);
+
+  // Normal mode, clk/8, noise canceller on
+  TCCR1A = 0;
+  TCCR1B = (1 << ICNC1) | (mode == RISING ? (1 << ICES1) : 0) | (1 << CS11);
+  TIFR1 = (1 << ICF1) | (1 << TOV1);
+  TIMSK1 |= 1 << ICIE1;
+}
+
+/**
+ * @brief Stops the input capture interrupt.
+ */
+void halDetachCapture()
+{
+  TIMSK1 &= ~(1 << ICIE1);
+}
+
+/**
+ * @var alarm_isr
+ * @brief Handler called when the alarm fires.
+ */
+void (*alarm_isr)();
+
+ISR(TIMER1_COMPA_vect)
+{
+  // One shot
+  TIMSK1 &= ~(1 << OCIE1A);
+  alarm_isr();
+}
+
+/**
+ * @brief Starts Timer1 for the alarm, keeping the input capture settings.
+ * @param isr Handler called when the alarm fires
+ */
+void halAttachAlarm(void (*isr)())
+{
+  alarm_isr = isr;
+
+  // Normal mode, clk/8
+  TCCR1A = 0;
+  TCCR1B = (TCCR1B & ((1 << ICNC1) | (1 << ICES1))) | (1 << CS11);
+  TIMSK1 &= ~(1 << OCIE1A);
+}
+
+/**
+ * @brief Stops the alarm.
+ */
+void halDetachAlarm()
+{
+  TIMSK1 &= ~(1 << OCIE1A);
+}
+
+/**
+ * @brief Fires the alarm handler once after a delay.
+ * @param us Delay in microseconds, up to HAL_ALARM_MAX_US
+ *
+ * Replaces an alarm that has not fired yet. A delay of 0 fires as soon as
+ * interrupts are enabled.
+ */
+void halSetAlarm(uint16_t us)
+{
+  uint16_t ticks = halUsToCaptureTicks(us);
+
+  // A compare value the timer is about to pass could be missed
+  if (ticks < 4)
+    ticks = 4;
+
+  uint8_t sreg = SREG;
+  noInterrupts();
+  OCR1A = TCNT1 + ticks;
+  TIFR1 = 1 << OCF1A;
+  TIMSK1 |= 1 << OCIE1A;
+  SREG = sreg;
+}
+
+#endif
@@ -0,0 +1,366 @@
+/** @file */
+
+#ifndef _HAL_AYA_H_
+#define _HAL_AYA_H_
+
+/*
+ * Hardware abstraction used by the library for GPIO, timing and interrupts.
+ *
+ * On Arduino these forward to the core. Elsewhere they are declared here and
+ * provided by the host platform (see extras/host), which also supplies the
+ * subset of the Arduino API the library uses (Serial, map(), PROGMEM, etc.).
+ */
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+
+inline uint32_t halMicros()
+{
+  return micros();
+}
+
+inline uint32_t halMillis()
+{
+  return millis();
+}
+
+inline void halDelay(uint32_t ms)
+{
+  delay(ms);
+}
+
+inline void halDelayMicroseconds(uint16_t us)
+{
+  delayMicroseconds(us);
+}
+
+inline void halPinMode(uint8_t pin, uint8_t mode)
+{
+  pinMode(pin, mode);
+}
+
+inline void halPinWrite(uint8_t pin, uint8_t level)
+{
+  digitalWrite(pin, level);
+}
+
+inline uint8_t halPinRead(uint8_t pin)
+{
+  return digitalRead(pin);
+}
+
+inline void halAttachInterrupt(uint8_t pin, void (*isr)(), int mode)
+{
+  attachInterrupt(digitalPinToInterrupt(pin), isr, mode);
+}
+
+inline void halDetachInterrupt(uint8_t pin)
+{
+  detachInterrupt(digitalPinToInterrupt(pin));
+}
+
+inline void halNoInterrupts()
+{
+  noInterrupts();
+}
+
+inline void halInterrupts()
+{
+  interrupts();
+}
+
+/**
+ * @brief Disables interrupts, returning whether they were enabled.
+ * @return State to pass to halRestoreInterrupts()
+ */
+inline uint8_t halSaveInterrupts()
+{
+#if defined(__AVR__)
+  uint8_t sreg = SREG;
+#else
+  uint8_t sreg = 1; // Taken as enabled
+#endif
+  noInterrupts();
+  return sreg;
+}
+
+/**
+ * @brief Enables interrupts again if they were before halSaveInterrupts().
+ * @param state State returned by halSaveInterrupts()
+ */
+inline void halRestoreInterrupts(uint8_t state)
+{
+#if defined(__AVR__)
+  SREG = state;
+#else
+  if (state)
+    interrupts();
+#endif
+}
+
+/**
+ * @brief Stops the compiler moving memory accesses across this point.
+ */
+inline void halMemoryBarrier()
+{
+  __asm__ __volatile__("" ::: "memory");
+}
+
+/*
+ * Sleep: idle mode, which keeps the timers and so halMicros(), the alarm and
+ * input capture running. Any interrupt wakes the CPU, at the latest the
+ * millis() tick every 1.024ms. The deeper modes stop Timer0 and Timer1.
+ */
+#if defined(__AVR__)
+#include <avr/sleep.h>
+
+/**
+ * @def HAL_SLEEP
+ * @brief Defined where halSleep() is available.
+ */
+#define HAL_SLEEP
+
+/**
+ * @brief Enables interrupts and sleeps until the next one.
+ *
+ * Call with interrupts disabled after checking there is nothing to do, an
+ * interrupt between the check and the sleep then wakes it straight away.
+ */
+inline void halSleep()
+{
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei(); // The next instruction runs before any interrupt
+  sleep_cpu();
+  sleep_disable();
+}
+#endif
+
+/*
+ * Storage: the AVR EEPROM. Writes are started by the hardware and complete in
+ * the background (~3.4ms a byte), halStorageReady() is true once the last has.
+ */
+#if defined(E2END)
+#include <avr/eeprom.h>
+
+/**
+ * @def HAL_STORAGE_SIZE
+ * @brief Bytes of non-volatile storage.
+ */
+#define HAL_STORAGE_SIZE (E2END + 1)
+
+inline void halStorageRead(uint16_t address, void *data, uint16_t len)
+{
+  eeprom_read_block(data, (const void *)address, len);
+}
+
+inline void halStorageWrite(uint16_t address, const void *data, uint16_t len)
+{
+  eeprom_write_block(data, (void *)address, len);
+}
+
+inline bool halStorageReady()
+{
+  return eeprom_is_ready();
+}
+#endif
+
+/*
+ * Input capture: edges on HAL_CAPTURE_PIN (ICP1) latch Timer1, which free runs
+ * at clk/8 (HAL_CAPTURE_HZ), so timestamps do not depend on interrupt
+ * latency. This takes over Timer1, it cannot be used alongside TimerOne, Servo
+ * or PWM on pins 9 and 10, so it is only built with HAL_TIMER1.
+ */
+
+/**
+ * @def HAL_TIMER1
+ * @brief Uses Timer1 for input capture and the alarm.
+ *
+ * Uncomment to enable, or define when building. Disabled, the Timer1
+ * interrupt vectors are left to other libraries, CPPM has only the pin
+ * interrupt decoder and the scheduler runs the task from scheduler_poll().
+ */
+// #define HAL_TIMER1
+
+#if defined(HAL_TIMER1)
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+#define HAL_CAPTURE_PIN 8
+#elif defined(__AVR_ATmega32U4__)
+#define HAL_CAPTURE_PIN 4
+#endif
+#endif
+
+#if defined(HAL_CAPTURE_PIN)
+
+/**
+ * @def HAL_CAPTURE_HZ
+ * @brief Input capture timer ticks per second, 2MHz at 16MHz and 1MHz at 8MHz.
+ */
+#define HAL_CAPTURE_HZ (F_CPU / 8)
+
+void halAttachCapture(void (*isr)(), int mode);
+void halDetachCapture();
+
+/**
+ * @brief Gets the timer value latched by the last captured edge.
+ */
+inline uint16_t halCaptureTicks()
+{
+  return ICR1;
+}
+
+/**
+ * @brief Checks if the capture timer has wrapped since the flag was cleared.
+ */
+inline bool halCaptureWrapped()
+{
+  return TIFR1 & (1 << TOV1);
+}
+
+inline void halCaptureClearWrapped()
+{
+  TIFR1 = 1 << TOV1;
+}
+
+/*
+ * Alarm: a one shot interrupt from Timer1 compare A, on the same free running
+ * timer as input capture.
+ */
+
+/**
+ * @def HAL_ALARM_MAX_US
+ * @brief Longest delay that can be passed to halSetAlarm().
+ */
+#define HAL_ALARM_MAX_US (0x7FFFUL * 1000 / (HAL_CAPTURE_HZ / 1000))
+
+void halAttachAlarm(void (*isr)());
+void halDetachAlarm();
+void halSetAlarm(uint16_t us);
+
+#endif
+
+#else
+
+#include <HostPlatform.h>
+
+uint32_t halMicros();
+uint32_t halMillis();
+void halDelay(uint32_t ms);
+void halDelayMicroseconds(uint16_t us);
+
+void halPinMode(uint8_t pin, uint8_t mode);
+void halPinWrite(uint8_t pin, uint8_t level);
+uint8_t halPinRead(uint8_t pin);
+
+/*
+ * Any pin may have an interrupt on the host, this also stands in for pin
+ * change interrupts (mode CHANGE).
+ */
+void halAttachInterrupt(uint8_t pin, void (*isr)(), int mode);
+void halDetachInterrupt(uint8_t pin);
+void halNoInterrupts();
+void halInterrupts();
+uint8_t halSaveInterrupts();
+void halRestoreInterrupts(uint8_t state);
+
+/*
+ * Stand in for the AVR input capture unit: edges on HAL_CAPTURE_PIN latch a
+ * 16 bit timer running at HAL_CAPTURE_HZ, that of a 16MHz AVR unless set when
+ * building.
+ */
+#define HAL_CAPTURE_PIN 8
+#if !defined(HAL_CAPTURE_HZ)
+#define HAL_CAPTURE_HZ 2000000
+#endif
+
+void halAttachCapture(void (*isr)(), int mode);
+void halDetachCapture();
+uint16_t halCaptureTicks();
+bool halCaptureWrapped();
+void halCaptureClearWrapped();
+
+/*
+ * Stand in for the AVR timer compare interrupt: a one shot alarm on the
+ * virtual clock.
+ */
+#define HAL_ALARM_MAX_US (0x7FFFUL * 1000 / (HAL_CAPTURE_HZ / 1000))
+
+void halAttachAlarm(void (*isr)());
+void halDetachAlarm();
+void halSetAlarm(uint16_t us);
+
+/*
+ * Stand in for the EEPROM, kept across hostReset() like non-volatile memory.
+ * Each byte written keeps it busy for as long as on an AVR.
+ */
+#define HAL_STORAGE_SIZE 1024
+
+/*
+ * Stand in for idle sleep: the virtual clock runs to the next interrupt, at
+ * the latest the next millis() tick as on an AVR.
+ */
+#define HAL_SLEEP
+
+void halSleep();
+
+void halStorageRead(uint16_t address, void *data, uint16_t len);
+void halStorageWrite(uint16_t address, const void *data, uint16_t len);
+bool halStorageReady();
+
+inline void halMemoryBarrier()
+{
+  __sync_synchronize();
+}
+
+#endif
+
+#if defined(HAL_CAPTURE_HZ)
+/**
+ * @brief Converts capture timer ticks to microseconds, rounded.
+ *
+ * A division by a constant where the timer runs at a whole number of MHz,
+ * otherwise 32 bit arithmetic.
+ */
+inline uint16_t halCaptureTicksToUs(uint16_t ticks)
+{
+#if HAL_CAPTURE_HZ % 1000000 == 0
+  return (ticks + HAL_CAPTURE_HZ / 2000000) / (HAL_CAPTURE_HZ / 1000000);
+#else
+  return ((uint32_t)ticks * 1000 + HAL_CAPTURE_HZ / 2000) /
+         (HAL_CAPTURE_HZ / 1000);
+#endif
+}
+
+/**
+ * @brief Converts microseconds, up to HAL_ALARM_MAX_US, to capture timer
+ * ticks.
+ */
+inline uint16_t halUsToCaptureTicks(uint16_t us)
+{
+#if HAL_CAPTURE_HZ % 1000000 == 0
+  return us * (uint16_t)(HAL_CAPTURE_HZ / 1000000);
+#else
+  return (uint32_t)us * (HAL_CAPTURE_HZ / 1000) / 1000;
+#endif
+}
+#endif
+
+/**
+ * @brief Compares two halMicros() or halMillis() times.
+ *
+ * Correct across the wrap around of the counter (~71 minutes for halMicros())
+ * as long as the times are less than half its range apart.
+ *
+ * @param a Time
+ * @param b Time
+ * @return True if a is later than b
+ */
+inline bool halTimeAfter(uint32_t a, uint32_t b)
+{
+  return (int32_t)(a - b) > 0;
+}
+
+#include "HalPin.h"
+
+#endif
@@ -0,0 +1,317 @@
+/** @file */
+
+#ifndef _HAL_PIN_AYA_H_
+#define _HAL_PIN_AYA_H_
+
+/*
+ * Digital pins fixed when building. HalPin<Pin> looks the port and bit of an
+ * Arduino pin up in a table at compile time, so each access compiles to a
+ * single sbi, cbi or sbic instruction on the port registers instead of the
+ * table walks of digitalWrite() (~10x slower). Ports beyond the I/O space (H,
+ * J, K and L on the ATmega2560) are read-modified-written with interrupts off.
+ *
+ * Included by HAL.h. Where the pins of a board are not mapped here, and on the
+ * host, HalPin forwards to halPinWrite() and the others.
+ */
+
+/**
+ * @def HAL_NO_PIN
+ * @brief Pin number for an unconnected pin.
+ */
+#define HAL_NO_PIN 0xFF
+
+#if defined(ARDUINO) && defined(__AVR__)
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+#define HAL_PIN_DIRECT
+
+/**
+ * @var hal_pin_port
+ * @brief Port letter of each Arduino pin.
+ */
+constexpr char hal_pin_port[] = {
+    'D', 'D', 'D', 'D', 'D', 'D', 'D', 'D', // 0-7
+    'B', 'B', 'B', 'B', 'B', 'B',           // 8-13
+    'C', 'C', 'C', 'C', 'C', 'C',           // A0-A5
+};
+
+/**
+ * @var hal_pin_bit
+ * @brief Bit of each Arduino pin in its port.
+ */
+constexpr uint8_t hal_pin_bit[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, // 0-7
+    0, 1, 2, 3, 4, 5,       // 8-13
+    0, 1, 2, 3, 4, 5,       // A0-A5
+};
+
+/**
+ * @def HAL_PIN_PCINT
+ * @brief Pin change interrupt group (PCINTn_vect) of an Arduino pin, -1 if
+ * it has none. A constant expression for #if.
+ */
+#define HAL_PIN_PCINT(pin)                                                   \
+  ((pin) <= 7 ? 2 : (pin) <= 13 ? 0 : (pin) <= 19 ? 1 : -1)
+#elif defined(__AVR_ATmega32U4__)
+#define HAL_PIN_DIRECT
+
+// Leonardo, Micro and Pro Micro numbering
+constexpr char hal_pin_port[] = {
+    'D', 'D', 'D', 'D', 'D', 'C', 'D', 'E', // 0-7
+    'B', 'B', 'B', 'B', 'D', 'C',           // 8-13
+    'B', 'B', 'B', 'B',                     // MISO, SCK, MOSI, SS
+    'F', 'F', 'F', 'F', 'F', 'F',           // A0-A5
+    'D', 'D', 'B', 'B', 'B', 'D',           // A6-A11 (4, 6, 8, 9, 10, 12)
+    'D',                                    // TX LED
+};
+
+constexpr uint8_t hal_pin_bit[] = {
+    2, 3, 1, 0, 4, 6, 7, 6, // 0-7
+    4, 5, 6, 7, 6, 7,       // 8-13
+    3, 1, 2, 0,             // MISO, SCK, MOSI, SS
+    7, 6, 5, 4, 1, 0,       // A0-A5
+    4, 7, 4, 5, 6, 6,       // A6-A11
+    5,                      // TX LED
+};
+
+// Only port B has pin change interrupts
+#define HAL_PIN_PCINT(pin)                                                   \
+  (((pin) >= 8 && (pin) <= 11) || ((pin) >= 14 && (pin) <= 17) ||            \
+           ((pin) >= 26 && (pin) <= 28)                                       \
+       ? 0                                                                    \
+       : -1)
+#elif defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+#define HAL_PIN_DIRECT
+
+// Mega numbering
+constexpr char hal_pin_port[] = {
+    'E', 'E', 'E', 'E', 'G', 'E', 'H', 'H', // 0-7
+    'H', 'H', 'B', 'B', 'B', 'B', 'J', 'J', // 8-15
+    'H', 'H', 'D', 'D', 'D', 'D', 'A', 'A', // 16-23
+    'A', 'A', 'A', 'A', 'A', 'A', 'C', 'C', // 24-31
+    'C', 'C', 'C', 'C', 'C', 'C', 'D', 'G', // 32-39
+    'G', 'G', 'L', 'L', 'L', 'L', 'L', 'L', // 40-47
+    'L', 'L', 'B', 'B', 'B', 'B', 'F', 'F', // 48-55
+    'F', 'F', 'F', 'F', 'F', 'F', 'K', 'K', // 56-63
+    'K', 'K', 'K', 'K', 'K', 'K',           // 64-69
+};
+
+constexpr uint8_t hal_pin_bit[] = {
+    0, 1, 4, 5, 5, 3, 3, 4, // 0-7
+    5, 6, 4, 5, 6, 7, 1, 0, // 8-15
+    1, 0, 3, 2, 1, 0, 0, 1, // 16-23
+    2, 3, 4, 5, 6, 7, 7, 6, // 24-31
+    5, 4, 3, 2, 1, 0, 7, 2, // 32-39
+    1, 0, 7, 6, 5, 4, 3, 2, // 40-47
+    1, 0, 3, 2, 1, 0, 0, 1, // 48-55
+    2, 3, 4, 5, 6, 7, 0, 1, // 56-63
+    2, 3, 4, 5, 6, 7,       // 64-69
+};
+
+// Port B, then E0 and J0-J1, then port K
+#define HAL_PIN_PCINT(pin)                                                   \
+  (((pin) >= 10 && (pin) <= 13) || ((pin) >= 50 && (pin) <= 53) ? 0          \
+   : (pin) == 0 || (pin) == 14 || (pin) == 15                    ? 1          \
+   : (pin) >= 62 && (pin) <= 69                                  ? 2          \
+                                                                 : -1)
+#endif
+#endif
+
+#if defined(HAL_PIN_DIRECT)
+/**
+ * @struct HalPort
+ * @brief Registers of a port.
+ * @tparam Letter Port letter
+ */
+template <char Letter>
+struct HalPort;
+
+/*
+ * Specialised for each port the MCU has. io is true for ports in the I/O
+ * space, where a single bit can be set or cleared in one instruction.
+ */
+#define HAL_PORT(letter, port, in, ddr, io)                                 \
+  template <>                                                               \
+  struct HalPort<letter>                                                    \
+  {                                                                         \
+    static volatile uint8_t &out()                                          \
+    {                                                                       \
+      return port;                                                          \
+    }                                                                       \
+    static volatile uint8_t &input()                                        \
+    {                                                                       \
+      return in;                                                            \
+    }                                                                       \
+    static volatile uint8_t &direction()                                    \
+    {                                                                       \
+      return ddr;                                                           \
+    }                                                                       \
+    static const bool bitAccess = io;                                       \
+  };
+
+#if defined(PORTA)
+HAL_PORT('A', PORTA, PINA, DDRA, true)
+#endif
+#if defined(PORTB)
+HAL_PORT('B', PORTB, PINB, DDRB, true)
+#endif
+#if defined(PORTC)
+HAL_PORT('C', PORTC, PINC, DDRC, true)
+#endif
+#if defined(PORTD)
+HAL_PORT('D', PORTD, PIND, DDRD, true)
+#endif
+#if defined(PORTE)
+HAL_PORT('E', PORTE, PINE, DDRE, true)
+#endif
+#if defined(PORTF)
+HAL_PORT('F', PORTF, PINF, DDRF, true)
+#endif
+#if defined(PORTG)
+HAL_PORT('G', PORTG, PING, DDRG, true)
+#endif
+#if defined(PORTH)
+HAL_PORT('H', PORTH, PINH, DDRH, false)
+#endif
+#if defined(PORTJ)
+HAL_PORT('J', PORTJ, PINJ, DDRJ, false)
+#endif
+#if defined(PORTK)
+HAL_PORT('K', PORTK, PINK, DDRK, false)
+#endif
+#if defined(PORTL)
+HAL_PORT('L', PORTL, PINL, DDRL, false)
+#endif
+
+#undef HAL_PORT
+
+/**
+ * @brief Sets bits of a port register, atomically.
+ * @tparam Port HalPort the register belongs to
+ */
+template <typename Port>
+inline void halPortSet(volatile uint8_t &reg, uint8_t mask)
+{
+  if (Port::bitAccess)
+    reg |= mask;
+  else
+  {
+    uint8_t sreg = SREG;
+    cli();
+    reg |= mask;
+    SREG = sreg;
+  }
+}
+
+/**
+ * @brief Clears bits of a port register, atomically.
+ * @tparam Port HalPort the register belongs to
+ */
+template <typename Port>
+inline void halPortClear(volatile uint8_t &reg, uint8_t mask)
+{
+  if (Port::bitAccess)
+    reg &= ~mask;
+  else
+  {
+    uint8_t sreg = SREG;
+    cli();
+    reg &= ~mask;
+    SREG = sreg;
+  }
+}
+#endif
+
+/**
+ * @struct HalPin
+ * @brief A digital pin fixed when building.
+ *
+ * Works on the port registers where HAL_PIN_DIRECT is defined, elsewhere
+ * forwards to halPinWrite() and the others. Modes are those of halPinMode()
+ * without the pull-up, input() turns the pull-up off. HalPin<HAL_NO_PIN>
+ * does nothing and reads low.
+ *
+ * @tparam Pin Arduino pin number
+ */
+template <uint8_t Pin>
+struct HalPin
+{
+#if defined(HAL_PIN_DIRECT)
+  static_assert(Pin < sizeof(hal_pin_port), "Pin is not mapped for this MCU");
+
+  typedef HalPort<hal_pin_port[Pin]> Port;
+  static const uint8_t MASK = 1 << hal_pin_bit[Pin];
+#endif
+
+  static void high()
+  {
+#if defined(HAL_PIN_DIRECT)
+    halPortSet<Port>(Port::out(), MASK);
+#else
+    halPinWrite(Pin, HIGH);
+#endif
+  }
+
+  static void low()
+  {
+#if defined(HAL_PIN_DIRECT)
+    halPortClear<Port>(Port::out(), MASK);
+#else
+    halPinWrite(Pin, LOW);
+#endif
+  }
+
+  static bool read()
+  {
+#if defined(HAL_PIN_DIRECT)
+    return Port::input() & MASK;
+#else
+    return halPinRead(Pin) == HIGH;
+#endif
+  }
+
+  static void output()
+  {
+#if defined(HAL_PIN_DIRECT)
+    halPortSet<Port>(Port::direction(), MASK);
+#else
+    halPinMode(Pin, OUTPUT);
+#endif
+  }
+
+  static void input()
+  {
+#if defined(HAL_PIN_DIRECT)
+    halPortClear<Port>(Port::direction(), MASK);
+    halPortClear<Port>(Port::out(), MASK);
+#else
+    halPinMode(Pin, INPUT);
+#endif
+  }
+};
+
+template <>
+struct HalPin<HAL_NO_PIN>
+{
+  static void high()
+  {
+  }
+
+  static void low()
+  {
+  }
+
+  static bool read()
+  {
+    return false;
+  }
+
+  static void output()
+  {
+  }
+
+  static void input()
+  {
+  }
+};
+
+#endif
@@ -26,8 +26,11 @@
  if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
+
 #include "Hubsan.h"
 #include "A7105.h"
+#include "Trace.h"
 
 #define MIN_THROTTLE_US 1100
 
@@ -43,126 +46,791 @@
 #define FLAG_FLIP 0x08
 #define FLAG_LED 0x04
 
+/**
+ * @def FRAME_US
+ * @brief Length of a data frame: TX, TX completion and the telemetry window.
+ *
+ * The default, see setFrameTime().
+ */
+#define FRAME_US 13000
+
+/**
+ * @def BIND_ID
+ * @brief A7105 ID the bind handshake starts on.
+ */
+#define BIND_ID 0x55201041
+
+/**
+ * @def TX_TIMEOUT_US
+ * @brief Maximum time to wait for TX completion before checking the radio.
+ */
+#define TX_TIMEOUT_US 3000
+
+/**
+ * @def POLL_US
+ * @brief Interval at which the radio is checked while waiting for telemetry.
+ *
+ * With GIO1 the protocol is woken by a7105_wtr_event, so this and
+ * BUSY_RETRY_US are only timeouts.
+ */
+#if defined(GIO1_PIN)
+#define POLL_US FRAME_US
+#define BUSY_RETRY_US TX_TIMEOUT_US
+#else
+#define POLL_US 1000
+#define BUSY_RETRY_US 0
+#endif
+
+/**
+ * @def POLL_GUARD_US
+ * @brief Time before the end of a frame in which the radio is not polled,
+ * twice a poll over SPI.
+ */
+#define POLL_GUARD_US 100
+
+/**
+ * @def HUBSAN_SETUP_ATTEMPTS
+ * @brief Radio setup attempts before giving up.
+ *
+ * Each attempt costs a soft reset (~1ms) and the calibration timeouts.
+ */
+#define HUBSAN_SETUP_ATTEMPTS 100
+
+/**
+ * @def CAL_POLL_US
+ * @brief Interval at which a running calibration is checked.
+ */
+#define CAL_POLL_US 100
+
+/**
+ * @def SETUP_FAILED_US
+ * @brief Interval at which tx() returns once setup has failed.
+ */
+#define SETUP_FAILED_US 50000
+
+/**
+ * @def HUBSAN_SESSION_VERSION
+ * @brief Layout version of HubsanSession, change with the layout.
+ */
+#define HUBSAN_SESSION_VERSION 2
+
+/**
+ * @def HUBSAN_RESUME_TIMEOUT_MS
+ * @brief Time without telemetry after which a resumed session is given up.
+ *
+ * Only for models that sent telemetry in the stored session, several times
+ * their interval between telemetry packets (~100ms).
+ */
+#define HUBSAN_RESUME_TIMEOUT_MS 500
+
+/**
+ * @def HUBSAN_SURVEY_US
+ * @brief Default time budget of the channel survey at bind, none.
+ *
+ * The survey is opt-in, see StaticHubsan::setSurveyBudget(). A sweep of the 24
+ * channels takes ~6ms on a 16MHz AVR.
+ */
+#define HUBSAN_SURVEY_US 0
+
+/**
+ * @def SURVEY_SETTLE_US
+ * @brief Time in RX on a channel before its RSSI is read.
+ */
+#define SURVEY_SETTLE_US 200
+
+/**
+ * @def HUBSAN_LINK_WINDOW
+ * @brief Data frames per link quality window, ~0.65s.
+ */
+#define HUBSAN_LINK_WINDOW 50
+
+/**
+ * @def LINK_QUALITY_LOW
+ * @brief Link quality below which the power control steps up.
+ */
+#define LINK_QUALITY_LOW 70
+
+/**
+ * @def LINK_QUALITY_HIGH
+ * @brief Link quality from which the power control may step down.
+ */
+#define LINK_QUALITY_HIGH 95
+
+/**
+ * @def LINK_RSSI_WEAK
+ * @brief Telemetry RSSI reading above which the power control steps up.
+ */
+#define LINK_RSSI_WEAK 0xA0
+
+/**
+ * @def LINK_RSSI_STRONG
+ * @brief Telemetry RSSI reading below which the power control may step down.
+ */
+#define LINK_RSSI_STRONG 0x70
+
+/**
+ * @def LINK_LOSS_GAPS
+ * @brief Telemetry intervals without telemetry before stepping up at once.
+ */
+#define LINK_LOSS_GAPS 3
+
+/**
+ * @def LINK_GAP_WINDOWS
+ * @brief Windows without the learnt telemetry interval before it is relearnt
+ * from the longer gaps seen meanwhile, ~5s.
+ */
+#define LINK_GAP_WINDOWS 8
+
+/**
+ * @def DIVERSITY_RSSI_MARGIN
+ * @brief RSSI reading by which the other radio must be stronger to switch to
+ * it, when both received as much telemetry.
+ */
+#define DIVERSITY_RSSI_MARGIN 8
+
+/**
+ * @def POWER_HOLD_MIN
+ * @brief Good windows before the power control steps down.
+ *
+ * Doubled each time a step down loses the link, up to POWER_HOLD_MAX, so a
+ * level that is too weak is not retried often.
+ */
+#define POWER_HOLD_MIN 2
+#define POWER_HOLD_MAX 64
+
+/**
+ * @def SURVEY_START
+ * @brief m_surveyIndex before the survey's first step.
+ */
+#define SURVEY_START 0xFF
+
+/**
+ * @def SLEEP_MIN_US
+ * @brief Shortest wait the radio is put to sleep for, see setLowPower().
+ */
+#define SLEEP_MIN_US (2 * A7105_STANDBY_US)
+
+enum
+{
+  doTx,
+  waitTx,
+  pollRx,
+  skipRx
+};
+
+/**
+ * @var hubsanRegisters
+ * @brief A7105 configuration for Hubsan as (register, value) pairs.
+ */
+const uint8_t hubsanRegisters[] PROGMEM = {
+    A7105_01_MODE_CONTROL,  0x63,
+    A7105_03_FIFOI,         0x0f,
+    A7105_0D_CLOCK,         0x05,
+    A7105_0E_DATA_RATE,     0x04,
+    A7105_15_TX_II,         0x2b,
+    A7105_18_RX,            0x62,
+    A7105_19_RX_GAIN_I,     0x80,
+    A7105_1C_RX_GAIN_IV,    0x0A,
+    A7105_1F_CODE_I,        0x07,
+    A7105_20_CODE_II,       0x17,
+    A7105_29_RX_DEM_TEST_I, 0x47,
+};
+
+static_assert(sizeof(hubsanRegisters) % 2 == 0,
+              "hubsanRegisters must contain (register, value) pairs");
+
 const uint8_t hubsanAllowedChannels[] = {0x14, 0x1e, 0x28, 0x32, 0x3c, 0x46,
                                          0x50, 0x5a, 0x64, 0x6e, 0x78, 0x82};
 
+static_assert(sizeof(hubsanAllowedChannels) == HUBSAN_CHANNEL_COUNT,
+              "HUBSAN_CHANNEL_COUNT must match hubsanAllowedChannels");
+
 /**
  * @brief Creates a new instance of the Hubsan protocol.
- * @param id ID of this transmitter
+ * @param id ID of this transmitter, kept in full in the stored session, only
+ *           the low 16 bits are sent in packets
  * @param forceBind Ignore the last bind packet (fixes failing to bind)
  * @param vtxFreq Video transmission frequency in kHz (for FPV model
  */
-Hubsan::Hubsan(uint16_t id, bool forceBind, uint16_t vtxFreq)
-    : IProtocol()
+StaticHubsan::StaticHubsan(uint32_t id, bool forceBind, uint16_t vtxFreq)
+    : StaticProtocol<StaticHubsan>()
     , m_id(id)
     , m_state(BIND_1)
+    , m_telemetryState(doTx)
+    , m_vtxFreq(vtxFreq)
     , m_rssiChannel(0)
-    , m_enableFlip(true)
-    , m_enableLED(true)
-    , m_recordVideo(false)
+    , m_txPower(TXPOWER_150mW)
+    , m_powerControl(false)
+    , m_minPower(TXPOWER_100uW)
+    , m_activeControls(0)
+    , m_controlsVersion(0)
+    , m_txIsData{false, false}
+    , m_txNext(0)
+    , m_txPrepared(false)
+    // Indexed by ProtocolCommand, throttle is 0 up to MIN_THROTTLE_US
+    , m_scales{StickScale(MIN_THROTTLE_US, 2000), StickScale(1000, 2000),
+               StickScale(1000, 2000, true), StickScale(1000, 2000, true)}
     , m_forceBind(forceBind)
-    , m_vtxFreq(vtxFreq)
+    , m_surveyIndex(SURVEY_START)
+    , m_surveyBudgetUs(HUBSAN_SURVEY_US)
+    , m_surveyRetune(false)
+    , m_useStoredCal(false)
+    , m_storageAddress(HUBSAN_NO_STORAGE)
+    , m_storeIndex(sizeof(HubsanSession))
+    , m_resumePending(false)
+    , m_lowPower(false)
+    , m_radioAsleep(false)
+    , m_frameUs(FRAME_US)
+    , m_radios{NULL, NULL}
+    , m_setupRadio(0)
+    , m_txRadio(0)
+    , m_rxThisFrame(false)
 {
+  HubsanControls &controls = m_controls[m_activeControls];
+  memset(controls.sticks, 0, sizeof(controls.sticks));
+  controls.enableFlip = true;
+  controls.enableLED = true;
+  controls.recordVideo = false;
+
+  memset(&m_session, 0, sizeof(m_session));
 }
 
 /**
  * @copydoc IProtocol::setup
+ *
+ * Blocks until the radio is set up or HUBSAN_SETUP_ATTEMPTS attempts have
+ * failed. beginSetup() does the same from tx() without blocking.
  */
-bool Hubsan::setup()
+bool StaticHubsan::setup()
 {
-  bool retVal = false;
+  beginSetup();
 
-  a7105SetupSPI();
+  const HubsanSetupStatus &setup = m_setupStatus.value();
 
-  for (uint8_t i = 0; i < 100; i++)
+  while (setup.state != HUBSAN_SETUP_READY &&
+         setup.state != HUBSAN_SETUP_FAILED)
   {
-    if (this->initRadio())
-    {
-      retVal = true;
-      break;
-    }
+    uint16_t d = setupStep();
+    halDelay(d / 1000);
+    halDelayMicroseconds(d % 1000);
   }
 
-  return retVal;
+  return setup.state == HUBSAN_SETUP_READY;
+}
+
+/**
+ * @brief Starts setting up the radio from tx().
+ *
+ * Each call to tx() runs a step of the setup and returns the time until the
+ * next, so the sketch keeps running while the radio wakes up and calibrates.
+ * Binding starts once the radio is ready. Progress and the reason for
+ * failures are reported by getSetupStatus().
+ *
+ * Call before tx() is scheduled.
+ */
+void StaticHubsan::beginSetup()
+{
+  m_setupStartUs = halMicros();
+  m_radioAsleep = false; // Reset from scratch
+  m_setupRadio = 0;
+  m_txRadio = 0;
+
+  HubsanSetupStatus &setup = m_setupStatus.beginWrite();
+  setup.state = HUBSAN_SETUP_WAKEUP;
+  setup.error = HUBSAN_SETUP_OK;
+  setup.attempts = 0;
+  setup.elapsedUs = 0;
+  m_setupStatus.endWrite();
+
+  if (m_radios[1])
+  {
+    // Both CS high before talking to either
+    useRadio(1);
+    a7105SetupSPI(false);
+    useRadio(0);
+  }
+  a7105SetupSPI(false);
 }
 
 /**
  * @copydoc IProtocol::bind()
+ *
+ * Binding starts with a survey of the noise on each channel if
+ * setSurveyBudget() has given it time.
  */
-bool Hubsan::bind()
+bool StaticHubsan::bind()
 {
   m_sessionID = random();
   m_channel = hubsanAllowedChannels[random() % sizeof(hubsanAllowedChannels)];
   setBindState(0xffffffff);
-  m_state = BIND_1;
+  m_state = m_surveyBudgetUs ? SURVEY : BIND_1;
+  m_surveyIndex = SURVEY_START;
+  m_surveyRetune = false;
   m_packetCount = 0;
+  m_txPrepared = false;
+  m_resumePending = false;
+  m_txRadio = 0; // Bind on the first radio
+  buildPacketTemplate();
+  resetLink();
 
   return true;
 }
 
+/**
+ * @brief Flies on two radios, receiving on both and transmitting on the one
+ * that hears the model better.
+ *
+ * Both radios are set up and calibrated, binding and the survey use the
+ * first. In data frames both listen for telemetry. At the end of each window
+ * of HUBSAN_LINK_WINDOW frames the transmitting radio moves to the other if
+ * it received more telemetry, or as much but stronger by
+ * DIVERSITY_RSSI_MARGIN. When neither radio receives telemetry for
+ * LINK_LOSS_GAPS telemetry intervals, the model is not hearing this one and
+ * it moves at once. Only for models that send telemetry.
+ *
+ * The radios may share SCLK and SDIO. Call before setup(), not for use with
+ * HubsanSlots.
+ *
+ * @param first Radio to bind on, e.g. a7105Default()
+ * @param second The other radio
+ */
+void StaticHubsan::setDiversity(A7105RadioBase &first,
+                                A7105RadioBase &second)
+{
+  m_radios[0] = &first;
+  m_radios[1] = &second;
+}
+
+/**
+ * @brief Gets the use of the radios over the last window.
+ * @param diversity Diversity to copy into
+ * @return False if setDiversity() was not called or no window has ended
+ */
+bool StaticHubsan::getDiversity(HubsanDiversity &diversity) const
+{
+  return m_diversity.read(diversity) && diversity.windows;
+}
+
+/**
+ * @brief Puts the radio to sleep when it has nothing to do.
+ *
+ * The A7105 sleeps through the long waits of the bind and, once the
+ * telemetry interval is known, through the telemetry window of the data
+ * frames no telemetry is due in. It listens again from the frame before the
+ * next is due and every frame after one is missed. Each sleep ends
+ * A7105_STANDBY_US early so the radio is ready for the next packet.
+ *
+ * @param enable True to sleep the radio, off by default
+ */
+void StaticHubsan::setLowPower(bool enable)
+{
+  m_lowPower = enable;
+}
+
+/**
+ * @brief Sets the length of a data frame, the time between data packets.
+ *
+ * Shorter frames leave less time for telemetry: the packet, the model's
+ * turnaround and its reply take ~6ms. See HubsanSlots.
+ *
+ * @param us Frame length, FRAME_US (13ms) by default
+ */
+void StaticHubsan::setFrameTime(uint16_t us)
+{
+  m_frameUs = us;
+}
+
+/**
+ * @brief Sets the radio up for this instance, when it shares the radio.
+ *
+ * Writes the ID, code and TX power this instance's protocol state expects,
+ * which another instance may have changed. The channel is set with each
+ * packet.
+ */
+void StaticHubsan::selectRadio()
+{
+  uint8_t state = m_state & ~WAIT_WRITE;
+
+  // The survey goes on for a slot, on a channel it must tune again
+  m_sliceStartUs = halMicros();
+  m_surveyRetune = state == SURVEY && m_surveyIndex != SURVEY_START;
+
+  // The bind handshake moves to the model's ID from BIND_5
+  a7105WriteID(state < BIND_5 || state == SURVEY ? BIND_ID : m_modelID);
+  a7105WriteReg(A7105_1F_CODE_I, bound() ? 0x0F : 0x07);
+  a7105SetPower(m_txPower);
+}
+
+/**
+ * @brief Checks if tx() has finished a radio exchange.
+ *
+ * True between a data frame and the next, and before each bind packet, when
+ * the radio can serve another instance until the next call to tx(). In the
+ * channel survey, once a step would run past a frame from selectRadio(), so
+ * the survey takes its turn like a data frame. The setup is not shared, the
+ * radio is of no use to other instances before it is set up.
+ */
+bool StaticHubsan::exchangeDone() const
+{
+  uint8_t setupState = m_setupStatus.value().state;
+  if (setupState != HUBSAN_SETUP_IDLE && setupState != HUBSAN_SETUP_READY)
+    return false;
+
+  switch (m_state)
+  {
+  case BIND_1:
+  case BIND_3:
+  case BIND_5:
+  case BIND_7:
+  case RESUME:
+    return true;
+  case SURVEY:
+    return halTimeAfter(halMicros() + SURVEY_SETTLE_US,
+                        m_sliceStartUs + m_frameUs);
+  case DATA_1:
+  case DATA_2:
+  case DATA_3:
+  case DATA_4:
+  case DATA_5:
+    return m_telemetryState == doTx;
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Wakes the radio if this instance put it to sleep.
+ *
+ * Called when the radio passes to another instance, see exchangeDone().
+ *
+ * @return Time until the radio can TX or RX
+ */
+uint16_t StaticHubsan::releaseRadio()
+{
+  if (!m_radioAsleep)
+    return 0;
+
+  a7105Strobe(A7105_STANDBY);
+  m_radioAsleep = false;
+
+  return A7105_STANDBY_US;
+}
+
+/**
+ * @brief Checks if this instance is bound and sending data packets.
+ */
+bool StaticHubsan::bound() const
+{
+  return m_state >= DATA_1 && m_state <= DATA_5;
+}
+
+/**
+ * @brief Gets the link quality of the last window.
+ * @param link Link quality to copy into
+ * @return False if not yet bound
+ */
+bool StaticHubsan::getLinkQuality(HubsanLinkQuality &link) const
+{
+  return m_linkQuality.read(link);
+}
+
+/**
+ * @brief Lowers the TX power to what the link needs, from telemetry.
+ * @param enable False for a fixed TXPOWER_150mW, as without it
+ * @param minPower Lowest A7105_TxPower to use
+ *
+ * Steps up at once when the link quality or telemetry RSSI drops or the
+ * telemetry stops, and down a step at a time while both have a margin. Stays
+ * at the power in use with models that send no telemetry.
+ */
+void StaticHubsan::setPowerControl(bool enable, uint8_t minPower)
+{
+  m_minPower = min(minPower, (uint8_t)TXPOWER_150mW);
+  m_powerControl = enable;
+
+  if (!enable)
+    m_txPower = TXPOWER_150mW;
+}
+
+/**
+ * @brief Sets the time the channel survey at bind may take.
+ * @param us Time budget, 0 to pick a channel at random without a survey
+ *
+ * The survey samples the RSSI of each data channel and its DATA_5 alternate
+ * (channel + 0x23) in turn until the budget is spent, then binds on the pair
+ * whose louder channel is quietest. Takes effect from the next bind(). Off
+ * by default, ~20ms covers three sweeps. Beside other models in HubsanSlots
+ * it only samples in its own slots.
+ */
+void StaticHubsan::setSurveyBudget(uint16_t us)
+{
+  m_surveyBudgetUs = us;
+}
+
+/**
+ * @brief Gets the noise table of the last channel survey.
+ * @param survey Survey to copy into
+ * @return False if no survey has finished, or one is running
+ */
+bool StaticHubsan::getSurvey(HubsanSurvey &survey) const
+{
+  // The channel is only set once the survey is over
+  return m_surveyResult.read(survey) && survey.channel;
+}
+
+/**
+ * @brief Gets the CRC-8 (polynomial 0x07) of a stored session.
+ *
+ * Unlike a sum, catches swapped and multiple changed bytes, e.g. a record
+ * half overwritten by another sketch.
+ */
+static uint8_t sessionChecksum(const HubsanSession &session)
+{
+  const uint8_t *p = (const uint8_t *)&session;
+  uint8_t crc = 0;
+
+  for (uint8_t i = 0; i < offsetof(HubsanSession, checksum); i++)
+  {
+    crc ^= p[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+
+  return crc;
+}
+
+/**
+ * @brief Keeps the bind session in HAL storage, for resume().
+ * @param address Storage address of a HubsanSession, or HUBSAN_NO_STORAGE
+ *
+ * The session is saved from tx() once bound. Each instance needs its own
+ * address. Ignored where the HAL has no storage (HAL_STORAGE_SIZE).
+ */
+void StaticHubsan::setStorage(uint16_t address)
+{
+#if defined(HAL_STORAGE_SIZE)
+  if (address != HUBSAN_NO_STORAGE &&
+      (uint32_t)address + sizeof(HubsanSession) > HAL_STORAGE_SIZE)
+    address = HUBSAN_NO_STORAGE;
+
+  m_storageAddress = address;
+#endif
+}
+
+/**
+ * @brief Resumes the stored session instead of binding.
+ * @return False if there is no valid session for this ID, call bind()
+ *
+ * For a transmitter restarted while the model stayed powered and bound. Call
+ * instead of bind(), before tx() is scheduled. Data packets are sent as soon
+ * as the radio is set up, which skips calibration for the stored values if
+ * it has not yet started.
+ *
+ * If the model sent telemetry in the stored session but sends none within
+ * HUBSAN_RESUME_TIMEOUT_MS, tx() forgets the session, sets up the radio
+ * again and binds.
+ */
+bool StaticHubsan::resume()
+{
+#if defined(HAL_STORAGE_SIZE)
+  HubsanSession session;
+
+  if (m_storageAddress == HUBSAN_NO_STORAGE)
+    return false;
+
+  halStorageRead(m_storageAddress, &session, sizeof(session));
+
+  if (session.version != HUBSAN_SESSION_VERSION || session.txID != m_id ||
+      session.checksum != sessionChecksum(session))
+    return false;
+
+  m_session = session;
+  m_storeIndex = sizeof(m_session);
+  m_sessionID = session.sessionID;
+  m_modelID = session.modelID;
+  m_channel = session.channel;
+  memcpy(m_calibration, session.calibration, sizeof(m_calibration));
+  m_useStoredCal = true;
+
+  m_state = RESUME;
+  m_telemetryState = doTx;
+  m_txPrepared = false;
+  m_resumePending = session.telemetry;
+  buildPacketTemplate();
+  resetLink();
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Invalidates the stored session, so resume() fails until bound again.
+ *
+ * Writes to storage before returning, waiting for any write in progress
+ * (up to ~3.4ms on the EEPROM).
+ */
+void StaticHubsan::forgetSession()
+{
+  m_session.version = 0;
+  m_storeIndex = sizeof(m_session);
+
+#if defined(HAL_STORAGE_SIZE)
+  uint8_t stored;
+
+  if (m_storageAddress == HUBSAN_NO_STORAGE)
+    return;
+
+  // Not left to storeSessionStep(), the transmitter may be switched off
+  // before the next tx()
+  halStorageRead(m_storageAddress, &stored, 1);
+  if (stored != m_session.version)
+    halStorageWrite(m_storageAddress, &m_session.version, 1);
+#endif
+}
+
 /**
  * @copydoc IProtocol::setCommand
  */
-bool Hubsan::setCommand(ProtocolCommand command, uint16_t value)
+bool StaticHubsan::setCommand(ProtocolCommand command, uint16_t value)
 {
+  HubsanControls &controls = nextControls();
+  controls = m_controls[m_activeControls];
+
   switch (command)
   {
   case COMMAND_THROTTLE:
-    if (value < MIN_THROTTLE_US)
-      value = MIN_THROTTLE_US;
-    m_sticks[COMMAND_THROTTLE] = map(value, MIN_THROTTLE_US, 2000, 0, 255);
-    break;
   case COMMAND_YAW:
-    m_sticks[command] = map(value, 1000, 2000, 0, 255);
-    break;
   case COMMAND_PITCH:
   case COMMAND_ROLL:
-    m_sticks[command] = map(value, 1000, 2000, 255, 0);
+    controls.sticks[command] = m_scales[command].apply(value);
     break;
   case COMMAND_FLIPS:
-    m_enableFlip = value > 1800;
+    controls.enableFlip = value > 1800;
     break;
   case COMMAND_LIGHTS:
-    m_enableLED = value <= 1800;
+    controls.enableLED = value <= 1800;
     break;
   case COMMAND_VIDEO:
-    m_recordVideo = value > 1800;
+    controls.recordVideo = value > 1800;
     break;
   default:
     return false;
   }
 
+  publishControls();
+
+  return true;
+}
+
+/**
+ * @copydoc IProtocol::setCommands
+ */
+bool StaticHubsan::setCommands(const uint16_t values[COMMAND_COUNT])
+{
+  HubsanControls &controls = nextControls();
+
+  for (uint8_t i = COMMAND_THROTTLE; i <= COMMAND_ROLL; i++)
+    controls.sticks[i] = m_scales[i].apply(values[i]);
+
+  controls.enableFlip = values[COMMAND_FLIPS] > 1800;
+  controls.enableLED = values[COMMAND_LIGHTS] <= 1800;
+  controls.recordVideo = values[COMMAND_VIDEO] > 1800;
+
+  publishControls();
+
+  return true;
+}
+
+/**
+ * @brief Gets the control buffer not being sent, to be filled and published.
+ *
+ * Controls are double buffered: tx() only reads the active buffer, so it may
+ * run from an interrupt while the other buffer is being filled. Commands must
+ * all be set from the same context.
+ */
+HubsanControls &StaticHubsan::nextControls()
+{
+  return m_controls[m_activeControls ^ 1];
+}
+
+/**
+ * @brief Makes the buffer from nextControls() the one sent by tx().
+ */
+void StaticHubsan::publishControls()
+{
+  halMemoryBarrier();
+  m_activeControls ^= 1;
+  m_controlsVersion++;
+}
+
+/**
+ * @brief Sets the endpoints, direction and expo of a stick.
+ * @param command Stick to set (throttle, yaw, pitch or roll)
+ * @param scale Scale to convert the stick with
+ * @return True if command is a stick
+ *
+ * Takes effect from the next setCommand() for the stick.
+ */
+bool StaticHubsan::setStickScale(ProtocolCommand command,
+                                 const StickScale &scale)
+{
+  if (command > COMMAND_ROLL)
+    return false;
+
+  m_scales[command] = scale;
+
   return true;
 }
 
 /**
  * @copydoc IProtocol::tx
  */
-uint16_t Hubsan::tx()
+uint16_t StaticHubsan::tx()
 {
-  enum
+  uint16_t d;
+
+  a7105_wtr_event = false;
+
+  uint8_t setupState = m_setupStatus.value().state;
+  if (setupState != HUBSAN_SETUP_IDLE && setupState != HUBSAN_SETUP_READY)
   {
-    doTx,
-    waitTx,
-    pollRx
-  };
+    TRACE(TRACE_SETUP, setupState, 0);
+    d = setupStep();
+    TRACE(TRACE_DELAY, d & 0xFF, d >> 8);
+    return d;
+  }
 
-  uint16_t d;
-  static uint8_t telemetryState = doTx;
-  static uint8_t polls, i;
+  useRadio(m_txRadio);
 
-  Serial.println(m_state);
+  // Wake the radio ahead of its next packet, see sleepRadio()
+  if (m_radioAsleep)
+  {
+    a7105Strobe(A7105_STANDBY);
+    m_radioAsleep = false;
+    return A7105_STANDBY_US;
+  }
+
+  TRACE(TRACE_STATE, m_state, m_telemetryState);
 
   switch (m_state)
   {
+  case SURVEY:
+    d = surveyStep();
+    break;
   case BIND_1:
   case BIND_3:
   case BIND_5:
   case BIND_7:
-    buildBindPacket(
-        m_state == BIND_7 ? 9 : (m_state == BIND_5 ? 1 : m_state + 1 - BIND_1));
+    buildBindPacket(m_txPackets[m_txNext],
+                    m_state == BIND_7 ? 9
+                                      : (m_state == BIND_5 ? 1
+                                                           : m_state + 1 - BIND_1));
+    m_txIsData[m_txNext] = false;
+    a7105SetPower(m_txPower);
     a7105Strobe(A7105_STANDBY);
-    a7105WriteData(a7105_packet, 16, m_channel);
+    a7105WriteData(m_txPackets[m_txNext], 16, m_channel);
     m_state |= WAIT_WRITE;
     d = 3000;
     break;
@@ -181,16 +849,20 @@ uint16_t Hubsan::tx()
     if (a7105Busy())
     {
       m_state = BIND_1;
-      d = 4500; // No signal, restart binding procedure.  12mS elapsed since
-                // last write
+      d = sleepRadio(4500); // No signal, restart binding procedure.  12mS
+                            // elapsed since last write
     }
     else
     {
-      a7105ReadData(a7105_packet, 16);
+      a7105ReadData(m_rxPacket, 16);
       m_state++;
       if (m_state == BIND_5)
-        a7105WriteID((a7105_packet[2] << 24) | (a7105_packet[3] << 16) |
-                     (a7105_packet[4] << 8) | a7105_packet[5]);
+      {
+        m_modelID = ((uint32_t)m_rxPacket[2] << 24) |
+                    ((uint32_t)m_rxPacket[3] << 16) |
+                    (m_rxPacket[4] << 8) | m_rxPacket[5];
+        a7105WriteID(m_modelID);
+      }
       d = 500; // 8mS elapsed time since last write
     }
     break;
@@ -198,161 +870,487 @@ uint16_t Hubsan::tx()
     if (a7105Busy() && !m_forceBind)
     {
       m_state = BIND_7;
-      d = 15000; // 22.5mS elapsed since last write
+      d = sleepRadio(15000); // 22.5mS elapsed since last write
     }
     else
     {
-      a7105ReadData(a7105_packet, 16);
-      if (a7105_packet[1] == 9 || m_forceBind)
+      a7105ReadData(m_rxPacket, 16);
+      if (m_rxPacket[1] == 9 || m_forceBind)
       {
         m_state = DATA_1;
         a7105WriteReg(A7105_1F_CODE_I, 0x0F);
+        bindOtherRadio();
         setBindState(0);
-        d = 28000; // 35.5mS elapsed since last write
+        saveSession();
+        d = sleepRadio(28000); // 35.5mS elapsed since last write
       }
       else
       {
         m_state = BIND_7;
-        d = 15000; // 22.5 mS elapsed since last write
+        d = sleepRadio(15000); // 22.5 mS elapsed since last write
       }
     }
     break;
+  case RESUME:
+    // The model already has the session, straight to data packets
+    a7105WriteID(m_modelID);
+    a7105WriteReg(A7105_1F_CODE_I, 0x0F);
+    bindOtherRadio();
+    setBindState(0);
+    m_state = DATA_1;
+    m_packetCount = 101; // Past the default flags and vTX packet
+    m_resumeMs = halMillis();
+    d = 0;
+    break;
   case DATA_1:
-    a7105SetPower(TXPOWER_150mW); // keep transmit power in sync
+    a7105SetPower(m_txPower); // keep transmit power in sync
   case DATA_2:
   case DATA_3:
   case DATA_4:
   case DATA_5:
-    switch (telemetryState)
+    switch (m_telemetryState)
     { // Goebish - telemetry is every ~0.1S r 10 Tx packets
     case doTx:
-      buildPacket();
+      if (m_resumePending &&
+          halMillis() - m_resumeMs > HUBSAN_RESUME_TIMEOUT_MS)
+      {
+        // The model did not keep the session, start again from scratch
+        forgetSession();
+        m_useStoredCal = false;
+        beginSetup();
+        bind();
+        d = 0;
+        break;
+      }
+
+      // Normally built during the last frame, unless the controls changed
+      if (!m_txPrepared || m_txVersion != m_controlsVersion)
+        buildPacket(m_txNext);
       a7105Strobe(A7105_STANDBY);
-      a7105WriteData(a7105_packet, 16,
+      a7105WriteData(m_txPackets[m_txNext], 16,
                      m_state == DATA_5 ? m_channel + 0x23 : m_channel);
-      d = 3000; // nominal tx time
-      telemetryState = waitTx;
+      tuneOtherRadio(m_state == DATA_5 ? m_channel + 0x23 : m_channel);
+      m_frameStartUs = halMicros();
+      m_rxThisFrame = false;
+      if (m_packetCount <= 100)
+        m_packetCount++;
+      m_txNext ^= 1;
+      m_txPrepared = false;
+      d = TX_TIMEOUT_US;
+      m_telemetryState = waitTx;
       break;
     case waitTx:
+      // Build the next packet and save the session while the radio is
+      // sending this one
+      if (!m_txPrepared)
+      {
+        buildPacket(m_txNext);
+        m_txPrepared = true;
+        storeSessionStep();
+      }
+
       if (a7105Busy())
-        d = 0;
+        d = BUSY_RETRY_US;
+      else if (m_lowPower && m_framesSinceTelemetry + 1 < m_telemetryGap)
+      { // no telemetry due, sleep until the next frame
+        uint32_t elapsedUs = halMicros() - m_frameStartUs;
+        m_telemetryState = skipRx;
+        d = sleepRadio(elapsedUs < m_frameUs ? m_frameUs - elapsedUs : 0);
+      }
       else
       { // wait for tx completion
         a7105Strobe(A7105_RX);
-        polls = 0;
-        telemetryState = pollRx;
-        d = 3000; // nominal rx time
+        if (m_radios[1])
+        {
+          useRadio(m_txRadio ^ 1);
+          a7105Strobe(A7105_RX);
+          useRadio(m_txRadio);
+        }
+        m_telemetryState = pollRx;
+        d = frameDelay();
       }
       break;
+    case skipRx:
     case pollRx: // check for telemetry
-      if (a7105Busy())
-        d = 1000;
-      else
+      // The delay is taken before the poll, and the last POLL_GUARD_US of
+      // the frame are not polled, so the time a poll takes over SPI never
+      // delays the next packet
+      d = frameDelay();
+      if (m_telemetryState == pollRx &&
+          halMicros() - m_frameStartUs + POLL_GUARD_US / 2 < m_frameUs)
+        pollTelemetry();
+
+      if (d == 0)
       {
-        a7105ReadData(a7105_packet, 16);
-        m_rssiChannel = a7105ReadReg(A7105_1D_RSSI_THOLD);
-        updateTelemetry();
-        a7105Strobe(A7105_RX);
-        d = 1000;
+        updateLink();
+        if (m_state == DATA_5)
+          m_state = DATA_1;
+        else
+          m_state++;
+        m_telemetryState = doTx;
       }
+      break;
+    default: // Not a telemetry state, send the next packet
+      m_telemetryState = doTx;
+      d = POLL_US;
+      break;
+    } // switch (telemetryState)
+    break;
+  default: // Not a state, keep the scheduler ticking at the frame rate
+    d = m_frameUs;
+    break;
+  } // switch (m_state)
+
+  TRACE(TRACE_DELAY, d & 0xFF, d >> 8);
+  return d;
+}
+
+/**
+ * @brief Samples the noise on the next channel of the survey.
+ * @return Delay until the next step in microseconds
+ *
+ * Each step reads the RSSI of the channel tuned by the step before, which has
+ * had SURVEY_SETTLE_US to settle, then tunes the next channel. Once the
+ * budget is spent the channel is picked and binding starts.
+ */
+uint16_t StaticHubsan::surveyStep()
+{
+  uint32_t nowUs = halMicros();
+
+  if (m_surveyIndex == SURVEY_START)
+  {
+    HubsanSurvey &survey = m_surveyResult.beginWrite();
+    memset(&survey, 0, sizeof(survey));
+    memcpy(survey.channels, hubsanAllowedChannels, HUBSAN_CHANNEL_COUNT);
+    m_surveyResult.endWrite();
+
+    m_surveyStartUs = nowUs;
+    m_surveyIndex = 0;
+  }
+  else if (m_surveyRetune)
+  {
+    // Another instance had the radio, tune the channel again before reading
+    m_surveyRetune = false;
+  }
+  else
+  {
+    uint8_t rssi = a7105ReadReg(A7105_1D_RSSI_THOLD);
+    HubsanSurvey &survey = m_surveyResult.beginWrite();
+    uint8_t *noise = m_surveyIndex < HUBSAN_CHANNEL_COUNT
+                         ? &survey.rssi[m_surveyIndex]
+                         : &survey.rssiAlt[m_surveyIndex -
+                                           HUBSAN_CHANNEL_COUNT];
+
+    // Keep the loudest sample
+    if (!survey.rounds || rssi < *noise)
+      *noise = rssi;
+
+    if (++m_surveyIndex == 2 * HUBSAN_CHANNEL_COUNT)
+    {
+      m_surveyIndex = 0;
+      survey.rounds++;
+    }
+    m_surveyResult.endWrite();
+  }
+
+  uint32_t elapsedUs = nowUs - m_surveyStartUs;
+
+  if (elapsedUs + SURVEY_SETTLE_US > m_surveyBudgetUs)
+  {
+    a7105Strobe(A7105_STANDBY);
+
+    m_channel = surveyPick();
+
+    HubsanSurvey &survey = m_surveyResult.beginWrite();
+    survey.channel = m_channel;
+    survey.elapsedUs = elapsedUs;
+    m_surveyResult.endWrite();
+
+    m_state = BIND_1;
+    return 0;
+  }
+
+  uint8_t channel =
+      hubsanAllowedChannels[m_surveyIndex % HUBSAN_CHANNEL_COUNT];
+  if (m_surveyIndex >= HUBSAN_CHANNEL_COUNT)
+    channel += 0x23;
+
+  a7105Strobe(A7105_STANDBY);
+  a7105WriteReg(A7105_0F_CHANNEL, channel);
+  a7105Strobe(A7105_RX);
+
+  return SURVEY_SETTLE_US;
+}
+
+/**
+ * @brief Picks the channel whose pair is quietest, by its louder channel.
+ *
+ * Starts from a channel given by the session ID and only moves on for a
+ * quieter pair, so transmitters at a quiet site still spread out.
+ */
+uint8_t StaticHubsan::surveyPick() const
+{
+  uint8_t first = m_sessionID % HUBSAN_CHANNEL_COUNT;
+  uint8_t best = first;
+  const HubsanSurvey &survey = m_surveyResult.value();
+  uint8_t bestNoise = min(survey.rssi[best], survey.rssiAlt[best]);
+
+  for (uint8_t n = 1; n < HUBSAN_CHANNEL_COUNT; n++)
+  {
+    uint8_t i = (first + n) % HUBSAN_CHANNEL_COUNT;
+    uint8_t noise = min(survey.rssi[i], survey.rssiAlt[i]);
+
+    if (noise > bestNoise)
+    {
+      best = i;
+      bestNoise = noise;
+    }
+  }
+
+  return hubsanAllowedChannels[best];
+}
+
+/**
+ * @brief Runs the next step of the radio setup.
+ * @return Delay until the next step in microseconds
+ */
+uint16_t StaticHubsan::setupStep()
+{
+  uint32_t elapsedUs = halMicros() - m_setupStartUs;
+  uint8_t calibration;
 
-      if (++polls >= 7)
-      { // 3ms + 3mS + 4*1ms
-        if (m_state == DATA_5)
-          m_state = DATA_1;
-        else
-          m_state++;
-        telemetryState = doTx;
-      }
-      break;
-    } // switch (telemetryState)
-    break;
-  } // switch (m_state)
+  useRadio(m_setupRadio);
 
-  return d;
+  switch (m_setupStatus.value().state)
+  {
+  case HUBSAN_SETUP_WAKEUP:
+    if (elapsedUs < A7105_WAKEUP_US)
+      return A7105_WAKEUP_US - elapsedUs;
+    return setupReset();
+
+  case HUBSAN_SETUP_RESET:
+    a7105WriteID(BIND_ID);
+    a7105WriteProfile(hubsanRegisters, sizeof(hubsanRegisters));
+    a7105SetupGIO1();
+
+    if (m_useStoredCal && !m_setupRadio)
+    {
+      // Calibration stored with the session, set in manual mode
+      a7105WriteReg(A7105_22_IF_CALIB_I, A7105_MASK_MFBS | m_calibration[0]);
+      a7105WriteReg(A7105_24_VCO_CURCAL, A7105_MASK_MVCS | m_calibration[1]);
+      a7105WriteReg(A7105_25_VCO_SBCAL_I, A7105_MASK_MVBS | m_calibration[2]);
+      return setupReady(elapsedUs);
+    }
+
+    a7105Strobe(A7105_STANDBY);
+
+    a7105WriteReg(A7105_02_CALC, 1); // IF cal.
+    m_calTimeoutUs = a7105SetTimeout();
+    setSetupState(HUBSAN_SETUP_IF_CAL);
+    return CAL_POLL_US;
+
+  case HUBSAN_SETUP_IF_CAL:
+    if (a7105ReadReg(A7105_02_CALC))
+      return calibrationWait(HUBSAN_SETUP_IF_TIMEOUT);
+
+    calibration = a7105ReadReg(A7105_22_IF_CALIB_I);
+    if (calibration & A7105_MASK_FBCF)
+      return setupFailed(HUBSAN_SETUP_IF_FAILED);
+    // The session keeps the first radio's calibration
+    if (!m_setupRadio)
+      m_calibration[0] = calibration & 0x0f; // Filter bank
+
+    a7105ReadReg(A7105_24_VCO_CURCAL);
+    // a7105WriteReg(0x24, 0x13); // VCO cal. from A7105 Datasheet
+    // a7105WriteReg(0x26, 0x3b); // VCO bank cal. limits from A7105 Datasheet
+
+    a7105WriteReg(A7105_0F_CHANNEL, 0); // set channel
+    a7105WriteReg(A7105_02_CALC, 2);    // VCO cal.
+    m_calTimeoutUs = a7105SetTimeout();
+    setSetupState(HUBSAN_SETUP_VCO_LOW);
+    return CAL_POLL_US;
+
+  case HUBSAN_SETUP_VCO_LOW:
+    if (a7105ReadReg(A7105_02_CALC))
+      return calibrationWait(HUBSAN_SETUP_VCO_TIMEOUT);
+
+    if (a7105ReadReg(A7105_25_VCO_SBCAL_I) & A7105_MASK_VBCF)
+      return setupFailed(HUBSAN_SETUP_VCO_FAILED);
+
+    a7105WriteReg(A7105_0F_CHANNEL, 0xa0); // set channel
+    a7105WriteReg(A7105_02_CALC, 2);       // VCO cal.
+    m_calTimeoutUs = a7105SetTimeout();
+    setSetupState(HUBSAN_SETUP_VCO_HIGH);
+    return CAL_POLL_US;
+
+  case HUBSAN_SETUP_VCO_HIGH:
+    if (a7105ReadReg(A7105_02_CALC))
+      return calibrationWait(HUBSAN_SETUP_VCO_TIMEOUT);
+
+    calibration = a7105ReadReg(A7105_25_VCO_SBCAL_I);
+    if (calibration & A7105_MASK_VBCF)
+      return setupFailed(HUBSAN_SETUP_VCO_FAILED);
+    if (!m_setupRadio)
+    {
+      m_calibration[2] = calibration & 0x07; // VCO band
+      m_calibration[1] = a7105ReadReg(A7105_24_VCO_CURCAL) & 0x0f;
+    }
+
+    // a7105WriteReg(0x25, 0x08); // reset VCO band cal.
+
+    return setupReady(elapsedUs);
+
+  case HUBSAN_SETUP_FAILED:
+    return SETUP_FAILED_US;
+
+  default:
+    return 0;
+  }
 }
 
 /**
- * @brief Initializes the A7105 radio.
- * @return True if the radio was successfully initialised
- *
- * If initialization fails, multiple attempts can be made.
+ * @brief Starts a setup attempt with a soft reset of the radio.
+ * @return Delay until the next step in microseconds
+ */
+uint16_t StaticHubsan::setupReset()
+{
+  a7105Reset(false);
+
+  HubsanSetupStatus &setup = m_setupStatus.beginWrite();
+  setup.attempts++;
+  setup.state = HUBSAN_SETUP_RESET;
+  m_setupStatus.endWrite();
+
+  return A7105_RESET_US;
+}
+
+/**
+ * @brief Ends a setup attempt that failed, trying again if any are left.
+ * @param error Reason for the failure
+ * @return Delay until the next step in microseconds
  */
-bool Hubsan::initRadio()
+uint16_t StaticHubsan::setupFailed(HubsanSetupError error)
 {
-  uint8_t vco_current;
-  uint32_t timeoutuS;
+  HubsanSetupStatus &setup = m_setupStatus.beginWrite();
+  bool retry = setup.attempts < HUBSAN_SETUP_ATTEMPTS;
 
-  a7105Reset();
+  setup.error = error;
+  if (!retry)
+  {
+    setup.elapsedUs = halMicros() - m_setupStartUs;
+    setup.state = HUBSAN_SETUP_FAILED;
+  }
+  m_setupStatus.endWrite();
 
-  a7105WriteID(0x55201041);
-  a7105WriteReg(A7105_01_MODE_CONTROL, 0x63);
-  a7105WriteReg(A7105_03_FIFOI, 0x0f);
-  a7105WriteReg(A7105_0D_CLOCK, 0x05);
-  a7105WriteReg(A7105_0E_DATA_RATE, 0x04);
-  a7105WriteReg(A7105_15_TX_II, 0x2b);
-  a7105WriteReg(A7105_18_RX, 0x62);
-  a7105WriteReg(A7105_19_RX_GAIN_I, 0x80);
-  a7105WriteReg(A7105_1C_RX_GAIN_IV, 0x0A);
-  a7105WriteReg(A7105_1F_CODE_I, 0x07);
-  a7105WriteReg(A7105_20_CODE_II, 0x17);
-  a7105WriteReg(A7105_29_RX_DEM_TEST_I, 0x47);
+  return retry ? setupReset() : SETUP_FAILED_US;
+}
 
+/**
+ * @brief Ends the setup with the radio ready to bind.
+ * @param elapsedUs Time since beginSetup()
+ * @return Delay until the next step in microseconds
+ */
+uint16_t StaticHubsan::setupReady(uint32_t elapsedUs)
+{
+  a7105SetPower(m_txPower);
   a7105Strobe(A7105_STANDBY);
 
-  a7105WriteReg(A7105_02_CALC, 1);
-  vco_current = a7105ReadReg(A7105_02_CALC);
+  // Then the same for the second radio
+  if (m_radios[1] && !m_setupRadio)
+  {
+    m_setupRadio = 1;
+    useRadio(1);
+    return setupReset();
+  }
 
-  timeoutuS = a7105SetTimeout();
-  while (a7105Busy())
-    if (micros() > timeoutuS)
-      return false;
+  HubsanSetupStatus &setup = m_setupStatus.beginWrite();
+  setup.elapsedUs = elapsedUs;
+  setup.state = HUBSAN_SETUP_READY;
+  m_setupStatus.endWrite();
 
-  if (a7105ReadReg(A7105_22_IF_CALIB_I) & A7105_MASK_FBCF)
-    return false;
+  return 0;
+}
 
-  a7105ReadReg(A7105_24_VCO_CURCAL);
-  // a7105WriteReg(0x24, 0x13); // VCO cal. from A7105 Datasheet
-  // a7105WriteReg(0x26, 0x3b); // VCO bank cal. limits from A7105 Datasheet
+/**
+ * @brief Waits for a running calibration, failing the attempt on timeout.
+ * @param timeoutError Reason reported if the calibration timed out
+ * @return Delay until the next step in microseconds
+ */
+uint16_t StaticHubsan::calibrationWait(HubsanSetupError timeoutError)
+{
+  if (halTimeAfter(halMicros(), m_calTimeoutUs))
+    return setupFailed(timeoutError);
+
+  return CAL_POLL_US;
+}
 
-  a7105WriteReg(A7105_0F_CHANNEL, 0); // set channel
-  a7105WriteReg(A7105_02_CALC, 2);    // VCO cal.
+/**
+ * @brief Moves the setup to a new state and publishes the status.
+ * @param state HubsanSetupState
+ */
+void StaticHubsan::setSetupState(uint8_t state)
+{
+  m_setupStatus.beginWrite().state = state;
+  m_setupStatus.endWrite();
+}
 
-  timeoutuS = a7105SetTimeout();
-  while (a7105Busy())
-    if (micros() > timeoutuS)
-      return false;
+/**
+ * @brief Gets the progress of the radio setup.
+ * @param status Status to copy into
+ * @return False if setup has not been started
+ */
+bool StaticHubsan::getSetupStatus(HubsanSetupStatus &status) const
+{
+  return m_setupStatus.read(status);
+}
 
-  if (a7105ReadReg(A7105_25_VCO_SBCAL_I) & A7105_MASK_VBCF)
-    return false;
+/**
+ * @brief Gets the time until the radio should next be checked in a frame.
+ * @return Delay in microseconds, 0 if the frame has ended
+ *
+ * The last check before the end is POLL_GUARD_US ahead of it.
+ */
+uint16_t StaticHubsan::frameDelay()
+{
+  uint32_t elapsedUs = halMicros() - m_frameStartUs;
 
-  a7105WriteReg(A7105_0F_CHANNEL, 0xa0); // set channel
-  a7105WriteReg(A7105_02_CALC, 2);       // VCO cal.
+  if (elapsedUs >= m_frameUs)
+    return 0;
 
-  timeoutuS = a7105SetTimeout();
-  while (a7105Busy())
-    if (micros() > timeoutuS)
-      return false;
+  uint32_t remainingUs = m_frameUs - elapsedUs;
+  if (remainingUs > POLL_GUARD_US)
+    return min(remainingUs - POLL_GUARD_US, (uint32_t)POLL_US);
 
-  if (a7105ReadReg(A7105_25_VCO_SBCAL_I) & A7105_MASK_VBCF)
-    return false;
+  return remainingUs;
+}
 
-  // a7105WriteReg(0x25, 0x08); // reset VCO band cal.
+/**
+ * @brief Puts the radio to sleep for a wait, if low power is enabled.
+ *
+ * The next tx() wakes it, A7105_STANDBY_US before the end of the wait.
+ *
+ * @param us Wait until the next step
+ * @return Delay until the radio is woken, or us if it stays awake
+ */
+uint16_t StaticHubsan::sleepRadio(uint16_t us)
+{
+  if (!m_lowPower || us < SLEEP_MIN_US)
+    return us;
 
-  a7105SetPower(TXPOWER_150mW);
-  a7105Strobe(A7105_STANDBY);
+  a7105Strobe(A7105_SLEEP);
+  m_radioAsleep = true;
 
-  return true;
+  return us - A7105_STANDBY_US;
 }
 
-void Hubsan::setBindState(uint32_t ms)
+void StaticHubsan::setBindState(uint32_t ms)
 {
   if (ms)
   {
     if (ms == 0xFFFFFFFF)
       m_bindTime = ms;
     else
-      m_bindTime = millis() + ms;
+      m_bindTime = halMillis() + ms;
     m_state |= BINDING;
   }
   else
@@ -360,88 +1358,145 @@ void Hubsan::setBindState(uint32_t ms)
 }
 
 /**
- * @brief Builds a standard data packet.
+ * @brief Sets a byte of a data packet, keeping its checksum valid.
+ *
+ * The checksum is the negated sum of the other bytes, so it moves by the
+ * opposite of the change to the byte.
+ */
+static inline void updatePacketByte(uint8_t *packet, uint8_t index,
+                                    uint8_t value)
+{
+  packet[15] -= value - packet[index];
+  packet[index] = value;
+}
+
+/**
+ * @brief Builds the data packet template for this session.
+ *
+ * Holds the bytes that do not change between data packets, with zero sticks,
+ * default flags and a valid checksum.
+ */
+void StaticHubsan::buildPacketTemplate()
+{
+  // 20 00 00 00 80 00 7d 00 84 02 64 db 04 26 79 7b
+  memset(m_txTemplate, 0, 16);
+  m_txTemplate[0] = 0x20;
+  m_txTemplate[9] = 0x20 | FLAG_LED | FLAG_FLIP;
+  m_txTemplate[10] = 0x64;
+  // Only the low 16 bits of the ID are sent
+  m_txTemplate[13] = (m_id >> 8) & 0xff;
+  m_txTemplate[14] = (m_id >> 0) & 0xff;
+
+  a7105CRCUpdate(m_txTemplate, 16);
+
+  m_txIsData[0] = false;
+  m_txIsData[1] = false;
+}
+
+/**
+ * @brief Builds a standard data packet for the next data frame.
+ * @param buffer Index of the TX buffer to build into
+ *
+ * A buffer that already holds a data packet only has the sticks and flags
+ * that changed rewritten, with the checksum adjusted by the difference.
+ * Otherwise it starts from the session template. Records the controls
+ * version it was built from, m_packetCount is advanced when the packet is
+ * sent.
  */
-void Hubsan::buildPacket()
+void StaticHubsan::buildPacket(uint8_t buffer)
 {
-  memset(a7105_packet, 0, 16);
+  m_txVersion = m_controlsVersion;
+  halMemoryBarrier();
+
+  const HubsanControls &controls = m_controls[m_activeControls];
+  uint8_t *packet = m_txPackets[buffer];
+  uint8_t flags;
 
 #if defined(USE_HUBSAN_EXTENDED)
-  if (m_packetCount == 100)
-  { // set vTX frequency (H107D)
-    a7105_packet[0] = 0x40;
-    a7105_packet[1] = (m_vtxFreq >> 8) & 0xff;
-    a7105_packet[2] = m_vtxFreq & 0xff;
-    a7105_packet[3] = 0x82;
-    m_packetCount++;
-  }
-  else
+  bool vtxPacket = m_packetCount == 100;
+#else
+  bool vtxPacket = false;
 #endif
-  { // 20 00 00 00 80 00 7d 00 84 02 64 db 04 26 79 7b
-    a7105_packet[0] = 0x20;
-    a7105_packet[2] = m_sticks[COMMAND_THROTTLE];
-  }
-  a7105_packet[4] = m_sticks[COMMAND_YAW];
-  a7105_packet[6] = m_sticks[COMMAND_PITCH];
-  a7105_packet[8] = m_sticks[COMMAND_ROLL];
 
-  if (m_packetCount > 100)
+  if (m_packetCount > 100 || vtxPacket)
   {
-    a7105_packet[9] = 0x20;
+    flags = 0x20;
 
-    if (m_enableLED)
-      a7105_packet[9] |= FLAG_LED;
+    if (controls.enableLED)
+      flags |= FLAG_LED;
 
-    if (m_enableFlip)
-      a7105_packet[9] |= FLAG_FLIP;
+    if (controls.enableFlip)
+      flags |= FLAG_FLIP;
 
-    if (m_recordVideo)
-      a7105_packet[9] |= FLAG_VIDEO;
+    if (controls.recordVideo)
+      flags |= FLAG_VIDEO;
   }
   else
   {
     // Sends default value for the 100 first packets
-    a7105_packet[9] = 0x20 | FLAG_LED | FLAG_FLIP;
-    m_packetCount++;
+    flags = 0x20 | FLAG_LED | FLAG_FLIP;
+  }
+
+  if (vtxPacket)
+  { // set vTX frequency (H107D), sent once so built in full
+    memcpy(packet, m_txTemplate, 16);
+    packet[0] = 0x40;
+    packet[1] = (m_vtxFreq >> 8) & 0xff;
+    packet[2] = m_vtxFreq & 0xff;
+    packet[3] = 0x82;
+    packet[4] = controls.sticks[COMMAND_YAW];
+    packet[6] = controls.sticks[COMMAND_PITCH];
+    packet[8] = controls.sticks[COMMAND_ROLL];
+    packet[9] = flags;
+    a7105CRCUpdate(packet, 16);
+    m_txIsData[buffer] = false;
+    return;
   }
 
-  a7105_packet[10] = 0x64;
-  a7105_packet[11] = (m_id >> 24) & 0xff;
-  a7105_packet[12] = (m_id >> 16) & 0xff;
-  a7105_packet[13] = (m_id >> 8) & 0xff;
-  a7105_packet[14] = (m_id >> 0) & 0xff;
+  if (!m_txIsData[buffer])
+  {
+    memcpy(packet, m_txTemplate, 16);
+    m_txIsData[buffer] = true;
+  }
 
-  a7105CRCUpdate(16);
+  updatePacketByte(packet, 2, controls.sticks[COMMAND_THROTTLE]);
+  updatePacketByte(packet, 4, controls.sticks[COMMAND_YAW]);
+  updatePacketByte(packet, 6, controls.sticks[COMMAND_PITCH]);
+  updatePacketByte(packet, 8, controls.sticks[COMMAND_ROLL]);
+  updatePacketByte(packet, 9, flags);
 }
 
 /**
  * @brief Builds a binding packet.
+ * @param packet Buffer to build into
+ * @param state Bind state sent to the model
  */
-void Hubsan::buildBindPacket(uint8_t state)
+void StaticHubsan::buildBindPacket(uint8_t *packet, uint8_t state)
 {
-  a7105_packet[0] = state;
-  a7105_packet[1] = m_channel;
-  a7105_packet[2] = (m_sessionID >> 24) & 0xff;
-  a7105_packet[3] = (m_sessionID >> 16) & 0xff;
-  a7105_packet[4] = (m_sessionID >> 8) & 0xff;
-  a7105_packet[5] = (m_sessionID >> 0) & 0xff;
-  a7105_packet[6] = 0x08;
-  a7105_packet[7] = 0xe4; //???
-  a7105_packet[8] = 0xea;
-  a7105_packet[9] = 0x9e;
-  a7105_packet[10] = 0x50;
-  a7105_packet[11] = (m_id >> 24) & 0xff;
-  a7105_packet[12] = (m_id >> 16) & 0xff;
-  a7105_packet[13] = (m_id >> 8) & 0xff;
-  a7105_packet[14] = (m_id >> 0) & 0xff;
+  packet[0] = state;
+  packet[1] = m_channel;
+  packet[2] = (m_sessionID >> 24) & 0xff;
+  packet[3] = (m_sessionID >> 16) & 0xff;
+  packet[4] = (m_sessionID >> 8) & 0xff;
+  packet[5] = (m_sessionID >> 0) & 0xff;
+  packet[6] = 0x08;
+  packet[7] = 0xe4; //???
+  packet[8] = 0xea;
+  packet[9] = 0x9e;
+  packet[10] = 0x50;
+  // Only the low 16 bits of the ID are sent, bytes 11 and 12 stay 0
+  packet[11] = 0;
+  packet[12] = 0;
+  packet[13] = (m_id >> 8) & 0xff;
+  packet[14] = (m_id >> 0) & 0xff;
 
-  a7105CRCUpdate(16);
+  a7105CRCUpdate(packet, 16);
 }
 
 /**
- * @brief Parses telemetry data.
+ * @brief Decodes a telemetry packet from m_rxPacket into the snapshot.
  */
-void Hubsan::updateTelemetry()
+void StaticHubsan::updateTelemetry()
 {
   enum Tag0xe0
   {
@@ -483,15 +1538,421 @@ void Hubsan::updateTelemetry()
     CRC1_e1
   };
 
-  uint8_t i;
-  static uint32_t lastUpdatemS = millis();
-  uint16_t intervalmS;
+  const uint8_t *p = m_rxPacket;
+
+  if (!a7105CRCCheck(p, 16))
+  {
+    if (m_linkCrcErrors < 0xff)
+      m_linkCrcErrors++;
+    return;
+  }
+
+  if (p[TAG] != 0xe0 && p[TAG] != 0xe1)
+    return;
+
+  // Telemetry interval, learnt down to the shortest gap at once, see
+  // updateLink() for longer. A second packet in the same frame is no gap.
+  uint8_t gap = m_framesSinceTelemetry;
+  if (gap && gap != 0xff)
+  {
+    if (!m_telemetryGap || gap <= m_telemetryGap)
+    {
+      m_telemetryGap = gap;
+      m_longerGap = 0;
+      m_gapWindows = 0;
+    }
+    else if (!m_longerGap || gap < m_longerGap)
+      m_longerGap = gap;
+  }
+  m_framesSinceTelemetry = 0;
+  m_lossFrames = 0;
+  m_divLossFrames = 0;
+  m_rxThisFrame = true;
+  m_linkTelemetry++;
+  m_linkRssiSum += m_rssiChannel;
+
+  m_resumePending = false;
+  if (m_session.version == HUBSAN_SESSION_VERSION && !m_session.telemetry)
+  {
+    m_session.telemetry = 1;
+    m_session.checksum = sessionChecksum(m_session);
+    m_storeIndex = 0;
+  }
+
+  uint32_t nowMs = halMillis();
+  HubsanTelemetry &t = m_telemetry.beginWrite();
+
+  if (t.packets)
+    t.intervalMs = nowMs - t.updatedMs;
+  t.updatedMs = nowMs;
+  t.packets++;
+
+  if (p[TAG] == 0xe0)
+  {
+    t.rateOfClimb = (p[ROC_MSB] << 8) | p[ROC_LSB];
+    t.acc[HUBSAN_YAW] = (p[Z_ACC_MSB] << 8) | p[Z_ACC_LSB];
+    t.gyro[HUBSAN_YAW] = (p[YAW_GYRO_MSB] << 8) | p[YAW_GYRO_LSB];
+    t.vbat = p[VBAT];
+  }
+  else
+  {
+    t.acc[HUBSAN_PITCH] = (p[PITCH_ACC_MSB] << 8) | p[PITCH_ACC_LSB];
+    t.acc[HUBSAN_ROLL] = (p[ROLL_ACC_MSB] << 8) | p[ROLL_ACC_LSB];
+    t.gyro[HUBSAN_PITCH] = (p[PITCH_GYRO_MSB] << 8) | p[PITCH_GYRO_LSB];
+    t.gyro[HUBSAN_ROLL] = (p[ROLL_GYRO_MSB] << 8) | p[ROLL_GYRO_LSB];
+    t.vbat = p[VBAT_e1];
+  }
+
+  m_telemetry.endWrite();
+}
+
+/**
+ * @brief Reads the telemetry each radio has received.
+ *
+ * With diversity a packet heard by both radios is counted for each but
+ * decoded once.
+ */
+void StaticHubsan::pollTelemetry()
+{
+  uint8_t radios = m_radios[1] ? 2 : 1;
+
+  for (uint8_t i = 0; i < radios; i++)
+  {
+    uint8_t radio = m_txRadio ^ i;
+
+    useRadio(radio);
+    if (a7105Busy())
+      continue;
+
+    a7105ReadData(m_rxPacket, 16);
+    m_rssiChannel = a7105ReadReg(A7105_1D_RSSI_THOLD);
+    a7105Strobe(A7105_RX);
+
+    if (m_radios[1] && a7105CRCCheck(m_rxPacket, 16) &&
+        (m_rxPacket[0] == 0xe0 || m_rxPacket[0] == 0xe1))
+    {
+      if (m_divTelemetry[radio] < 0xff)
+        m_divTelemetry[radio]++;
+      m_divRssiSum[radio] += m_rssiChannel;
+    }
+
+    if (!m_radios[1] || !m_rxThisFrame)
+      updateTelemetry();
+  }
+
+  useRadio(m_txRadio);
+}
+
+/**
+ * @brief Starts the link quality estimate and power control over.
+ */
+void StaticHubsan::resetLink()
+{
+  m_txPower = TXPOWER_150mW;
+  m_powerHold = POWER_HOLD_MIN;
+  m_powerWindows = 0;
+  m_powerSteppedDown = false;
+  m_powerChanged = false;
+  m_powerChanges = 0;
+  m_lossFrames = 0;
+  m_linkFrames = 0;
+  m_linkTelemetry = 0;
+  m_linkCrcErrors = 0;
+  m_linkRssiSum = 0;
+  m_longerGap = 0;
+  m_gapWindows = 0;
+  m_framesSinceTelemetry = 0xff;
+  m_telemetryGap = 0;
+  m_divFrames = 0;
+  m_divLossFrames = 0;
+  memset(m_divTelemetry, 0, sizeof(m_divTelemetry));
+  memset(m_divRssiSum, 0, sizeof(m_divRssiSum));
+  m_diversity.beginWrite() = HubsanDiversity();
+  m_diversity.endWrite();
+
+  m_linkQuality.beginWrite() = HubsanLinkQuality();
+  m_linkQuality.endWrite();
+}
+
+/**
+ * @brief Counts a data frame, ending the link quality window when full.
+ */
+void StaticHubsan::updateLink()
+{
+  if (m_framesSinceTelemetry < 0xfe)
+    m_framesSinceTelemetry++;
+
+  if (m_radios[1])
+    updateDiversity();
+
+  // Telemetry stopped, e.g. a step down was too far, do not wait for the
+  // end of the window
+  if (m_powerControl && m_telemetryGap &&
+      ++m_lossFrames >= LINK_LOSS_GAPS * m_telemetryGap)
+  {
+    m_lossFrames = 0;
+    powerUp();
+  }
+
+  if (++m_linkFrames < HUBSAN_LINK_WINDOW)
+    return;
+
+  uint8_t quality = 0;
+  uint8_t rssi = 0xff;
+
+  if (m_telemetryGap)
+    quality = min((uint32_t)m_linkTelemetry * m_telemetryGap * 100 /
+                      HUBSAN_LINK_WINDOW,
+                  (uint32_t)100);
+  if (m_linkTelemetry)
+    rssi = m_linkRssiSum / m_linkTelemetry;
+
+  if (m_powerControl && m_telemetryGap && !m_powerChanged)
+  {
+    if (quality < LINK_QUALITY_LOW || rssi > LINK_RSSI_WEAK)
+      powerUp();
+    else if (quality >= LINK_QUALITY_HIGH && rssi < LINK_RSSI_STRONG)
+    {
+      m_powerSteppedDown = false; // The last step down kept the link
+      if (++m_powerWindows >= m_powerHold)
+        powerDown();
+    }
+    else
+      m_powerWindows = 0;
+  }
+
+  HubsanLinkQuality &link = m_linkQuality.beginWrite();
+  link.quality = quality;
+  link.telemetry = m_linkTelemetry;
+  link.crcErrors = m_linkCrcErrors;
+  link.rssi = rssi;
+  link.telemetryGap = m_telemetryGap;
+  link.power = m_txPower;
+  link.windows++;
+  link.powerChanges = m_powerChanges;
+  m_linkQuality.endWrite();
+
+  // A stray short gap or a model that slows down must not pin the interval,
+  // relearn it from the gaps since it was last seen. Not sooner, losses
+  // lengthen the gaps too.
+  if (m_longerGap && ++m_gapWindows >= LINK_GAP_WINDOWS)
+  {
+    m_telemetryGap = m_longerGap;
+    m_longerGap = 0;
+    m_gapWindows = 0;
+  }
+
+  m_powerChanged = false;
+  m_linkFrames = 0;
+  m_linkTelemetry = 0;
+  m_linkCrcErrors = 0;
+  m_linkRssiSum = 0;
+}
+
+/**
+ * @brief Steps the TX power up, from the next data frame.
+ */
+void StaticHubsan::powerUp()
+{
+  // The last step down lost the link, wait longer before the next
+  if (m_powerSteppedDown)
+    m_powerHold = min(m_powerHold * 2, POWER_HOLD_MAX);
+
+  m_powerSteppedDown = false;
+  m_powerWindows = 0;
+  m_powerChanged = true;
+
+  if (m_txPower < TXPOWER_150mW)
+  {
+    m_txPower++;
+    m_powerChanges++;
+  }
+}
+
+/**
+ * @brief Steps the TX power down, from the next data frame.
+ */
+void StaticHubsan::powerDown()
+{
+  m_powerWindows = 0;
+
+  if (m_txPower > m_minPower)
+  {
+    m_txPower--;
+    m_powerChanges++;
+    m_powerSteppedDown = true;
+    m_powerChanged = true;
+  }
+}
+
+/**
+ * @brief Selects one of the radios set with setDiversity(), if any.
+ *
+ * Without diversity the protocol uses whichever radio is selected.
+ */
+void StaticHubsan::useRadio(uint8_t index)
+{
+  if (m_radios[1])
+    a7105Select(*m_radios[index]);
+}
+
+/**
+ * @brief Tunes the radio not transmitting to this frame's channel.
+ *
+ * It starts listening with the transmitting radio, once the packet is sent.
+ */
+void StaticHubsan::tuneOtherRadio(uint8_t channel)
+{
+  if (!m_radios[1])
+    return;
+
+  useRadio(m_txRadio ^ 1);
+  a7105Strobe(A7105_STANDBY);
+  a7105WriteReg(A7105_0F_CHANNEL, channel);
+  useRadio(m_txRadio);
+}
+
+/**
+ * @brief Moves the radio not transmitting to the model's ID and code, once
+ * bound.
+ */
+void StaticHubsan::bindOtherRadio()
+{
+  if (!m_radios[1])
+    return;
+
+  useRadio(m_txRadio ^ 1);
+  a7105WriteID(m_modelID);
+  a7105WriteReg(A7105_1F_CODE_I, 0x0F);
+  useRadio(m_txRadio);
+}
+
+/**
+ * @brief Counts a data frame for diversity, picking the radio to transmit on.
+ */
+void StaticHubsan::updateDiversity()
+{
+  // Neither radio hears the model, it is not hearing the one transmitting.
+  // What was received before says nothing of the link now, start the window
+  // over.
+  if (m_telemetryGap && ++m_divLossFrames >= LINK_LOSS_GAPS * m_telemetryGap)
+  {
+    HubsanDiversity &div = m_diversity.beginWrite();
+    div.lossSwitches++;
+    div.switches++;
+    div.txRadio = m_txRadio ^ 1;
+    m_diversity.endWrite();
+
+    switchRadio();
+    m_divFrames = 0;
+    memset(m_divTelemetry, 0, sizeof(m_divTelemetry));
+    memset(m_divRssiSum, 0, sizeof(m_divRssiSum));
+    return;
+  }
+
+  if (++m_divFrames < HUBSAN_LINK_WINDOW)
+    return;
+
+  HubsanDiversity &div = m_diversity.beginWrite();
+
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    div.telemetry[i] = m_divTelemetry[i];
+    div.rssi[i] =
+        m_divTelemetry[i] ? m_divRssiSum[i] / m_divTelemetry[i] : 0xff;
+  }
+
+  uint8_t tx = m_txRadio;
+  uint8_t other = m_txRadio ^ 1;
+  uint8_t heard = div.telemetry[other];
+  bool better = heard > div.telemetry[tx] ||
+                (heard && heard == div.telemetry[tx] &&
+                 div.rssi[other] + DIVERSITY_RSSI_MARGIN < div.rssi[tx]);
+
+  if (better)
+    div.switches++;
+  div.windows++;
+  div.txRadio = better ? other : tx;
+  m_diversity.endWrite();
+
+  if (better)
+    switchRadio();
+
+  m_divFrames = 0;
+  memset(m_divTelemetry, 0, sizeof(m_divTelemetry));
+  memset(m_divRssiSum, 0, sizeof(m_divRssiSum));
+}
+
+/**
+ * @brief Transmits on the other radio from the next data frame.
+ */
+void StaticHubsan::switchRadio()
+{
+  m_txRadio ^= 1;
+  m_divLossFrames = 0;
+
+  useRadio(m_txRadio);
+  a7105SetPower(m_txPower);
+}
+
+/**
+ * @brief Starts saving the session just bound, if there is storage for it.
+ */
+void StaticHubsan::saveSession()
+{
+  if (m_storageAddress == HUBSAN_NO_STORAGE)
+    return;
+
+  memset(&m_session, 0, sizeof(m_session));
+  m_session.version = HUBSAN_SESSION_VERSION;
+  m_session.txID = m_id;
+  m_session.sessionID = m_sessionID;
+  m_session.modelID = m_modelID;
+  m_session.channel = m_channel;
+  memcpy(m_session.calibration, m_calibration, sizeof(m_calibration));
+  m_session.checksum = sessionChecksum(m_session);
+  m_storeIndex = 0;
+}
+
+/**
+ * @brief Writes the next byte of the session that differs from storage.
+ *
+ * At most one byte per call and only once the last write has finished, so
+ * tx() never waits for an EEPROM write (~3.4ms).
+ */
+void StaticHubsan::storeSessionStep()
+{
+#if defined(HAL_STORAGE_SIZE)
+  const uint8_t *record = (const uint8_t *)&m_session;
 
-  if (a7105CRCCheck(16))
+  if (m_storageAddress == HUBSAN_NO_STORAGE ||
+      m_storeIndex >= sizeof(m_session) || !halStorageReady())
+    return;
+
+  for (; m_storeIndex < sizeof(m_session); m_storeIndex++)
   {
-    intervalmS = millis() - lastUpdatemS;
-    lastUpdatemS = millis();
+    uint16_t address = m_storageAddress + m_storeIndex;
+    uint8_t stored;
 
-    // TODO
+    halStorageRead(address, &stored, 1);
+    if (stored != record[m_storeIndex])
+    {
+      halStorageWrite(address, &record[m_storeIndex++], 1);
+      return;
+    }
   }
+#endif
+}
+
+/**
+ * @brief Gets the latest telemetry from the model.
+ * @param telemetry Destination for the telemetry
+ * @return False if no telemetry has been received
+ *
+ * Does not disable interrupts, must not be called from an interrupt that can
+ * preempt tx().
+ */
+bool StaticHubsan::getTelemetry(HubsanTelemetry &telemetry) const
+{
+  return m_telemetry.read(telemetry);
 }
@@ -3,7 +3,10 @@
 #ifndef _HUBSAN_AYA_H_
 #define _HUBSAN_AYA_H_
 
-#include "IProtocol.h"
+#include "A7105.h"
+#include "Protocol.h"
+#include "Snapshot.h"
+#include "StickScale.h"
 
 enum
 {
@@ -20,43 +23,332 @@ enum
   DATA_3,
   DATA_4,
   DATA_5,
+  RESUME,
+  SURVEY,
 };
 
 /**
- * @class Hubsan
+ * @enum HubsanAxis
+ * @brief Index of each axis in HubsanTelemetry.
+ */
+enum HubsanAxis
+{
+  HUBSAN_PITCH = 0,
+  HUBSAN_ROLL = 1,
+  HUBSAN_YAW = 2, //!< Yaw for gyro, Z for accelerometer
+};
+
+/**
+ * @struct HubsanTelemetry
+ * @brief Telemetry reported by a Hubsan model.
+ *
+ * Sensor values are raw readings. Models alternate between two packets, each
+ * updates a subset of the fields.
+ */
+struct HubsanTelemetry
+{
+  uint8_t vbat;        //!< Battery voltage in 0.1V
+  int16_t rateOfClimb; //!< Rate of climb
+  int16_t gyro[3];     //!< Gyro rates, indexed by HubsanAxis
+  int16_t acc[3];      //!< Accelerations, indexed by HubsanAxis
+  uint32_t updatedMs;  //!< halMillis() when the last packet was received
+  uint16_t intervalMs; //!< Time between the last two packets
+  uint16_t packets;    //!< Number of packets received
+};
+
+/**
+ * @struct HubsanLinkQuality
+ * @brief Link quality over the last window of HUBSAN_LINK_WINDOW data frames.
+ *
+ * Estimated from the telemetry the model sends back, so only for models that
+ * send it. The model replies to data packets it received, so lost telemetry
+ * counts losses either way.
+ */
+struct HubsanLinkQuality
+{
+  uint8_t quality;       //!< Telemetry received, % of expected, 0 if unknown
+  uint8_t telemetry;     //!< Telemetry packets received
+  uint8_t crcErrors;     //!< Packets received with a bad checksum
+  uint8_t rssi;          //!< Mean RSSI of the telemetry, lower is stronger
+  uint8_t telemetryGap;  //!< Frames between telemetry packets, 0 until known
+  uint8_t power;         //!< A7105_TxPower in use
+  uint16_t windows;      //!< Windows since bind
+  uint16_t powerChanges; //!< Steps made by the power control since bind
+};
+
+/**
+ * @struct HubsanDiversity
+ * @brief Both radios over the last window of HUBSAN_LINK_WINDOW data frames.
+ *
+ * See StaticHubsan::setDiversity(). Both radios listen for the telemetry, the
+ * one transmitting is picked from what each received.
+ */
+struct HubsanDiversity
+{
+  uint8_t txRadio;       //!< Radio transmitting, 0 for the first
+  uint8_t telemetry[2];  //!< Telemetry packets each radio received
+  uint8_t rssi[2];       //!< Mean RSSI of each, lower is stronger, 0xFF if none
+  uint16_t windows;      //!< Windows since bind
+  uint16_t switches;     //!< Changes of the transmitting radio since bind
+  uint16_t lossSwitches; //!< Of those, made when all telemetry was lost
+};
+
+/**
+ * @enum HubsanSetupState
+ * @brief Progress of the radio setup, in order.
+ */
+enum HubsanSetupState
+{
+  HUBSAN_SETUP_IDLE,     //!< Not started, tx() runs the protocol directly
+  HUBSAN_SETUP_WAKEUP,   //!< Waiting for the A7105 to wake up
+  HUBSAN_SETUP_RESET,    //!< Soft resetting the A7105
+  HUBSAN_SETUP_IF_CAL,   //!< IF filter bank calibration
+  HUBSAN_SETUP_VCO_LOW,  //!< VCO bank calibration at the bottom channel
+  HUBSAN_SETUP_VCO_HIGH, //!< VCO bank calibration at the top channel
+  HUBSAN_SETUP_READY,    //!< Radio set up, tx() binds and flies
+  HUBSAN_SETUP_FAILED,   //!< Gave up after HUBSAN_SETUP_ATTEMPTS
+};
+
+/**
+ * @enum HubsanSetupError
+ * @brief Reason the last setup attempt failed.
+ */
+enum HubsanSetupError
+{
+  HUBSAN_SETUP_OK,
+  HUBSAN_SETUP_IF_TIMEOUT,  //!< IF calibration did not finish
+  HUBSAN_SETUP_IF_FAILED,   //!< IF calibration flagged a failure (FBCF)
+  HUBSAN_SETUP_VCO_TIMEOUT, //!< VCO calibration did not finish
+  HUBSAN_SETUP_VCO_FAILED,  //!< VCO calibration flagged a failure (VBCF)
+};
+
+/**
+ * @struct HubsanSetupStatus
+ * @brief Progress of the radio setup started by StaticHubsan::beginSetup().
+ */
+struct HubsanSetupStatus
+{
+  uint8_t state;      //!< HubsanSetupState
+  uint8_t error;      //!< HubsanSetupError of the last failed attempt
+  uint8_t attempts;   //!< Attempts started
+  uint32_t elapsedUs; //!< Time from beginSetup() to ready or failed
+};
+
+/**
+ * @def HUBSAN_CHANNEL_COUNT
+ * @brief Number of data channels a session can use.
+ */
+#define HUBSAN_CHANNEL_COUNT 12
+
+/**
+ * @struct HubsanSurvey
+ * @brief Noise on each channel, sampled by the survey that starts a bind.
+ *
+ * Readings are of A7105_1D_RSSI_THOLD in RX, lower is louder. Each entry
+ * keeps the loudest sample, 0 if the channel was not reached in the budget.
+ */
+struct HubsanSurvey
+{
+  uint8_t channels[HUBSAN_CHANNEL_COUNT]; //!< Data channels surveyed
+  uint8_t rssi[HUBSAN_CHANNEL_COUNT];     //!< Noise on each channel
+  uint8_t rssiAlt[HUBSAN_CHANNEL_COUNT];  //!< Noise on channel + 0x23
+  uint8_t rounds;                         //!< Sweeps over all channels
+  uint8_t channel;                        //!< Channel picked
+  uint32_t elapsedUs;                     //!< Time the survey took
+};
+
+/**
+ * @def HUBSAN_NO_STORAGE
+ * @brief Storage address for no stored session, see StaticHubsan::setStorage().
+ */
+#define HUBSAN_NO_STORAGE 0xFFFF
+
+/**
+ * @struct HubsanSession
+ * @brief Bind session and radio calibration kept in HAL storage.
+ *
+ * Written a byte at a time in ascending order, so the checksum is written
+ * last and a record cut short by a power loss is not used.
+ */
+struct HubsanSession
+{
+  uint8_t version;        //!< HUBSAN_SESSION_VERSION, 0xFF when erased
+  uint32_t txID;          //!< ID of the transmitter that bound
+  uint32_t sessionID;     //!< Session ID sent in the bind packets
+  uint32_t modelID;       //!< A7105 ID given by the model while binding
+  uint8_t channel;        //!< Data channel
+  uint8_t calibration[3]; //!< IF filter bank, VCO current and VCO band
+  uint8_t telemetry;      //!< Non-zero if the model has sent telemetry
+  uint8_t checksum;       //!< CRC-8 of the other bytes
+};
+
+/**
+ * @struct HubsanControls
+ * @brief Control state sent in data packets.
+ */
+struct HubsanControls
+{
+  uint8_t sticks[4]; //!< Stick values, indexed by ProtocolCommand
+  bool enableFlip;   //!< Flip mode
+  bool enableLED;    //!< LEDs on
+  bool recordVideo;  //!< Video recording on
+};
+
+/**
+ * @class StaticHubsan
  * @brief HUbsan RF protocol
+ *
+ * Bound at compile time, with no vtable. Hubsan is the same protocol as an
+ * IProtocol.
  */
-class Hubsan : public IProtocol
+class StaticHubsan : public StaticProtocol<StaticHubsan>
 {
 public:
-  Hubsan(uint16_t id = 0x35000001, bool forceBind = false, uint16_t vtxFreq = 5800);
-  virtual ~Hubsan(){};
+  StaticHubsan(uint32_t id = 0x35000001, bool forceBind = false,
+               uint16_t vtxFreq = 5800);
 
   bool setup();
+  void beginSetup();
   bool bind();
   bool setCommand(ProtocolCommand command, uint16_t value);
+  bool setCommands(const uint16_t values[COMMAND_COUNT]);
   uint16_t tx();
 
+  bool getTelemetry(HubsanTelemetry &telemetry) const;
+  bool getSetupStatus(HubsanSetupStatus &status) const;
+  bool setStickScale(ProtocolCommand command, const StickScale &scale);
+
+  bool getLinkQuality(HubsanLinkQuality &link) const;
+  void setPowerControl(bool enable, uint8_t minPower = 0);
+
+  void setDiversity(A7105RadioBase &first, A7105RadioBase &second);
+  bool getDiversity(HubsanDiversity &diversity) const;
+
+  void setLowPower(bool enable);
+  void setFrameTime(uint16_t us);
+
+  void selectRadio();
+  bool exchangeDone() const;
+  uint16_t releaseRadio();
+  bool bound() const;
+
+  void setSurveyBudget(uint16_t us);
+  bool getSurvey(HubsanSurvey &survey) const;
+
+  void setStorage(uint16_t address);
+  bool resume();
+  void forgetSession();
+
 private:
-  bool initRadio();
+  uint16_t setupStep();
+  uint16_t setupReset();
+  uint16_t setupFailed(HubsanSetupError error);
+  uint16_t setupReady(uint32_t elapsedUs);
+  uint16_t calibrationWait(HubsanSetupError timeoutError);
+  void setSetupState(uint8_t state);
+  uint16_t surveyStep();
+  uint8_t surveyPick() const;
   void setBindState(uint32_t ms);
-  void buildPacket();
-  void buildBindPacket(uint8_t state);
+  uint16_t frameDelay();
+  uint16_t sleepRadio(uint16_t us);
+  void buildPacketTemplate();
+  void buildPacket(uint8_t buffer);
+  void buildBindPacket(uint8_t *packet, uint8_t state);
   void updateTelemetry();
+  void pollTelemetry();
+  void resetLink();
+  void updateLink();
+  void useRadio(uint8_t index);
+  void tuneOtherRadio(uint8_t channel);
+  void bindOtherRadio();
+  void updateDiversity();
+  void switchRadio();
+  void powerUp();
+  void powerDown();
+  void saveSession();
+  void storeSessionStep();
+  HubsanControls &nextControls();
+  void publishControls();
 
-  uint16_t m_id;
+  uint32_t m_id;
   int16_t m_state;
+  uint8_t m_telemetryState;
+  uint32_t m_frameStartUs;
   uint16_t m_vtxFreq;
   uint8_t m_channel;
   uint32_t m_sessionID;
+  uint32_t m_modelID;
   uint8_t m_packetCount;
   uint32_t m_bindTime;
   uint8_t m_rssiChannel;
-  bool m_enableFlip;
-  bool m_enableLED;
-  bool m_recordVideo;
-  uint8_t m_sticks[4];
+  uint8_t m_txPower;
+  bool m_powerControl;
+  uint8_t m_minPower;
+  uint8_t m_powerHold;
+  uint8_t m_powerWindows;
+  bool m_powerSteppedDown;
+  bool m_powerChanged;
+  uint16_t m_powerChanges;
+  uint16_t m_lossFrames;
+  uint8_t m_linkFrames;
+  uint8_t m_linkTelemetry;
+  uint8_t m_linkCrcErrors;
+  uint16_t m_linkRssiSum;
+  uint8_t m_longerGap;
+  uint8_t m_gapWindows;
+  uint8_t m_framesSinceTelemetry;
+  uint8_t m_telemetryGap;
+  Snapshot<HubsanLinkQuality> m_linkQuality;
+  HubsanControls m_controls[2];
+  volatile uint8_t m_activeControls;
+  volatile uint8_t m_controlsVersion;
+  uint8_t m_txTemplate[16];
+  uint8_t m_txPackets[2][16];
+  bool m_txIsData[2];
+  uint8_t m_txNext;
+  bool m_txPrepared;
+  uint8_t m_txVersion;
+  uint8_t m_rxPacket[16];
+  StickScale m_scales[4];
   bool m_forceBind;
+  Snapshot<HubsanTelemetry> m_telemetry;
+  uint32_t m_setupStartUs;
+  uint32_t m_calTimeoutUs;
+  Snapshot<HubsanSetupStatus> m_setupStatus;
+  uint8_t m_surveyIndex;
+  uint16_t m_surveyBudgetUs;
+  uint32_t m_surveyStartUs;
+  bool m_surveyRetune;
+  uint32_t m_sliceStartUs;
+  Snapshot<HubsanSurvey> m_surveyResult;
+  uint8_t m_calibration[3];
+  bool m_useStoredCal;
+  uint16_t m_storageAddress;
+  HubsanSession m_session;
+  uint8_t m_storeIndex;
+  bool m_resumePending;
+  uint32_t m_resumeMs;
+  bool m_lowPower;
+  bool m_radioAsleep;
+  uint16_t m_frameUs;
+  A7105RadioBase *m_radios[2];
+  uint8_t m_setupRadio;
+  uint8_t m_txRadio;
+  bool m_rxThisFrame;
+  uint8_t m_divFrames;
+  uint16_t m_divLossFrames;
+  uint8_t m_divTelemetry[2];
+  uint16_t m_divRssiSum[2];
+  Snapshot<HubsanDiversity> m_diversity;
 };
 
+/**
+ * @typedef Hubsan
+ * @brief Hubsan protocol as an IProtocol, as it always was.
+ *
+ * Sketches that do not need an IProtocol can use StaticHubsan instead, which
+ * saves the vtable and lets calls be inlined.
+ */
+typedef DynamicProtocol<StaticHubsan> Hubsan;
+
 #endif
@@ -0,0 +1,161 @@
+/** @file */
+
+#include "HubsanSlots.h"
+
+/**
+ * @brief Creates an empty set of slots.
+ * @param slotUs Slot length, also the data frame of each model
+ */
+HubsanSlots::HubsanSlots(uint16_t slotUs)
+    : m_count(0)
+    , m_current(0)
+    , m_inSlot(false)
+    , m_slotUs(slotUs)
+    , m_slotStartUs(0)
+{
+}
+
+/**
+ * @brief Adds a model, its turn comes after those added before.
+ *
+ * Call before tx() is scheduled. Sets the model's data frame to the slot
+ * length.
+ *
+ * @param model Model, set up or binding as when flown alone
+ * @return False if HUBSAN_SLOTS_MAX models have been added
+ */
+bool HubsanSlots::add(StaticHubsan &model)
+{
+  if (m_count == HUBSAN_SLOTS_MAX)
+    return false;
+
+  model.setFrameTime(m_slotUs);
+  m_models[m_count] = &model;
+  m_readyUs[m_count] = halMicros();
+  m_count++;
+
+  // The first slot goes to the first model
+  m_current = m_count - 1;
+
+  return true;
+}
+
+/**
+ * @brief Runs the slot of the current model, or starts the next slot.
+ *
+ * Call when the time returned by the last call has passed, as
+ * StaticHubsan::tx().
+ *
+ * @return Time in microseconds until the next call
+ */
+uint16_t HubsanSlots::tx()
+{
+  if (!m_count)
+    return m_slotUs;
+
+  if (!m_inSlot)
+  {
+    uint16_t waitUs = startSlot(halMicros());
+    if (waitUs)
+      return waitUs;
+  }
+
+  StaticHubsan &model = *m_models[m_current];
+  uint16_t d = model.tx();
+
+  if (!model.exchangeDone())
+    return d;
+
+  return endSlot(d);
+}
+
+/**
+ * @brief Gives the radio to the next model that is ready.
+ * @param nowUs halMicros() time
+ * @return Time until a model is ready, 0 if a slot started
+ */
+uint16_t HubsanSlots::startSlot(uint32_t nowUs)
+{
+  uint32_t waitUs = 0xFFFFFFFF;
+  uint8_t index = m_count;
+
+  // Round robin from the model after the last, passing over any still
+  // waiting in their bind
+  for (uint8_t i = 1; i <= m_count; i++)
+  {
+    uint8_t next = (m_current + i) % m_count;
+
+    if (!halTimeAfter(m_readyUs[next], nowUs))
+    {
+      index = next;
+      break;
+    }
+
+    waitUs = min(waitUs, m_readyUs[next] - nowUs);
+  }
+
+  if (index == m_count)
+    return waitUs;
+
+  StaticHubsan &model = *m_models[index];
+  HubsanSlotStats &stats = m_stats[index].beginWrite();
+
+  stats.slots++;
+  if (model.bound())
+  {
+    if (stats.frames)
+    {
+      stats.maxGapUs = max(stats.maxGapUs, nowUs - m_lastStartUs[index]);
+      stats.elapsedUs = nowUs - m_firstStartUs[index];
+    }
+    else
+      m_firstStartUs[index] = nowUs;
+
+    stats.frames++;
+    m_lastStartUs[index] = nowUs;
+  }
+
+  m_stats[index].endWrite();
+
+  m_current = index;
+  m_inSlot = true;
+  m_slotStartUs = nowUs;
+  model.selectRadio();
+
+  return 0;
+}
+
+/**
+ * @brief Ends the slot of the current model.
+ * @param delayUs Delay the model returned, until it is ready again
+ * @return Time until the next slot
+ */
+uint16_t HubsanSlots::endSlot(uint16_t delayUs)
+{
+  uint32_t nowUs = halMicros();
+  uint32_t endUs = m_slotStartUs + m_slotUs;
+  uint16_t wakeUs = m_models[m_current]->releaseRadio();
+
+  m_inSlot = false;
+  m_readyUs[m_current] = nowUs + delayUs;
+
+  // At the end of the slot, once the radio is awake
+  if (halTimeAfter(nowUs + wakeUs, endUs))
+    return wakeUs;
+
+  return endUs - nowUs;
+}
+
+/**
+ * @brief Gets the slots given to a model.
+ * @param index Model, in the order added
+ * @param stats Statistics to copy into
+ * @return False if the model has not had a slot
+ */
+bool HubsanSlots::getStats(uint8_t index, HubsanSlotStats &stats) const
+{
+  if (index >= m_count)
+    return false;
+
+  return m_stats[index].read(stats);
+}
@@ -0,0 +1,85 @@
+/** @file */
+
+#ifndef _HUBSAN_SLOTS_AYA_H_
+#define _HUBSAN_SLOTS_AYA_H_
+
+#include "Hubsan.h"
+#include "Snapshot.h"
+
+/**
+ * @def HUBSAN_SLOTS_MAX
+ * @brief Most models a HubsanSlots can share the radio between.
+ */
+#define HUBSAN_SLOTS_MAX 4
+
+/**
+ * @def HUBSAN_SLOT_US
+ * @brief Default slot length, room for a data packet and its telemetry.
+ */
+#define HUBSAN_SLOT_US 6500
+
+/**
+ * @struct HubsanSlotStats
+ * @brief Slots given to one model.
+ *
+ * The model's data packet rate is (frames - 1) * 1000000 / elapsedUs, its
+ * worst latency maxGapUs.
+ */
+struct HubsanSlotStats
+{
+  uint32_t slots;     //!< Slots run, binding or bound
+  uint32_t frames;    //!< Slots with a data frame
+  uint32_t maxGapUs;  //!< Longest time between the starts of two data frames
+  uint32_t elapsedUs; //!< Time from the first data frame to the last
+};
+
+/**
+ * @class HubsanSlots
+ * @brief Flies several Hubsan models from one A7105 by time division.
+ *
+ * The models take turns in slots. A slot starts with the model's radio ID,
+ * code and power (StaticHubsan::selectRadio()), runs its tx() until the
+ * exchange is done (StaticHubsan::exchangeDone()) and lasts at least the
+ * slot length. Data frames are set to the slot length, so with N models each
+ * gets a data packet every N slots. Bind exchanges may stretch a slot by a
+ * few ms and a model waiting in its bind does not take its turn.
+ *
+ * Set up the radio with the first model added, before the others bind.
+ * Models bind to whichever Hubsan is binding, switch them on one at a time.
+ * Either StaticHubsan or Hubsan can be added.
+ */
+class HubsanSlots
+{
+public:
+  HubsanSlots(uint16_t slotUs = HUBSAN_SLOT_US);
+
+  bool add(StaticHubsan &model);
+  uint16_t tx();
+
+  /**
+   * @brief Gets the number of models added.
+   */
+  uint8_t count() const
+  {
+    return m_count;
+  }
+
+  bool getStats(uint8_t index, HubsanSlotStats &stats) const;
+
+private:
+  uint16_t startSlot(uint32_t nowUs);
+  uint16_t endSlot(uint16_t delayUs);
+
+  StaticHubsan *m_models[HUBSAN_SLOTS_MAX];
+  uint8_t m_count;
+  uint8_t m_current;
+  bool m_inSlot;
+  uint16_t m_slotUs;
+  uint32_t m_slotStartUs;
+  uint32_t m_readyUs[HUBSAN_SLOTS_MAX];
+  uint32_t m_firstStartUs[HUBSAN_SLOTS_MAX];
+  uint32_t m_lastStartUs[HUBSAN_SLOTS_MAX];
+  Snapshot<HubsanSlotStats> m_stats[HUBSAN_SLOTS_MAX];
+};
+
+#endif
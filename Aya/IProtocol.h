@@ -3,7 +3,7 @@
 #ifndef _IPROTOCOL_AYA_H_
 #define _IPROTOCOL_AYA_H_
 
-#include <Arduino.h>
+#include "HAL.h"
 
 /**
  * @enum ProtocolCommand
@@ -17,7 +17,8 @@ enum ProtocolCommand
   COMMAND_ROLL = 3,
   COMMAND_VIDEO,
   COMMAND_FLIPS,
-  COMMAND_LIGHTS
+  COMMAND_LIGHTS,
+  COMMAND_COUNT //!< Number of commands
 };
 
 /**
@@ -53,6 +54,26 @@ public:
    */
   virtual bool setCommand(ProtocolCommand command, uint16_t value) = 0;
 
+  /**
+   * @brief Sends every command to the model at once.
+   * @param values Value of each command, indexed by ProtocolCommand
+   * @return True if all commands were accepted
+   * @see setCommand()
+   *
+   * Protocols that override this apply the whole set in one pass and publish
+   * it to tx() atomically, so a packet never mixes old and new values. The
+   * default sets each command in turn.
+   */
+  virtual bool setCommands(const uint16_t values[COMMAND_COUNT])
+  {
+    bool accepted = true;
+
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+      accepted = setCommand((ProtocolCommand)i, values[i]) && accepted;
+
+    return accepted;
+  }
+
   /**
    * @brief Transmits control state to model.
    * @return If transmission was successful
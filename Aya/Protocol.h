@@ -0,0 +1,94 @@
+/** @file */
+
+#ifndef _PROTOCOL_AYA_H_
+#define _PROTOCOL_AYA_H_
+
+#include "IProtocol.h"
+
+/**
+ * @class StaticProtocol
+ * @brief Base of protocols bound at compile time (CRTP).
+ *
+ * Protocols implement the IProtocol methods without virtual, so a sketch
+ * that uses one protocol by its type has no vtables and calls can be inlined.
+ * Wrap the protocol in DynamicProtocol to use it through IProtocol.
+ *
+ * @tparam Derived Protocol class
+ */
+template <typename Derived> class StaticProtocol
+{
+public:
+  /**
+   * @copydoc IProtocol::setCommands
+   *
+   * Hidden by protocols that can apply a whole set at once.
+   */
+  bool setCommands(const uint16_t values[COMMAND_COUNT])
+  {
+    bool accepted = true;
+
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+    {
+      if (!derived().setCommand((ProtocolCommand)i, values[i]))
+        accepted = false;
+    }
+
+    return accepted;
+  }
+
+protected:
+  Derived &derived()
+  {
+    return *static_cast<Derived *>(this);
+  }
+};
+
+/**
+ * @class DynamicProtocol
+ * @brief Makes a protocol bound at compile time available through IProtocol.
+ *
+ * e.g. IProtocol *protocol = new DynamicProtocol<StaticHubsan>(id);
+ *
+ * @tparam Protocol Protocol class derived from StaticProtocol
+ */
+template <typename Protocol>
+class DynamicProtocol : public IProtocol, public Protocol
+{
+public:
+  /**
+   * @brief Creates the protocol, arguments are passed to its constructor.
+   */
+  template <typename... Args>
+  DynamicProtocol(Args... args)
+      : IProtocol()
+      , Protocol(args...)
+  {
+  }
+
+  bool setup()
+  {
+    return Protocol::setup();
+  }
+
+  bool bind()
+  {
+    return Protocol::bind();
+  }
+
+  bool setCommand(ProtocolCommand command, uint16_t value)
+  {
+    return Protocol::setCommand(command, value);
+  }
+
+  bool setCommands(const uint16_t values[COMMAND_COUNT])
+  {
+    return Protocol::setCommands(values);
+  }
+
+  uint16_t tx()
+  {
+    return Protocol::tx();
+  }
+};
+
+#endif
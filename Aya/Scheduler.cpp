@@ -0,0 +1,292 @@
+/** @file */
+
+#include "Scheduler.h"
+
+/**
+ * @def SCHEDULER_SLACK_US
+ * @brief How early a deadline may be taken as due.
+ *
+ * The alarm fires on a finer clock than halMicros(), which steps by 4us on a
+ * 16MHz AVR.
+ */
+#define SCHEDULER_SLACK_US 4
+
+/**
+ * @var scheduler_task
+ * @brief Task being run, returns the delay until its next run.
+ */
+uint16_t (*scheduler_task)();
+
+/**
+ * @var scheduler_deadline_us
+ * @brief halMicros() time of the next run.
+ *
+ * Each deadline is the previous one plus the delay returned by the task, so
+ * the time the task takes and a late start do not add up over a frame.
+ */
+volatile uint32_t scheduler_deadline_us;
+
+/**
+ * @var scheduler_woken
+ * @brief Flag to run the task before its deadline.
+ */
+volatile bool scheduler_woken;
+
+/**
+ * @var scheduler_running
+ * @brief Flag set while the alarm runs the task, with interrupts enabled.
+ */
+volatile bool scheduler_running;
+
+/**
+ * @var scheduler_stats
+ * @brief Timing statistics, updated by each run.
+ */
+Snapshot<SchedulerStats> scheduler_stats;
+
+/**
+ * @var scheduler_idle_total_us
+ * @brief Time spent in scheduler_idle().
+ *
+ * Kept apart from scheduler_stats, which only the task side writes.
+ */
+uint32_t scheduler_idle_total_us;
+
+/**
+ * @brief Adds the start of a run to the statistics.
+ * @param offset_us Start time minus the deadline
+ * @param woken True if started by scheduler_wake()
+ * @param task_us Time the task took
+ */
+void scheduler_record(int32_t offset_us, bool woken, uint32_t task_us)
+{
+  SchedulerStats &stats = scheduler_stats.beginWrite();
+
+  stats.taskUs += task_us;
+
+  if (woken)
+  {
+    stats.wakes++;
+  }
+  else
+  {
+    int16_t offset = constrain(offset_us, (int32_t)INT16_MIN,
+                               (int32_t)INT16_MAX);
+
+    if (!stats.runs || offset < stats.offsetMinUs)
+      stats.offsetMinUs = offset;
+    if (!stats.runs || offset > stats.offsetMaxUs)
+      stats.offsetMaxUs = offset;
+
+    stats.runs++;
+    stats.offsetSumUs += offset;
+    stats.offsetSqSum += (int32_t)offset * offset;
+  }
+
+  scheduler_stats.endWrite();
+}
+
+/**
+ * @brief Runs the task if it is due and sets the next deadline.
+ * @return True if the task was run
+ */
+bool scheduler_run()
+{
+  uint32_t now_us = halMicros();
+
+  // A wake between reading and clearing the flag would be lost
+  uint8_t state = halSaveInterrupts();
+  bool woken = scheduler_woken;
+  scheduler_woken = false;
+  halRestoreInterrupts(state);
+
+  if (!woken &&
+      halTimeAfter(scheduler_deadline_us, now_us + SCHEDULER_SLACK_US))
+    return false;
+
+  if (woken)
+    scheduler_deadline_us = now_us;
+
+  int32_t offset_us = now_us - scheduler_deadline_us;
+  uint32_t start_us = now_us;
+  scheduler_deadline_us += scheduler_task();
+
+  // The task served the radio, a wake while it ran came from its own strobes
+  scheduler_woken = false;
+
+  now_us = halMicros();
+  scheduler_record(offset_us, woken, now_us - start_us);
+
+  // Start again from now rather than catching up on missed runs
+  if (halTimeAfter(now_us, scheduler_deadline_us))
+    scheduler_deadline_us = now_us;
+
+  return true;
+}
+
+#if defined(HAL_ALARM_MAX_US)
+/**
+ * @brief Sets the alarm for the next deadline, or at once if woken.
+ *
+ * Deadlines further away than HAL_ALARM_MAX_US are reached in steps. Call
+ * with interrupts disabled, so a wake can not be overwritten.
+ */
+void scheduler_arm()
+{
+  int32_t remaining_us = scheduler_deadline_us - halMicros();
+
+  halSetAlarm(scheduler_woken
+                  ? 0
+                  : constrain(remaining_us, 0, (int32_t)HAL_ALARM_MAX_US));
+}
+
+/**
+ * @brief Called when the alarm fires.
+ *
+ * Runs the task with interrupts enabled, so the CPPM decoder, millis() and
+ * the GIO1 pin change are not held off for the time tx() takes. A wake during
+ * the run fires the alarm into the guard below, the run has served it (see
+ * scheduler_run()) and sets the alarm again after.
+ */
+void scheduler_alarm_isr()
+{
+  if (!scheduler_task || scheduler_running)
+    return;
+
+  scheduler_running = true;
+  halInterrupts();
+
+  scheduler_run();
+
+  halNoInterrupts();
+  scheduler_arm();
+  scheduler_running = false;
+}
+#endif
+
+/**
+ * @brief Starts running a task.
+ *
+ * Where the HAL has an alarm (HAL_ALARM_MAX_US) the task runs from the timer
+ * interrupt at each deadline, with interrupts enabled, otherwise
+ * scheduler_poll() must be called often.
+ *
+ * @param task Task to run, e.g. a function calling IProtocol::tx(), returns
+ * the delay to its next run in microseconds
+ * @param delay_us Delay to the first run
+ */
+void scheduler_start(uint16_t (*task)(), uint16_t delay_us)
+{
+  scheduler_stop();
+  scheduler_reset_stats();
+
+  scheduler_woken = false;
+  scheduler_deadline_us = halMicros() + delay_us;
+  scheduler_task = task;
+
+#if defined(HAL_ALARM_MAX_US)
+  halAttachAlarm(scheduler_alarm_isr);
+  scheduler_arm();
+#endif
+}
+
+/**
+ * @brief Stops running the task.
+ */
+void scheduler_stop()
+{
+#if defined(HAL_ALARM_MAX_US)
+  halDetachAlarm();
+#endif
+
+  scheduler_task = NULL;
+}
+
+/**
+ * @brief Runs the task as soon as possible instead of at its deadline.
+ *
+ * May be called from an interrupt, e.g. as a7105_wtr_handler. A wake while
+ * the task runs is taken as served by that run.
+ */
+void scheduler_wake()
+{
+  scheduler_woken = true;
+
+#if defined(HAL_ALARM_MAX_US)
+  if (scheduler_task)
+    halSetAlarm(0);
+#endif
+}
+
+/**
+ * @brief Runs the task if it is due, when there is no alarm.
+ *
+ * Does nothing where the task runs from the alarm, so sketches can call it
+ * from loop() either way.
+ *
+ * @return True if the task was run
+ */
+bool scheduler_poll()
+{
+#if defined(HAL_ALARM_MAX_US)
+  return false;
+#else
+  return scheduler_task && scheduler_run();
+#endif
+}
+
+/**
+ * @brief Waits for the next interrupt, sleeping where the HAL can.
+ *
+ * Where the task runs from the alarm (HAL_ALARM_MAX_US) and the HAL has
+ * halSleep() the CPU sleeps until an interrupt, the alarm, a pin change or
+ * the millis() tick, so loop() can call this when it has nothing else to do.
+ * Otherwise it polls the task.
+ */
+void scheduler_idle()
+{
+#if defined(HAL_ALARM_MAX_US) && defined(HAL_SLEEP)
+  uint32_t start_us = halMicros();
+
+  halNoInterrupts();
+  halSleep();
+
+  scheduler_idle_total_us += halMicros() - start_us;
+#else
+  scheduler_poll();
+#endif
+}
+
+/**
+ * @brief Gets the time spent in scheduler_idle().
+ *
+ * Includes the interrupts that end each sleep, the task among them, so the
+ * time asleep is this less SchedulerStats::taskUs over the same period. Wraps
+ * after ~71 minutes, compare differences.
+ */
+uint32_t scheduler_idle_us()
+{
+  return scheduler_idle_total_us;
+}
+
+/**
+ * @brief Gets the timing statistics.
+ * @param stats Statistics to copy into
+ * @return True if the scheduler has been started
+ */
+bool scheduler_read_stats(SchedulerStats &stats)
+{
+  return scheduler_stats.read(stats);
+}
+
+/**
+ * @brief Clears the timing statistics.
+ */
+void scheduler_reset_stats()
+{
+  // The task may be updating them from the alarm
+  uint8_t state = halSaveInterrupts();
+  scheduler_stats.beginWrite() = SchedulerStats();
+  scheduler_stats.endWrite();
+  halRestoreInterrupts(state);
+}
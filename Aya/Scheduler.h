@@ -0,0 +1,37 @@
+/** @file */
+
+#ifndef _SCHEDULER_AYA_H_
+#define _SCHEDULER_AYA_H_
+
+#include "HAL.h"
+#include "Snapshot.h"
+
+/**
+ * @struct SchedulerStats
+ * @brief Start times of task runs relative to their deadlines.
+ *
+ * The spread of the offset (offsetMaxUs - offsetMinUs) is the jitter of the
+ * TX period. Runs started early by scheduler_wake() are only counted. The
+ * time spent in the task is summed over all runs, for the duty cycle.
+ */
+struct SchedulerStats
+{
+  uint32_t runs;        //!< Runs started at a deadline
+  uint32_t wakes;       //!< Runs started by scheduler_wake()
+  int16_t offsetMinUs;  //!< Earliest start after the deadline
+  int16_t offsetMaxUs;  //!< Latest start after the deadline
+  int32_t offsetSumUs;  //!< Sum of offsets, for the mean
+  uint64_t offsetSqSum; //!< Sum of squared offsets, for the RMS
+  uint32_t taskUs;      //!< Time spent running the task
+};
+
+void scheduler_start(uint16_t (*task)(), uint16_t delay_us = 0);
+void scheduler_stop();
+void scheduler_wake();
+bool scheduler_poll();
+void scheduler_idle();
+uint32_t scheduler_idle_us();
+bool scheduler_read_stats(SchedulerStats &stats);
+void scheduler_reset_stats();
+
+#endif
@@ -0,0 +1,91 @@
+/** @file */
+
+#ifndef _SNAPSHOT_AYA_H_
+#define _SNAPSHOT_AYA_H_
+
+#include "HAL.h"
+
+/**
+ * @class Snapshot
+ * @brief Single writer, lock-free published value (sequence lock).
+ *
+ * The writer updates the value in place between beginWrite() and endWrite(),
+ * readers copy it out with read() and retry if a write happened meanwhile.
+ * Neither side disables interrupts.
+ *
+ * read() must not be called from an interrupt that can preempt the writer,
+ * it would never see the write complete.
+ */
+template <typename T> class Snapshot
+{
+public:
+  Snapshot()
+      : m_sequence(0)
+      , m_value()
+  {
+  }
+
+  /**
+   * @brief Starts an update of the value.
+   * @return Value to be modified in place
+   */
+  T &beginWrite()
+  {
+    m_sequence++;
+    halMemoryBarrier();
+    return m_value;
+  }
+
+  /**
+   * @brief Publishes the value modified since beginWrite().
+   */
+  void endWrite()
+  {
+    halMemoryBarrier();
+    // Skip 0 on wrap around, it means nothing has been published
+    if (++m_sequence == 0)
+      m_sequence = 2;
+  }
+
+  /**
+   * @brief Copies out a consistent value.
+   * @param value Destination
+   * @return False if nothing has been published yet
+   */
+  bool read(T &value) const
+  {
+    uint8_t sequence;
+
+    do
+    {
+      sequence = m_sequence;
+      halMemoryBarrier();
+      value = m_value;
+      halMemoryBarrier();
+    } while ((sequence & 1) || sequence != m_sequence);
+
+    return sequence != 0;
+  }
+
+  /**
+   * @brief Gets the value as last written, for the writer only.
+   */
+  const T &value() const
+  {
+    return m_value;
+  }
+
+  /**
+   * @brief Gets the sequence number, changes with every update.
+   */
+  uint8_t sequence() const
+  {
+    return m_sequence;
+  }
+
+private:
+  volatile uint8_t m_sequence;
+  T m_value;
+};
+
+#endif
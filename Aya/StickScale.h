@@ -0,0 +1,95 @@
+/** @file */
+
+#ifndef _STICK_SCALE_AYA_H_
+#define _STICK_SCALE_AYA_H_
+
+#include "HAL.h"
+
+/**
+ * @class StickScale
+ * @brief Converts a channel pulse width to a 0-255 stick value.
+ *
+ * The reciprocal of the endpoint range is worked out when the scale is made
+ * (at compile time for constants), so apply() is a clamp and a 16 x 16 bit
+ * multiply into 32 bits keeping the top 16, instead of the 32 bit multiply
+ * and divide in map(). For ranges of 256us to 2047us the result matches
+ * map() to within 1, for the default endpoints it is exact.
+ */
+class StickScale
+{
+public:
+  /**
+   * @brief Creates a scale.
+   * @param minUs Pulse width giving 0 (255 if reversed)
+   * @param maxUs Pulse width giving 255 (0 if reversed), at least minUs + 256
+   * @param reversed Swap the ends
+   * @param expoPercent Cubic expo around the centre, 0 for linear
+   */
+  constexpr StickScale(uint16_t minUs = 1000, uint16_t maxUs = 2000,
+                       bool reversed = false, uint8_t expoPercent = 0)
+      : m_minUs(minUs)
+      , m_maxUs(maxUs)
+      , m_scale(reciprocal(maxUs - minUs))
+      , m_reversed(reversed)
+      , m_expo(expoPercent >= 100 ? 255 : expoPercent * 255 / 100)
+  {
+  }
+
+  /**
+   * @brief Converts a pulse width.
+   * @param us Pulse width in microseconds
+   * @return Stick value
+   */
+  uint8_t apply(uint16_t us) const
+  {
+    uint8_t value;
+
+    if (us <= m_minUs)
+      value = 0;
+    else if (us >= m_maxUs)
+      value = 255;
+    else
+      // Both operands are 16 bit, only the product is widened
+      value = ((uint32_t)(uint16_t)(us - m_minUs) * m_scale) >> 16;
+
+    if (m_expo)
+      value = expo(value);
+
+    return m_reversed ? 255 - value : value;
+  }
+
+private:
+  /**
+   * @brief Gets 255 / range in 16.16 fixed point, rounded up so the end of
+   * the range is not lost to truncation.
+   */
+  static constexpr uint16_t reciprocal(uint16_t range)
+  {
+    return range ? ((255UL << 16) + range - 1) / range : 0;
+  }
+
+  /**
+   * @brief Blends the value towards a cubic curve around the centre.
+   *
+   * Works on the distance from the centre (0-255) with 8 bit multiplies,
+   * m^3 / 255^2 being approximated by two multiply and shift steps.
+   */
+  uint8_t expo(uint8_t value) const
+  {
+    int16_t x = 2 * (int16_t)value - 255;
+    uint8_t m = x < 0 ? -x : x;
+    uint8_t square = ((uint16_t)m * m + 255) >> 8;
+    uint8_t cube = ((uint16_t)square * m + 255) >> 8;
+    uint8_t y = m - (((uint16_t)(m - cube) * m_expo) >> 8);
+
+    return x < 0 ? (255 - y) >> 1 : (255 + y) >> 1;
+  }
+
+  uint16_t m_minUs;
+  uint16_t m_maxUs;
+  uint16_t m_scale;
+  bool m_reversed;
+  uint8_t m_expo;
+};
+
+#endif
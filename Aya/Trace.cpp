@@ -0,0 +1,162 @@
+/** @file */
+
+#include "Trace.h"
+
+#if defined(TRACE_ENABLED)
+
+#if (TRACE_EVENTS & (TRACE_EVENTS - 1)) || TRACE_EVENTS > 256
+#error "TRACE_EVENTS must be a power of two, at most 256"
+#endif
+
+/**
+ * @struct TraceEvent
+ * @brief Event waiting in the trace buffer.
+ */
+struct TraceEvent
+{
+  uint8_t type;    //!< TraceType
+  uint8_t a;       //!< First argument
+  uint8_t b;       //!< Second argument
+  uint16_t timeUs; //!< Low 16 bits of the halMicros() time
+};
+
+/**
+ * @var trace_buffer
+ * @brief Events recorded and not yet sent.
+ *
+ * One writer, trace_event(), fills it at trace_head and one reader,
+ * trace_drain(), empties it at trace_tail. Each only moves its own index, so
+ * the writer may be an interrupt preempting the reader, or the other way
+ * round, without either disabling interrupts. Events must only be recorded
+ * from one context at a time, e.g. the scheduler task.
+ */
+TraceEvent trace_buffer[TRACE_EVENTS];
+
+/**
+ * @var trace_head
+ * @brief Index of the next event to write.
+ */
+volatile uint8_t trace_head;
+
+/**
+ * @var trace_tail
+ * @brief Index of the next event to send.
+ */
+volatile uint8_t trace_tail;
+
+/**
+ * @var trace_time_high
+ * @brief High 16 bits of the time last recorded with TRACE_TIME.
+ */
+uint16_t trace_time_high;
+
+/**
+ * @var trace_time_valid
+ * @brief Flag to indicate if a TRACE_TIME event has been recorded.
+ */
+bool trace_time_valid;
+
+/**
+ * @var trace_lost
+ * @brief Events lost to a full buffer since the last one recorded.
+ */
+uint8_t trace_lost;
+
+/**
+ * @brief Adds an event to the buffer.
+ * @return False if the buffer is full
+ */
+static bool trace_put(uint8_t type, uint8_t a, uint8_t b, uint16_t time_us)
+{
+  uint8_t head = trace_head;
+  uint8_t next = (head + 1) & (TRACE_EVENTS - 1);
+
+  if (next == trace_tail)
+    return false;
+
+  TraceEvent &event = trace_buffer[head];
+  event.type = type;
+  event.a = a;
+  event.b = b;
+  event.timeUs = time_us;
+
+  // Publish the event only once it is complete
+  halMemoryBarrier();
+  trace_head = next;
+
+  return true;
+}
+
+/**
+ * @brief Records an event with the time.
+ *
+ * Takes constant time and never blocks. Events are 16 bit timestamped, a
+ * TRACE_TIME event goes first when the high bits have changed, and a
+ * TRACE_LOST event counts any events lost to a full buffer.
+ *
+ * @param type TraceType
+ * @param a First argument
+ * @param b Second argument
+ */
+void trace_event(uint8_t type, uint8_t a, uint8_t b)
+{
+  uint32_t time_us = halMicros();
+  uint16_t high = time_us >> 16;
+  bool full = false;
+
+  if (!trace_time_valid || high != trace_time_high)
+  {
+    full = !trace_put(TRACE_TIME, high & 0xFF, high >> 8, time_us);
+    if (!full)
+    {
+      trace_time_high = high;
+      trace_time_valid = true;
+    }
+  }
+
+  if (!full && trace_lost)
+  {
+    full = !trace_put(TRACE_LOST, trace_lost, 0, time_us);
+    if (!full)
+      trace_lost = 0;
+  }
+
+  if (full || !trace_put(type, a, b, time_us))
+  {
+    if (trace_lost < UINT8_MAX)
+      trace_lost++;
+  }
+}
+
+/**
+ * @brief Sends recorded events to Serial, as much as fits without blocking.
+ *
+ * Call from loop(). Each event is sent as TRACE_RECORD_SIZE bytes, decoded
+ * by extras/host/trace_decode. At 115200 baud this drains ~1900 events/s.
+ */
+void trace_drain()
+{
+  uint8_t record[TRACE_RECORD_SIZE];
+
+  while (trace_tail != trace_head &&
+         Serial.availableForWrite() >= TRACE_RECORD_SIZE)
+  {
+    uint8_t tail = trace_tail;
+    const TraceEvent &event = trace_buffer[tail];
+
+    record[0] = TRACE_SYNC;
+    record[1] = event.type;
+    record[2] = event.a;
+    record[3] = event.b;
+    record[4] = event.timeUs & 0xFF;
+    record[5] = event.timeUs >> 8;
+
+    // Free the slot only once the event has been copied out
+    halMemoryBarrier();
+    trace_tail = (tail + 1) & (TRACE_EVENTS - 1);
+
+    Serial.write(record, TRACE_RECORD_SIZE);
+  }
+}
+
+#endif
@@ -0,0 +1,80 @@
+/** @file */
+
+#ifndef _TRACE_AYA_H_
+#define _TRACE_AYA_H_
+
+#include "HAL.h"
+
+/**
+ * @def TRACE_ENABLED
+ * @brief Record protocol events in the trace buffer.
+ *
+ * Uncomment to enable, or define when building. Disabled, TRACE() compiles to
+ * nothing and trace_drain() to an empty function.
+ */
+// #define TRACE_ENABLED
+
+/**
+ * @def TRACE_EVENTS
+ * @brief Size of the trace buffer in events, a power of two.
+ *
+ * Each event takes 5 bytes of RAM on an AVR.
+ */
+#if !defined(TRACE_EVENTS)
+#define TRACE_EVENTS 32
+#endif
+
+/**
+ * @def TRACE_SYNC
+ * @brief First byte of each record sent by trace_drain().
+ */
+#define TRACE_SYNC 0xA5
+
+/**
+ * @def TRACE_RECORD_SIZE
+ * @brief Bytes sent per event: TRACE_SYNC, type, two arguments and the low 16
+ * bits of the halMicros() time, little endian.
+ */
+#define TRACE_RECORD_SIZE 6
+
+/**
+ * @enum TraceType
+ * @brief Kind of a trace event, and what its two arguments hold.
+ */
+enum TraceType
+{
+  TRACE_TIME,       //!< High 16 bits of the time of the events that follow
+  TRACE_LOST,       //!< Events lost to a full buffer before this one
+  TRACE_SETUP,      //!< Hubsan::tx() in setup, HubsanSetupState
+  TRACE_STATE,      //!< Hubsan::tx(), protocol state and telemetry state
+  TRACE_DELAY,      //!< Delay returned by Hubsan::tx(), low and high byte
+  TRACE_STROBE,     //!< Strobe command
+  TRACE_WRITE_REG,  //!< Register and value written
+  TRACE_READ_REG,   //!< Register and value read
+  TRACE_WRITE_ID,   //!< Low two bytes of the ID written
+  TRACE_WRITE_DATA, //!< Packet length and channel
+  TRACE_READ_DATA,  //!< Packet length and first byte
+  TRACE_BUSY,       //!< Busy poll result, and 1 if read from GIO1
+};
+
+#if defined(TRACE_ENABLED)
+/**
+ * @def TRACE
+ * @brief Records an event, see trace_event().
+ */
+#define TRACE(type, a, b) trace_event(type, a, b)
+
+void trace_event(uint8_t type, uint8_t a, uint8_t b);
+void trace_drain();
+#else
+#define TRACE(type, a, b)                                                     \
+  do                                                                          \
+  {                                                                           \
+  } while (0)
+
+inline void trace_drain()
+{
+}
+#endif
+
+#endif
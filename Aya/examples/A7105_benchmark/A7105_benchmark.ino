@@ -0,0 +1,174 @@
+/**
+ * @file
+ *
+ * Measures the bus time taken by the A7105 transport selected with
+ * A7105_SPI_MODE in A7105.h.
+ *
+ * The difference between the burst and per byte packet RX times is the time
+ * saved in each telemetry poll.
+ *
+ * With the bit-bang transport, also counts the CPU cycles of a7105Write(),
+ * which reaches the pins through HalPin, against the same byte clocked out
+ * with digitalWrite().
+ *
+ * A7105 on pins:
+ *  SDIO = 5
+ *  SCK = 4
+ *  SCS = 2
+ */
+
+#include <A7105.h>
+
+#define ITERATIONS 1000
+
+uint8_t packet[16];
+
+#if A7105_SPI_MODE == A7105_SPI_BITBANG && defined(TCNT1)
+/**
+ * @brief a7105Write() as it was before HalPin, for comparison.
+ * @param c Byte to write
+ */
+void digital_write(uint8_t c)
+{
+  uint8_t n = 8;
+
+  digitalWrite(SCLK_PIN, LOW);
+  digitalWrite(SDIO_PIN, LOW);
+  while (n--)
+  {
+    if (c & 0x80)
+      digitalWrite(SDIO_PIN, HIGH);
+    else
+      digitalWrite(SDIO_PIN, LOW);
+    digitalWrite(SCLK_PIN, HIGH);
+    delayMicroseconds(1);
+    digitalWrite(SCLK_PIN, LOW);
+    c = c << 1;
+  }
+  digitalWrite(SDIO_PIN, HIGH);
+}
+
+/**
+ * @brief Prints the average cycles of ITERATIONS writes.
+ * @param name Name of the write
+ * @param write Function writing a byte
+ */
+void print_cycles(const char *name, void (*write)(uint8_t))
+{
+  uint32_t cycles = 0;
+  uint16_t start;
+
+  // Timer1 free running at the CPU clock
+  TCCR1A = 0;
+  TCCR1B = 1 << CS10;
+
+  // CS stays high, the A7105 ignores the bytes
+  noInterrupts();
+
+  for (uint16_t i = 0; i < ITERATIONS; i++)
+  {
+    start = TCNT1;
+    write(0x55);
+    cycles += (uint16_t)(TCNT1 - start);
+  }
+
+  interrupts();
+
+  Serial.print(name);
+  Serial.print("\t");
+  Serial.print((float)cycles / ITERATIONS);
+  Serial.println(" cycles");
+}
+#endif
+
+/**
+ * @brief Prints the average time of ITERATIONS operations.
+ * @param name Name of the operation
+ * @param start_us Time before the first operation
+ */
+void print_result(const char *name, uint32_t start_us)
+{
+  uint32_t elapsed_us = micros() - start_us;
+
+  Serial.print(name);
+  Serial.print("\t");
+  Serial.print((float)elapsed_us / ITERATIONS);
+  Serial.println(" us");
+}
+
+/**
+ * @brief Setup routine.
+ */
+void setup()
+{
+  uint32_t start_us;
+  uint16_t i;
+
+  Serial.begin(9600);
+
+#if A7105_SPI_MODE == A7105_SPI_HARDWARE
+  Serial.println("Transport: hardware SPI");
+#elif A7105_SPI_MODE == A7105_SPI_USART
+  Serial.println("Transport: USART SPI");
+#else
+  Serial.println("Transport: bit-bang");
+#endif
+  Serial.flush();
+
+  a7105SetupSPI();
+  a7105Reset();
+
+  for (i = 0; i < sizeof(packet); i++)
+    packet[i] = i;
+
+  start_us = micros();
+  for (i = 0; i < ITERATIONS; i++)
+    a7105Strobe(A7105_STANDBY);
+  print_result("a7105Strobe", start_us);
+
+  start_us = micros();
+  for (i = 0; i < ITERATIONS; i++)
+    a7105WriteReg(A7105_0F_CHANNEL, 0x14);
+  print_result("a7105WriteReg", start_us);
+
+  start_us = micros();
+  for (i = 0; i < ITERATIONS; i++)
+    a7105ReadReg(A7105_0F_CHANNEL);
+  print_result("a7105ReadReg", start_us);
+
+  start_us = micros();
+  for (i = 0; i < ITERATIONS; i++)
+  {
+    a7105WriteData(packet, sizeof(packet), 0x14);
+    a7105Strobe(A7105_STANDBY);
+  }
+  print_result("packet TX", start_us);
+
+  start_us = micros();
+  for (i = 0; i < ITERATIONS; i++)
+    a7105ReadData(packet, sizeof(packet));
+  print_result("packet RX (burst)", start_us);
+
+  // Equivalent to one a7105ReadReg() per FIFO byte
+  start_us = micros();
+  for (i = 0; i < ITERATIONS; i++)
+  {
+    a7105Strobe(A7105_RST_RDPTR);
+    for (uint8_t j = 0; j < sizeof(packet); j++)
+      packet[j] = a7105ReadReg(A7105_05_FIFO_DATA);
+  }
+  print_result("packet RX (per byte)", start_us);
+
+#if A7105_SPI_MODE == A7105_SPI_BITBANG && defined(TCNT1)
+  // The 1us clock high time is 8 x 16 cycles of each byte at 16MHz
+  print_cycles("a7105Write (HalPin)", a7105Write);
+  print_cycles("a7105Write (digitalWrite)", digital_write);
+#endif
+}
+
+/**
+ * @brief Main routine.
+ */
+void loop()
+{
+}
@@ -10,6 +10,7 @@ void setup()
   Serial.begin(9600);
 
   bool initResult = cppm_init(1); // Interrupt 1, pin 3
+  // bool initResult = cppm_init_capture(); // Input capture, pin 8
   Serial.println(initResult);
 }
 
@@ -18,21 +19,29 @@ void setup()
  */
 void loop()
 {
-  if (cppm_fresh)
+  static uint32_t last_sequence = 0;
+  CppmFrame frame;
+
+  if (cppm_read_frame(frame) && frame.sequence != last_sequence)
   {
-    cppm_read();
-    print_cppm_values();
+    last_sequence = frame.sequence;
+    print_cppm_frame(frame);
   }
 }
 
 /**
- * @brief Prints all CPPM values to serial.
+ * @brief Prints a frame number, its age and all CPPM values to serial.
  */
-void print_cppm_values()
+void print_cppm_frame(const CppmFrame &frame)
 {
-  for (size_t i = 0; i < CPPM_NUM_CHANNELS; i++)
+  Serial.print(frame.sequence);
+  Serial.print("\t");
+  Serial.print(micros() - frame.timeUs);
+  Serial.print("us\t");
+
+  for (size_t i = 0; i < frame.channelCount; i++)
   {
-    Serial.print(cppm_channels[i]);
+    Serial.print(frame.channels[i]);
     Serial.print("\t");
   }
 
@@ -7,36 +7,74 @@
  *  SCS = 2
  * CPPM on pin 3
  * LED on pin 13
+ *
+ * hubsan.tx() is run by the scheduler at the deadlines it returns.
+ *
+ * Optional, see the defines below and in the library headers:
+ *  - GIO1 wired to pin 6, uncomment GIO1_PIN in A7105.h
+ *  - Timer1 for the scheduler alarm, so hubsan.tx() is not delayed by loop(),
+ *    uncomment HAL_TIMER1 in HAL.h
+ *  - CPPM on pin 8 with the input capture decoder, not affected by the time
+ *    other interrupts take (USE_CPPM_CAPTURE, needs HAL_TIMER1)
+ *  - the bind session kept in EEPROM and resumed (USE_STORAGE)
+ *  - the radio asleep between packets (USE_LOW_POWER)
+ *  - the protocol trace sent on Serial at 115200 baud, with TRACE_ENABLED in
+ *    Trace.h, decode it with extras/host/trace_decode
  */
 
-#include <TimerOne.h>
-
+#include <A7105.h>
 #include <CPPM.h>
 #include <Hubsan.h>
+#include <Scheduler.h>
+#include <Trace.h>
+
+// #define USE_CPPM_CAPTURE
+// #define USE_STORAGE
+// #define USE_LOW_POWER
 
 #define LED_PIN 13
 
 #define THROTTLE_CHANNEL 2
 #define MIN_THROTTLE 1050
 
-Hubsan hubsan(0x35000001, true, 5885);
-uint32_t next_update_us = 0;
+// Bound at compile time, declare as Hubsan to pass it on as an IProtocol
+StaticHubsan hubsan(0x35000001, true, 5885);
+uint32_t led_toggle_ms = 0;
+bool cppm_lost = false;
+
+/**
+ * @brief Sends Hubsan packets, run by the scheduler.
+ */
+uint16_t hubsan_tx()
+{
+  return hubsan.tx();
+}
 
 /**
  * @brief Setup routine.
  */
 void setup()
 {
+#if defined(TRACE_ENABLED)
+  Serial.begin(115200);
+#else
   Serial.begin(9600);
+#endif
 
-  Timer1.attachInterrupt(toggle_led);
-  Timer1.initialize(50000); // 0.05s
+  pinMode(LED_PIN, OUTPUT);
 
+#if defined(USE_CPPM_CAPTURE)
+  cppm_init_capture(); // Pin 8
+#else
   cppm_init(1); // Interrupt 1, pin 3
+#endif
 
   /* Wait for PPM signal */
   while (!cppm_fresh)
+  {
+    update_led(50);
     delay(10);
+  }
   cppm_read();
 
   /* Wait for zero throttle */
@@ -45,15 +83,31 @@ void setup()
     if (cppm_fresh)
       cppm_read();
 
+    update_led(50);
     delay(10);
   }
 
   delay(1000);
 
-  hubsan.setup();
+  // The radio is set up from tx(), then binds
+  hubsan.beginSetup();
+#if defined(USE_LOW_POWER)
+  hubsan.setLowPower(true);
+#endif
+#if defined(USE_STORAGE)
+  // Unless the model is still bound to the session saved in EEPROM
+  hubsan.setStorage(0);
+  if (!hubsan.resume())
+    hubsan.bind();
+#else
   hubsan.bind();
+#endif
 
-  Timer1.setPeriod(1000000); // 1s
+#if defined(GIO1_PIN)
+  // Service the radio as soon as a TX or RX completes
+  a7105_wtr_handler = scheduler_wake;
+#endif
+  scheduler_start(hubsan_tx);
 }
 
 /**
@@ -63,26 +117,51 @@ void loop()
 {
   if (cppm_fresh)
   {
+    uint16_t commands[COMMAND_COUNT];
+
     cppm_read();
 
     // Set channel order here
-    hubsan.setCommand(COMMAND_ROLL, cppm_channels[0]);
-    hubsan.setCommand(COMMAND_PITCH, cppm_channels[1]);
-    hubsan.setCommand(COMMAND_THROTTLE, cppm_channels[THROTTLE_CHANNEL]);
-    hubsan.setCommand(COMMAND_YAW, cppm_channels[3]);
-    hubsan.setCommand(COMMAND_LIGHTS, cppm_channels[4]);
-    hubsan.setCommand(COMMAND_FLIPS, cppm_channels[5]);
+    commands[COMMAND_ROLL] = cppm_channels[0];
+    commands[COMMAND_PITCH] = cppm_channels[1];
+    commands[COMMAND_THROTTLE] = cppm_channels[THROTTLE_CHANNEL];
+    commands[COMMAND_YAW] = cppm_channels[3];
+    commands[COMMAND_LIGHTS] = cppm_channels[4];
+    commands[COMMAND_FLIPS] = cppm_channels[5];
+    commands[COMMAND_VIDEO] = 1000;
+
+    // All at once, so no packet is sent with half of the frame
+    hubsan.setCommands(commands);
+    cppm_lost = false;
   }
+  else if (!cppm_lost && cppm_stale())
+  {
+    // Failsafe, stop sending old sticks when the CPPM signal is lost
+    hubsan.setCommand(COMMAND_THROTTLE, 1000);
+    cppm_lost = true;
+  }
+
+  update_led(1000);
 
-  unsigned long now_us = micros();
-  if (now_us >= next_update_us)
-    next_update_us = (now_us + hubsan.tx());
+  // Send what the trace recorded, without waiting for the port
+  trace_drain();
+
+  // Sleep until the next interrupt (CPPM edge, alarm or millis() tick), or
+  // run hubsan.tx() on boards without a hardware alarm
+  scheduler_idle();
 }
 
 /**
  * @brief Toggles status indicator LED.
+ * @param period_ms Time between toggles
  */
-void toggle_led()
+void update_led(uint32_t period_ms)
 {
-  digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+  uint32_t now_ms = millis();
+
+  if (now_ms - led_toggle_ms >= period_ms)
+  {
+    led_toggle_ms = now_ms;
+    digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+  }
 }
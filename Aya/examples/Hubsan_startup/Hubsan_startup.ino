@@ -0,0 +1,95 @@
+/**
+ * @file
+ *
+ * Measures the time from power on to the first Hubsan bind packet, with the
+ * radio set up and the channels surveyed from tx() by the scheduler while
+ * loop() keeps running.
+ *
+ * A7105 on pins:
+ *  SDIO = 5
+ *  SCK = 4
+ *  SCS = 2
+ *  GIO1 = 6 (optional, GIO1_PIN in A7105.h)
+ */
+
+#include <Hubsan.h>
+#include <Scheduler.h>
+
+StaticHubsan hubsan(0x35000001, true, 5885);
+uint32_t start_us;
+volatile uint32_t first_bind_us = 0;
+uint32_t loops = 0;
+bool reported = false;
+
+/**
+ * @brief Sends Hubsan packets, run by the scheduler.
+ */
+uint16_t hubsan_tx()
+{
+  HubsanSurvey survey;
+
+  // The first call after the channel survey sends the first bind packet
+  if (!first_bind_us && hubsan.getSurvey(survey))
+    first_bind_us = micros();
+
+  return hubsan.tx();
+}
+
+/**
+ * @brief Setup routine.
+ */
+void setup()
+{
+  Serial.begin(9600);
+  Serial.flush();
+
+  start_us = micros();
+  hubsan.setSurveyBudget(20000);
+  hubsan.beginSetup();
+  hubsan.bind();
+  scheduler_start(hubsan_tx);
+}
+
+/**
+ * @brief Main routine.
+ */
+void loop()
+{
+  HubsanSetupStatus status;
+  HubsanSurvey survey;
+
+  scheduler_poll();
+  loops++;
+
+  if (reported || !hubsan.getSetupStatus(status))
+    return;
+
+  if (status.state == HUBSAN_SETUP_FAILED)
+  {
+    Serial.print("setup failed, error ");
+    Serial.print(status.error);
+    Serial.print(" after ");
+    Serial.print(status.attempts);
+    Serial.println(" attempts");
+    reported = true;
+  }
+  else if (first_bind_us)
+  {
+    Serial.print("setup time\t");
+    Serial.print(status.elapsedUs);
+    Serial.println(" us");
+    Serial.print("setup attempts\t");
+    Serial.println(status.attempts);
+    hubsan.getSurvey(survey);
+    Serial.print("channel survey\t");
+    Serial.print(survey.elapsedUs);
+    Serial.print(" us, channel 0x");
+    Serial.println(survey.channel, HEX);
+    Serial.print("first bind packet\t");
+    Serial.print(first_bind_us - start_us);
+    Serial.println(" us");
+    Serial.print("loop() runs meanwhile\t");
+    Serial.println(loops);
+    reported = true;
+  }
+}
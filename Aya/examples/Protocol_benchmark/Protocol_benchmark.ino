@@ -0,0 +1,93 @@
+/**
+ * @file
+ *
+ * Measures the cost of calling the protocol through IProtocol (Hubsan)
+ * against using StaticHubsan directly.
+ *
+ * Build once with DYNAMIC_PROTOCOL 0 and once with 1, and compare the flash
+ * and RAM use reported by the build as well as the printed cycles. The
+ * protocol is not set up, only the command path is timed.
+ */
+
+#include <Hubsan.h>
+
+#define DYNAMIC_PROTOCOL 0
+
+#define ITERATIONS 200
+
+#if DYNAMIC_PROTOCOL
+Hubsan hubsan;
+IProtocol *volatile protocol = &hubsan;
+#define PROTOCOL (*protocol)
+#else
+StaticHubsan hubsan;
+#define PROTOCOL hubsan
+#endif
+
+volatile uint8_t sink;
+
+/**
+ * @brief Prints the average cycles of a number of calls.
+ * @param name Name of the operation
+ * @param cycles Total cycles
+ */
+void print_result(const char *name, uint32_t cycles)
+{
+  Serial.print(name);
+  Serial.print("\t");
+  Serial.print((float)cycles / ITERATIONS);
+  Serial.println(" cycles");
+}
+
+/**
+ * @brief Setup routine.
+ */
+void setup()
+{
+  uint32_t single_cycles = 0;
+  uint32_t batch_cycles = 0;
+  uint16_t commands[COMMAND_COUNT];
+  uint16_t start;
+
+  Serial.begin(9600);
+
+#if DYNAMIC_PROTOCOL
+  Serial.println("Protocol: IProtocol");
+#else
+  Serial.println("Protocol: StaticHubsan");
+#endif
+  Serial.print("sizeof\t");
+  Serial.println(sizeof(hubsan));
+
+  // Timer1 free running at the CPU clock
+  TCCR1A = 0;
+  TCCR1B = 1 << CS10;
+
+  noInterrupts();
+
+  for (uint16_t i = 0; i < ITERATIONS; i++)
+  {
+    for (uint8_t c = 0; c < COMMAND_COUNT; c++)
+      commands[c] = 1000 + i * 5;
+
+    start = TCNT1;
+    sink = PROTOCOL.setCommand(COMMAND_THROTTLE, commands[COMMAND_THROTTLE]);
+    single_cycles += (uint16_t)(TCNT1 - start);
+
+    start = TCNT1;
+    sink = PROTOCOL.setCommands(commands);
+    batch_cycles += (uint16_t)(TCNT1 - start);
+  }
+
+  interrupts();
+
+  print_result("setCommand()", single_cycles);
+  print_result("setCommands()", batch_cycles);
+}
+
+/**
+ * @brief Main routine.
+ */
+void loop()
+{
+}
@@ -0,0 +1,123 @@
+/**
+ * @file
+ *
+ * Measures the CPU cycles taken by StaticHubsan::setCommand() for the sticks,
+ * against the map() based conversion it used before StickScale, and the
+ * cycles to apply a whole frame of commands one by one and with
+ * setCommands().
+ *
+ * Cycles are counted with Timer1 running at the CPU clock and interrupts off,
+ * averaged over the 1000-2000us range. No results are recorded yet, run it
+ * on the target before relying on StickScale being the quicker one.
+ */
+
+#include <Hubsan.h>
+
+#define STEP_US 5
+
+StaticHubsan hubsan;
+volatile uint8_t sink;
+
+/**
+ * @brief Stick conversion as done with map(), for comparison.
+ */
+uint8_t map_stick(ProtocolCommand command, uint16_t value)
+{
+  switch (command)
+  {
+  case COMMAND_THROTTLE:
+    if (value < 1100)
+      value = 1100;
+    return map(value, 1100, 2000, 0, 255);
+  case COMMAND_YAW:
+    return map(value, 1000, 2000, 0, 255);
+  default:
+    return map(value, 1000, 2000, 255, 0);
+  }
+}
+
+/**
+ * @brief Prints the average cycles of a number of calls.
+ * @param name Name of the operation
+ * @param cycles Total cycles
+ * @param calls Number of calls
+ */
+void print_result(const char *name, uint32_t cycles, uint32_t calls)
+{
+  Serial.print(name);
+  Serial.print("\t");
+  Serial.print((float)cycles / calls);
+  Serial.println(" cycles");
+}
+
+/**
+ * @brief Setup routine.
+ */
+void setup()
+{
+  uint32_t overhead_cycles = 0;
+  uint32_t map_cycles = 0;
+  uint32_t scale_cycles = 0;
+  uint32_t single_cycles = 0;
+  uint32_t batch_cycles = 0;
+  uint32_t calls = 0;
+  uint32_t frames = 0;
+  uint16_t commands[COMMAND_COUNT];
+  uint16_t start;
+
+  Serial.begin(9600);
+
+  // Timer1 free running at the CPU clock
+  TCCR1A = 0;
+  TCCR1B = 1 << CS10;
+
+  noInterrupts();
+
+  for (uint16_t us = 1000; us <= 2000; us += STEP_US)
+  {
+    for (uint8_t c = COMMAND_THROTTLE; c <= COMMAND_ROLL; c++)
+    {
+      start = TCNT1;
+      sink = c;
+      overhead_cycles += (uint16_t)(TCNT1 - start);
+
+      start = TCNT1;
+      sink = map_stick((ProtocolCommand)c, us);
+      map_cycles += (uint16_t)(TCNT1 - start);
+
+      start = TCNT1;
+      sink = hubsan.setCommand((ProtocolCommand)c, us);
+      scale_cycles += (uint16_t)(TCNT1 - start);
+
+      calls++;
+    }
+
+    for (uint8_t c = 0; c < COMMAND_COUNT; c++)
+      commands[c] = us;
+
+    start = TCNT1;
+    for (uint8_t c = 0; c < COMMAND_COUNT; c++)
+      hubsan.setCommand((ProtocolCommand)c, commands[c]);
+    single_cycles += (uint16_t)(TCNT1 - start);
+
+    start = TCNT1;
+    hubsan.setCommands(commands);
+    batch_cycles += (uint16_t)(TCNT1 - start);
+
+    frames++;
+  }
+
+  interrupts();
+
+  print_result("map()", map_cycles - overhead_cycles, calls);
+  print_result("setCommand()", scale_cycles - overhead_cycles, calls);
+  print_result("frame, setCommand()", single_cycles, frames);
+  print_result("frame, setCommands()", batch_cycles, frames);
+}
+
+/**
+ * @brief Main routine.
+ */
+void loop()
+{
+}
@@ -0,0 +1,382 @@
+/** @file */
+
+#include "A7105Model.h"
+
+/**
+ * @def MODEL_CAL_US
+ * @brief Time taken by an IF or VCO calibration.
+ */
+#define MODEL_CAL_US 250
+
+/**
+ * @def MODEL_NOISE_FLOOR
+ * @brief Default RSSI reading of a quiet channel.
+ */
+#define MODEL_NOISE_FLOOR 0xE0
+
+/**
+ * @def MODEL_SIGNAL_RSSI
+ * @brief RSSI reading latched when a packet is received.
+ */
+#define MODEL_SIGNAL_RSSI 0x40
+
+/**
+ * @brief Creates a new A7105 on the given pins.
+ * @param air Medium to send and receive packets on
+ * @param csPin Pin connected to SCS
+ * @param sclkPin Pin connected to SCK
+ * @param sdioPin Pin connected to SDIO
+ * @param gio1Pin Pin connected to GIO1, A7105_MODEL_NO_PIN if unconnected
+ */
+A7105Model::A7105Model(HostAir &air, uint8_t csPin, uint8_t sclkPin,
+                       uint8_t sdioPin, uint8_t gio1Pin)
+    : spiTransactions(0)
+    , spiBytes(0)
+    , strobes(0)
+    , txPackets(0)
+    , rxPackets(0)
+    , earlyStrobes(0)
+    , m_air(air)
+    , m_csPin(csPin)
+    , m_sclkPin(sclkPin)
+    , m_sdioPin(sdioPin)
+    , m_gio1Pin(gio1Pin)
+    , m_calFailures(0)
+    , m_wtr(false)
+    , m_blocked(false)
+    , m_rxLoss(0)
+    , m_selected(false)
+    , m_phase(SPI_COMMAND)
+{
+  memset(m_noise, MODEL_NOISE_FLOOR, sizeof(m_noise));
+  memset(m_stateTime, 0, sizeof(m_stateTime));
+  m_state = A7105_STANDBY;
+  m_stateStart = hostTime();
+  reset();
+
+  air.attach(this);
+  hostWatchPin(csPin, this);
+  hostWatchPin(sclkPin, this);
+}
+
+/**
+ * @brief Returns all registers and state to power on defaults.
+ */
+void A7105Model::reset()
+{
+  memset(m_regs, 0, sizeof(m_regs));
+  m_id = 0;
+  m_fifoWr = 0;
+  m_fifoRd = 0;
+  m_rssi = MODEL_NOISE_FLOOR;
+  setState(A7105_STANDBY);
+  m_readyTime = 0;
+  m_calEnd = HOST_NEVER;
+  m_txEnd = HOST_NEVER;
+  setWtr(false);
+}
+
+/**
+ * @copydoc HostDevice::pinChanged
+ */
+void A7105Model::pinChanged(uint8_t pin, uint8_t level)
+{
+  if (pin == m_csPin)
+  {
+    m_selected = !level;
+    m_phase = SPI_COMMAND;
+    m_bitsIn = 0;
+    m_bitsOut = 0;
+
+    if (m_selected)
+      spiTransactions++;
+    else
+      hostReleasePin(m_sdioPin);
+  }
+  else if (pin == m_sclkPin && m_selected)
+  {
+    if (m_phase == SPI_READ)
+    {
+      if (level)
+      {
+        // MCU samples before the rising edge
+        m_bitsOut--;
+      }
+      else
+      {
+        // Data changes on the falling edge
+        if (m_bitsOut == 0)
+        {
+          m_shiftOut = readByte();
+          m_bitsOut = 8;
+          spiBytes++;
+        }
+        hostDrivePin(m_sdioPin, (m_shiftOut >> (m_bitsOut - 1)) & 1);
+      }
+    }
+    else if (level)
+    {
+      m_shiftIn = (m_shiftIn << 1) | hostPinLevel(m_sdioPin);
+      if (++m_bitsIn == 8)
+      {
+        m_bitsIn = 0;
+        spiBytes++;
+        byteIn(m_shiftIn);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Handles a byte written by the MCU.
+ */
+void A7105Model::byteIn(uint8_t b)
+{
+  if (m_phase == SPI_COMMAND)
+  {
+    if (b & 0x80)
+    {
+      // Strobes are a single byte, another command may follow
+      strobe(b & 0xF0);
+    }
+    else
+    {
+      m_addr = b & 0x3F;
+      m_idIndex = 0;
+      m_bitsOut = 0;
+      m_phase = (b & 0x40) ? SPI_READ : SPI_WRITE;
+    }
+  }
+  else
+  {
+    writeReg(m_addr, b);
+  }
+}
+
+/**
+ * @brief Gets the next byte to be read by the MCU.
+ */
+uint8_t A7105Model::readByte()
+{
+  switch (m_addr)
+  {
+  case A7105_00_MODE:
+    // TRER: TX or RX in progress
+    return (m_state == A7105_TX || m_state == A7105_RX) ? 0x01 : 0x00;
+  case A7105_05_FIFO_DATA:
+    return m_fifo[m_fifoRd++ & 0x3F];
+  case A7105_06_ID_DATA:
+    return (m_id >> (8 * (3 - (m_idIndex++ & 3)))) & 0xFF;
+  case A7105_1D_RSSI_THOLD:
+    return m_state == A7105_RX ? m_noise[m_regs[A7105_0F_CHANNEL]] : m_rssi;
+  default:
+    return m_addr < sizeof(m_regs) ? m_regs[m_addr] : 0;
+  }
+}
+
+/**
+ * @brief Handles a register write.
+ */
+void A7105Model::writeReg(uint8_t a, uint8_t d)
+{
+  switch (a)
+  {
+  case A7105_00_MODE:
+    reset();
+    break;
+  case A7105_02_CALC:
+    m_regs[a] = d;
+    if (d)
+      m_calEnd = hostTime() + MODEL_CAL_US;
+    break;
+  case A7105_05_FIFO_DATA:
+    m_fifo[m_fifoWr++ & 0x3F] = d;
+    break;
+  case A7105_06_ID_DATA:
+  {
+    uint8_t shift = 8 * (3 - (m_idIndex++ & 3));
+    m_id = (m_id & ~(0xFFUL << shift)) | ((uint32_t)d << shift);
+    break;
+  }
+  case A7105_0B_GPIO1_PIN1:
+    m_regs[a] = d;
+    setWtr(m_wtr);
+    break;
+  default:
+    if (a < sizeof(m_regs))
+      m_regs[a] = d;
+    break;
+  }
+}
+
+/**
+ * @brief Handles a strobe command.
+ */
+void A7105Model::strobe(uint8_t command)
+{
+  strobes++;
+
+  switch (command)
+  {
+  case A7105_RST_WRPTR:
+    m_fifoWr = 0;
+    break;
+  case A7105_RST_RDPTR:
+    m_fifoRd = 0;
+    break;
+  case A7105_TX:
+  case A7105_RX:
+    if (!ready())
+    {
+      earlyStrobes++;
+      break;
+    }
+
+    if (command == A7105_RX)
+    {
+      setState(A7105_RX);
+      m_rxStart = hostTime();
+      m_txEnd = HOST_NEVER;
+      setWtr(true);
+      break;
+    }
+
+    setState(A7105_TX);
+    m_txEnd = hostTime() + airTimeUs(m_regs[A7105_03_FIFOI] + 1,
+                                     m_regs[A7105_0E_DATA_RATE]);
+    setWtr(true);
+    break;
+  default:
+    // Waking up, the crystal settles before TX or RX
+    if ((m_state == A7105_SLEEP || m_state == A7105_IDLE) &&
+        command != A7105_SLEEP && command != A7105_IDLE)
+      m_readyTime = hostTime() + A7105_STANDBY_US;
+
+    setState(command);
+    m_txEnd = HOST_NEVER;
+    setWtr(false);
+    break;
+  }
+}
+
+/**
+ * @brief Changes the operating state, accounting the time in the last.
+ */
+void A7105Model::setState(uint8_t state)
+{
+  uint64_t now = hostTime();
+
+  m_stateTime[(m_state >> 4) & 7] += now - m_stateStart;
+  m_stateStart = now;
+  m_state = state;
+}
+
+/**
+ * @brief Checks the radio is awake and its crystal has settled.
+ */
+bool A7105Model::ready() const
+{
+  return m_state != A7105_SLEEP && m_state != A7105_IDLE &&
+         hostTime() >= m_readyTime;
+}
+
+/**
+ * @brief Gets the time spent in an operating state since construction.
+ * @param state One of A7105_SLEEP to A7105_TX
+ */
+uint64_t A7105Model::stateTime(uint8_t state) const
+{
+  uint64_t time = m_stateTime[(state >> 4) & 7];
+
+  if (state == m_state)
+    time += hostTime() - m_stateStart;
+
+  return time;
+}
+
+/**
+ * @brief Updates WTR and the GIO1 output.
+ */
+void A7105Model::setWtr(bool busy)
+{
+  m_wtr = busy;
+
+  if (m_gio1Pin == A7105_MODEL_NO_PIN)
+    return;
+
+  uint8_t gio1 = m_regs[A7105_0B_GPIO1_PIN1];
+  if ((gio1 & 0x3D) == A7105_GIO_WTR)
+    hostDrivePin(m_gio1Pin, busy ^ ((gio1 >> 1) & 1));
+  else
+    hostReleasePin(m_gio1Pin);
+}
+
+/**
+ * @copydoc HostDevice::nextEvent
+ */
+uint64_t A7105Model::nextEvent()
+{
+  return min(m_calEnd, m_txEnd);
+}
+
+/**
+ * @copydoc HostDevice::update
+ */
+void A7105Model::update(uint64_t now)
+{
+  if (now >= m_calEnd)
+  {
+    m_calEnd = HOST_NEVER;
+    m_regs[A7105_22_IF_CALIB_I] = 0;
+    m_regs[A7105_25_VCO_SBCAL_I] = 0;
+    if (m_calFailures)
+    {
+      m_calFailures--;
+      m_regs[A7105_22_IF_CALIB_I] = A7105_MASK_FBCF;
+      m_regs[A7105_25_VCO_SBCAL_I] = A7105_MASK_VBCF;
+    }
+    m_regs[A7105_02_CALC] = 0;
+  }
+
+  if (now >= m_txEnd)
+  {
+    AirPacket packet;
+    packet.id = m_id;
+    packet.channel = m_regs[A7105_0F_CHANNEL];
+    packet.len = m_regs[A7105_03_FIFOI] + 1;
+    memcpy(packet.data, m_fifo, sizeof(packet.data));
+    packet.end = m_txEnd;
+    packet.start =
+        m_txEnd - airTimeUs(packet.len, m_regs[A7105_0E_DATA_RATE]);
+    packet.power = m_regs[A7105_28_TX_TEST];
+    packet.rssi = MODEL_SIGNAL_RSSI;
+    packet.source = this;
+
+    m_txEnd = HOST_NEVER;
+    setState(A7105_STANDBY);
+    txPackets++;
+    setWtr(false);
+
+    if (!m_blocked)
+      m_air.transmit(packet);
+  }
+}
+
+/**
+ * @copydoc AirNode::airReceive
+ *
+ * The packet is received if the radio was listening on its channel and ID for
+ * all of it.
+ */
+void A7105Model::airReceive(const AirPacket &packet)
+{
+  if (m_blocked || m_state != A7105_RX || packet.start < m_rxStart ||
+      packet.channel != m_regs[A7105_0F_CHANNEL] || packet.id != m_id)
+    return;
+
+  memcpy(m_fifo, packet.data, sizeof(m_fifo));
+  m_rssi = min(packet.rssi + m_rxLoss, 0xFF);
+  setState(A7105_STANDBY);
+  rxPackets++;
+  setWtr(false);
+}
@@ -0,0 +1,160 @@
+/** @file */
+
+#ifndef _A7105_MODEL_AYA_H_
+#define _A7105_MODEL_AYA_H_
+
+#include "A7105.h"
+#include "HostAir.h"
+
+/**
+ * @def A7105_MODEL_NO_PIN
+ * @brief Pin number for an unconnected GIO1.
+ */
+#define A7105_MODEL_NO_PIN 0xFF
+
+/**
+ * @class A7105Model
+ * @brief Register level model of an A7105 on the virtual pins.
+ *
+ * Decodes 3-wire SPI from CS, SCLK and SDIO and models the control
+ * registers, ID, FIFO, strobes, IF/VCO calibration, TX/RX timing and the WTR
+ * output on GIO1. Packets are exchanged with other nodes through HostAir.
+ *
+ * Time is accounted to each operating state, for power estimates. Strobing
+ * TX or RX before A7105_STANDBY_US has passed since waking from A7105_SLEEP
+ * or A7105_IDLE is counted and ignored, the crystal has not settled.
+ */
+class A7105Model : public HostDevice, public AirNode
+{
+public:
+  A7105Model(HostAir &air, uint8_t csPin, uint8_t sclkPin, uint8_t sdioPin,
+             uint8_t gio1Pin = A7105_MODEL_NO_PIN);
+
+  void pinChanged(uint8_t pin, uint8_t level);
+  uint64_t nextEvent();
+  void update(uint64_t now);
+  void airReceive(const AirPacket &packet);
+
+  /**
+   * @brief Gets the value of a control register.
+   */
+  uint8_t reg(uint8_t a) const
+  {
+    return m_regs[a];
+  }
+
+  /**
+   * @brief Gets the ID currently set.
+   */
+  uint32_t id() const
+  {
+    return m_id;
+  }
+
+  /**
+   * @brief Gets the operating state (one of A7105_State).
+   */
+  uint8_t state() const
+  {
+    return m_state;
+  }
+
+  uint64_t stateTime(uint8_t state) const;
+
+  /**
+   * @brief Makes the next calibrations report failure.
+   * @param count Number of calibrations to fail
+   */
+  void setCalibrationFailures(uint8_t count)
+  {
+    m_calFailures = count;
+  }
+
+  /**
+   * @brief Sets the RSSI reading while listening to a channel.
+   * @param channel Channel number
+   * @param rssi Reading of A7105_1D_RSSI_THOLD, lower is stronger
+   */
+  void setNoise(uint8_t channel, uint8_t rssi)
+  {
+    m_noise[channel] = rssi;
+  }
+
+  /**
+   * @brief Blocks the antenna, nothing sent or received gets through.
+   *
+   * TX still takes its time and completes.
+   */
+  void setBlocked(bool blocked)
+  {
+    m_blocked = blocked;
+  }
+
+  /**
+   * @brief Weakens the packets received.
+   * @param rssi Added to the RSSI reading of each, lower is stronger
+   */
+  void setRxLoss(uint8_t rssi)
+  {
+    m_rxLoss = rssi;
+  }
+
+  uint32_t spiTransactions; //!< Number of CS low periods
+  uint32_t spiBytes;        //!< Number of bytes transferred
+  uint32_t strobes;         //!< Number of strobe commands
+  uint32_t txPackets;       //!< Number of packets transmitted
+  uint32_t rxPackets;       //!< Number of packets received
+  uint32_t earlyStrobes;    //!< TX or RX strobes before the radio was ready
+
+private:
+  void reset();
+  void byteIn(uint8_t b);
+  uint8_t readByte();
+  void writeReg(uint8_t a, uint8_t d);
+  void strobe(uint8_t command);
+  void setState(uint8_t state);
+  bool ready() const;
+  void setWtr(bool busy);
+
+  HostAir &m_air;
+  uint8_t m_csPin;
+  uint8_t m_sclkPin;
+  uint8_t m_sdioPin;
+  uint8_t m_gio1Pin;
+
+  uint8_t m_regs[0x33];
+  uint32_t m_id;
+  uint8_t m_fifo[64];
+  uint8_t m_fifoWr;
+  uint8_t m_fifoRd;
+  uint8_t m_noise[256];
+  uint8_t m_rssi;
+
+  uint8_t m_state;
+  uint64_t m_stateStart;
+  uint64_t m_stateTime[6];
+  uint64_t m_readyTime;
+  uint64_t m_txEnd;
+  uint64_t m_rxStart;
+  uint64_t m_calEnd;
+  uint8_t m_calFailures;
+  bool m_wtr;
+  bool m_blocked;
+  uint8_t m_rxLoss;
+
+  bool m_selected;
+  enum
+  {
+    SPI_COMMAND,
+    SPI_WRITE,
+    SPI_READ
+  } m_phase;
+  uint8_t m_addr;
+  uint8_t m_idIndex;
+  uint8_t m_shiftIn;
+  uint8_t m_bitsIn;
+  uint8_t m_shiftOut;
+  uint8_t m_bitsOut;
+};
+
+#endif
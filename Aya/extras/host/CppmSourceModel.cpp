@@ -0,0 +1,82 @@
+/** @file */
+
+#include "CppmSourceModel.h"
+
+/**
+ * @brief Creates an 8 channel source, all centred, starting immediately.
+ * @param pin Pin to drive
+ */
+CppmSourceModel::CppmSourceModel(uint8_t pin)
+    : channelCount(8)
+    , frameUs(22500)
+    , pulseUs(300)
+    , frames(0)
+    , m_pin(pin)
+    , m_frameStart(hostTime())
+    , m_next(hostTime())
+    , m_edge(0)
+{
+  for (uint8_t i = 0; i < CPPM_NUM_CHANNELS; i++)
+    channels[i] = 1500;
+  hostDrivePin(m_pin, HIGH);
+}
+
+/**
+ * @copydoc HostDevice::nextEvent
+ */
+uint64_t CppmSourceModel::nextEvent()
+{
+  return m_next;
+}
+
+/**
+ * @copydoc HostDevice::update
+ *
+ * Edges are numbered through the frame: even edges fall at the channel
+ * boundaries, odd edges rise pulseUs later.
+ */
+void CppmSourceModel::update(uint64_t now)
+{
+  if (now < m_next)
+    return;
+
+  if (m_edge == 0)
+  {
+    m_frameStart = m_next;
+    frames++;
+  }
+
+  bool falling = (m_edge % 2) == 0;
+  hostDrivePin(m_pin, falling ? LOW : HIGH);
+
+  if (falling)
+  {
+    m_next += pulseUs;
+    m_edge++;
+    return;
+  }
+
+  // Falling edge that just ended was at the boundary before channel m_edge / 2
+  uint8_t channel = m_edge / 2;
+  if (channel < channelCount)
+  {
+    m_next += channels[channel] - pulseUs;
+    m_edge++;
+  }
+  else
+  {
+    m_next = m_frameStart + frameUs;
+    m_edge = 0;
+  }
+}
+
+/**
+ * @brief Stops the signal, holding it idle.
+ * @param us Time until the next frame starts
+ */
+void CppmSourceModel::pause(uint32_t us)
+{
+  hostDrivePin(m_pin, HIGH);
+  m_next = hostTime() + us;
+  m_edge = 0;
+}
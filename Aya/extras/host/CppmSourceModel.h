@@ -0,0 +1,38 @@
+/** @file */
+
+#ifndef _CPPM_SOURCE_MODEL_AYA_H_
+#define _CPPM_SOURCE_MODEL_AYA_H_
+
+#include "CPPM.h"
+
+/**
+ * @class CppmSourceModel
+ * @brief Simulated receiver/transmitter trainer port driving a CPPM signal.
+ *
+ * Idles high and marks each channel boundary with a low pulse, the time
+ * between falling edges being the channel value.
+ */
+class CppmSourceModel : public HostDevice
+{
+public:
+  CppmSourceModel(uint8_t pin);
+
+  uint64_t nextEvent();
+  void update(uint64_t now);
+
+  void pause(uint32_t us);
+
+  uint16_t channels[CPPM_NUM_CHANNELS]; //!< Channel values in microseconds
+  uint8_t channelCount;                 //!< Channels sent per frame
+  uint16_t frameUs;                     //!< Time between frame starts
+  uint16_t pulseUs;                     //!< Length of the low pulses
+  uint32_t frames;                      //!< Frames started
+
+private:
+  uint8_t m_pin;
+  uint64_t m_frameStart;
+  uint64_t m_next;
+  uint8_t m_edge;
+};
+
+#endif
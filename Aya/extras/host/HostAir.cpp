@@ -0,0 +1,25 @@
+/** @file */
+
+#include "HostAir.h"
+
+/**
+ * @brief Adds a node to the medium.
+ */
+void HostAir::attach(AirNode *node)
+{
+  m_nodes.push_back(node);
+}
+
+/**
+ * @brief Delivers a packet to all nodes other than its source.
+ */
+void HostAir::transmit(const AirPacket &packet)
+{
+  packets++;
+
+  for (size_t i = 0; i < m_nodes.size(); i++)
+  {
+    if (m_nodes[i] != packet.source)
+      m_nodes[i]->airReceive(packet);
+  }
+}
@@ -0,0 +1,81 @@
+/** @file */
+
+#ifndef _HOST_AIR_AYA_H_
+#define _HOST_AIR_AYA_H_
+
+#include <vector>
+
+#include "HAL.h"
+
+class AirNode;
+
+/**
+ * @struct AirPacket
+ * @brief A packet sent over the simulated 2.4GHz band.
+ */
+struct AirPacket
+{
+  uint32_t id;           //!< A7105 ID the packet was sent with
+  uint8_t channel;       //!< A7105 channel number
+  uint8_t len;           //!< Payload length
+  uint8_t data[64];      //!< Payload
+  uint64_t start;        //!< Time the first bit was sent
+  uint64_t end;          //!< Time the last bit was sent
+  uint8_t power;         //!< A7105_28_TX_TEST of the sender
+  uint8_t rssi;          //!< A7105_1D_RSSI_THOLD reading, lower is stronger
+  const AirNode *source; //!< Node that sent the packet
+};
+
+/**
+ * @class AirNode
+ * @brief Something that can receive packets from HostAir.
+ */
+class AirNode
+{
+public:
+  virtual ~AirNode(){};
+
+  /**
+   * @brief Called for every packet sent by another node, when it ends.
+   * @param packet Packet on air
+   */
+  virtual void airReceive(const AirPacket &packet) = 0;
+};
+
+/**
+ * @class HostAir
+ * @brief A lossless medium connecting simulated radios.
+ *
+ * Delivers every packet to every other node, nodes decide if they are
+ * listening on the right channel and ID.
+ */
+class HostAir
+{
+public:
+  HostAir()
+      : packets(0)
+  {
+  }
+
+  void attach(AirNode *node);
+  void transmit(const AirPacket &packet);
+
+  uint32_t packets; //!< Number of packets sent
+
+private:
+  std::vector<AirNode *> m_nodes;
+};
+
+/**
+ * @brief Computes the time a packet is on air.
+ * @param len Payload length
+ * @param dataRateReg Value of A7105_0E_DATA_RATE
+ * @return Time in microseconds, including PLL settling
+ */
+inline uint32_t airTimeUs(uint8_t len, uint8_t dataRateReg)
+{
+  // 500Kbps / (DRCK + 1), preamble + ID + payload
+  return (4 + 4 + len) * 16 * (dataRateReg + 1) + 60;
+}
+
+#endif
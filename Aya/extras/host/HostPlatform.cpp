@@ -0,0 +1,676 @@
+/** @file */
+
+#include <vector>
+
+#include "HAL.h"
+
+HostSerial Serial;
+
+/**
+ * @struct HostPin
+ * @brief State of a virtual pin.
+ */
+struct HostPin
+{
+  uint8_t mode;   //!< Mode set by halPinMode()
+  uint8_t output; //!< Level set by halPinWrite()
+  bool driven;    //!< If a device drives the pin
+  uint8_t input;  //!< Level driven by a device
+  void (*isr)();  //!< Interrupt handler
+  int isrMode;    //!< Edge the handler is attached to
+  bool pending;   //!< Interrupt raised while interrupts were disabled
+  std::vector<HostDevice *> watchers;
+};
+
+/**
+ * @var now_us
+ * @brief Virtual time in microseconds.
+ */
+uint64_t now_us;
+
+HostPin pins[HOST_PINS];
+std::vector<HostDevice *> devices;
+
+/**
+ * @var interrupts_enabled
+ * @brief Global interrupt enable, cleared while an ISR runs.
+ */
+bool interrupts_enabled = true;
+
+/**
+ * @var micros_resolution
+ * @brief Step of halMicros() in microseconds (4 on a 16MHz AVR).
+ */
+uint8_t micros_resolution = 1;
+
+/**
+ * @var isr_latency_max
+ * @brief Upper bound of the simulated delay before an ISR starts.
+ */
+uint16_t isr_latency_max;
+
+/**
+ * @var isr_latency
+ * @brief Delay of the running ISR, seen by halMicros() but not by the clock.
+ */
+uint16_t isr_latency;
+
+/**
+ * @var last_micros
+ * @brief Latest time returned by halMicros(), code after a delayed ISR must
+ * not see time go backwards.
+ */
+uint64_t last_micros;
+
+/**
+ * @var latency_seed
+ * @brief State of the pseudo random ISR latency, fixed so runs repeat.
+ */
+uint32_t latency_seed;
+
+// Input capture unit, see halAttachCapture()
+void (*capture_isr)();
+int capture_mode;
+bool capture_pending;
+uint16_t capture_ticks;
+
+/**
+ * @var capture_period
+ * @brief Capture timer period at the last halCaptureClearWrapped().
+ */
+uint64_t capture_period;
+
+/**
+ * @def STORAGE_WRITE_US
+ * @brief Time an EEPROM byte write takes on an AVR.
+ */
+#define STORAGE_WRITE_US 3400
+
+// EEPROM, not cleared by hostReset()
+uint8_t storage[HAL_STORAGE_SIZE];
+uint32_t storage_writes;
+uint64_t storage_ready_time;
+bool storage_erased;
+
+/**
+ * @def SLEEP_TICK_US
+ * @brief Period of the millis() interrupt that ends an AVR idle sleep.
+ */
+#define SLEEP_TICK_US 1024
+
+// Idle sleep, see halSleep()
+volatile bool isr_ran;
+uint64_t sleep_us;
+uint32_t sleeps;
+
+// Timer compare alarm, see halSetAlarm()
+void (*alarm_isr)();
+uint64_t alarm_time = HOST_NEVER;
+bool alarm_pending;
+
+/**
+ * @def SPI_BYTE_US
+ * @brief Time a byte takes at F_CPU / 2, the clock both transports use.
+ */
+#define SPI_BYTE_US 1
+
+// SPI peripheral and USART0, see HostSpiData
+uint8_t host_spcr;
+uint8_t host_spsr;
+HostSpiData host_spdr(false);
+uint8_t host_ucsr0a = 1 << UDRE0;
+uint8_t host_ucsr0b;
+uint8_t host_ucsr0c;
+uint16_t host_ubrr0;
+HostSpiData host_udr0(true);
+
+/**
+ * @brief Gets the level of a pin as seen by both the MCU and devices.
+ */
+uint8_t pinLevel(const HostPin &p)
+{
+  if (p.mode == OUTPUT)
+    return p.output;
+  if (p.driven)
+    return p.input;
+  return p.mode == INPUT_PULLUP ? HIGH : LOW;
+}
+
+/**
+ * @brief Runs an interrupt handler with interrupts disabled.
+ */
+void runIsr(void (*isr)())
+{
+  if (isr_latency_max)
+  {
+    latency_seed = latency_seed * 1103515245 + 12345;
+    isr_latency = (latency_seed >> 16) % (isr_latency_max + 1);
+  }
+
+  interrupts_enabled = false;
+  isr();
+  interrupts_enabled = true;
+  isr_latency = 0;
+  isr_ran = true;
+}
+
+/**
+ * @brief Gets the time seen by the running code.
+ */
+uint64_t mcuTime()
+{
+  return now_us + isr_latency;
+}
+
+/**
+ * @brief Checks if a level change matches an interrupt mode.
+ */
+bool edgeMatches(int mode, uint8_t level)
+{
+  return mode == CHANGE || (mode == RISING && level) ||
+         (mode == FALLING && !level);
+}
+
+/**
+ * @brief Notifies watchers and raises interrupts after a pin has changed.
+ */
+void notifyPin(uint8_t pin, uint8_t oldLevel)
+{
+  HostPin &p = pins[pin];
+  uint8_t level = pinLevel(p);
+
+  if (level == oldLevel)
+    return;
+
+  for (size_t i = 0; i < p.watchers.size(); i++)
+    p.watchers[i]->pinChanged(pin, level);
+
+  if (p.isr && edgeMatches(p.isrMode, level))
+  {
+    if (interrupts_enabled)
+    {
+      p.pending = false;
+      runIsr(p.isr);
+    }
+    else
+      p.pending = true;
+  }
+
+  // The capture timer latches on the edge itself, before any ISR latency
+  if (pin == HAL_CAPTURE_PIN && capture_isr &&
+      edgeMatches(capture_mode, level))
+  {
+    capture_ticks = (uint16_t)(now_us * HAL_CAPTURE_HZ / 1000000);
+    if (interrupts_enabled)
+    {
+      capture_pending = false;
+      runIsr(capture_isr);
+    }
+    else
+      capture_pending = true;
+  }
+}
+
+/**
+ * @brief Resets the clock, pins and devices.
+ */
+void hostReset()
+{
+  now_us = 0;
+  interrupts_enabled = true;
+  micros_resolution = 1;
+  isr_latency_max = 0;
+  isr_latency = 0;
+  last_micros = 0;
+  latency_seed = 1;
+  capture_isr = NULL;
+  capture_pending = false;
+  capture_period = 0;
+  alarm_isr = NULL;
+  alarm_time = HOST_NEVER;
+  alarm_pending = false;
+  sleep_us = 0;
+  sleeps = 0;
+  storage_ready_time = 0;
+  if (!storage_erased)
+    hostEraseStorage();
+  devices.clear();
+  for (uint8_t i = 0; i < HOST_PINS; i++)
+    pins[i] = HostPin();
+  host_spcr = 0;
+  host_spsr = 0;
+  host_ucsr0a = 1 << UDRE0;
+  host_ucsr0b = 0;
+  host_ucsr0c = 0;
+  host_ubrr0 = 0;
+}
+
+/**
+ * @brief Gets the virtual time.
+ * @return Time in microseconds
+ */
+uint64_t hostTime()
+{
+  return now_us;
+}
+
+/**
+ * @brief Advances the virtual time, processing device events on the way.
+ * @param us Time to advance by in microseconds
+ */
+void hostAdvance(uint32_t us)
+{
+  hostRunUntil(now_us + us);
+}
+
+/**
+ * @brief Advances the virtual time to a deadline or until a flag is set.
+ * @param time Deadline in microseconds
+ * @param wake Flag to stop at (e.g. set by an ISR), may be NULL
+ * @return True if stopped by wake
+ */
+bool hostRunUntil(uint64_t time, volatile bool *wake)
+{
+  for (;;)
+  {
+    if (wake && *wake)
+      return true;
+
+    uint64_t next = min(time, alarm_time);
+    for (size_t i = 0; i < devices.size(); i++)
+      next = min(next, devices[i]->nextEvent());
+
+    if (next > now_us)
+      now_us = next;
+
+    bool due = false;
+    if (alarm_time <= now_us)
+    {
+      alarm_time = HOST_NEVER;
+      alarm_pending = true;
+      due = true;
+    }
+    if (alarm_pending && alarm_isr && interrupts_enabled)
+    {
+      alarm_pending = false;
+      runIsr(alarm_isr);
+    }
+
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+      if (devices[i]->nextEvent() <= now_us)
+      {
+        devices[i]->update(now_us);
+        due = true;
+      }
+    }
+
+    if (!due && now_us >= time)
+      return wake && *wake;
+  }
+}
+
+/**
+ * @brief Sets the step of halMicros().
+ * @param us Resolution in microseconds
+ */
+void hostSetMicrosResolution(uint8_t us)
+{
+  micros_resolution = us ? us : 1;
+}
+
+/**
+ * @brief Delays every ISR by a pseudo random time, as other interrupts would.
+ * @param maxUs Maximum latency in microseconds, 0 for none
+ */
+void hostSetInterruptLatency(uint16_t maxUs)
+{
+  isr_latency_max = maxUs;
+}
+
+/**
+ * @brief Gets the time spent in halSleep() since hostReset().
+ * @param count Number of sleeps, may be NULL
+ */
+uint64_t hostSleepTime(uint32_t *count)
+{
+  if (count)
+    *count = sleeps;
+  return sleep_us;
+}
+
+/**
+ * @brief Gets the storage contents, e.g. to corrupt them.
+ */
+uint8_t *hostStorage()
+{
+  return storage;
+}
+
+/**
+ * @brief Sets every byte of storage to 0xFF, as an erased EEPROM.
+ */
+void hostEraseStorage()
+{
+  memset(storage, 0xFF, sizeof(storage));
+  storage_writes = 0;
+  storage_erased = true;
+}
+
+/**
+ * @brief Gets the number of bytes written to storage since it was erased.
+ */
+uint32_t hostStorageWrites()
+{
+  return storage_writes;
+}
+
+/**
+ * @brief Adds a device to the virtual clock.
+ */
+void hostAddDevice(HostDevice *device)
+{
+  devices.push_back(device);
+}
+
+/**
+ * @brief Notifies a device of changes to a pin.
+ */
+void hostWatchPin(uint8_t pin, HostDevice *device)
+{
+  pins[pin].watchers.push_back(device);
+}
+
+/**
+ * @brief Drives a pin from a device.
+ *
+ * The MCU sees the level while the pin is an input.
+ */
+void hostDrivePin(uint8_t pin, uint8_t level)
+{
+  HostPin &p = pins[pin];
+  uint8_t oldLevel = pinLevel(p);
+  p.driven = true;
+  p.input = level;
+  notifyPin(pin, oldLevel);
+}
+
+/**
+ * @brief Stops a device driving a pin.
+ */
+void hostReleasePin(uint8_t pin)
+{
+  HostPin &p = pins[pin];
+  uint8_t oldLevel = pinLevel(p);
+  p.driven = false;
+  notifyPin(pin, oldLevel);
+}
+
+/**
+ * @brief Gets the level of a pin.
+ */
+uint8_t hostPinLevel(uint8_t pin)
+{
+  return pinLevel(pins[pin]);
+}
+
+uint32_t halMicros()
+{
+  uint64_t t = mcuTime();
+  last_micros = max(last_micros, t - t % micros_resolution);
+  return (uint32_t)last_micros;
+}
+
+uint32_t halMillis()
+{
+  return (uint32_t)(now_us / 1000);
+}
+
+void halDelay(uint32_t ms)
+{
+  hostAdvance(ms * 1000);
+}
+
+void halDelayMicroseconds(uint16_t us)
+{
+  hostAdvance(us);
+}
+
+void halPinMode(uint8_t pin, uint8_t mode)
+{
+  HostPin &p = pins[pin];
+  uint8_t oldLevel = pinLevel(p);
+  p.mode = mode;
+  notifyPin(pin, oldLevel);
+}
+
+void halPinWrite(uint8_t pin, uint8_t level)
+{
+  HostPin &p = pins[pin];
+  uint8_t oldLevel = pinLevel(p);
+  p.output = level ? HIGH : LOW;
+  notifyPin(pin, oldLevel);
+}
+
+uint8_t halPinRead(uint8_t pin)
+{
+  return pinLevel(pins[pin]);
+}
+
+void halAttachInterrupt(uint8_t pin, void (*isr)(), int mode)
+{
+  pins[pin].isr = isr;
+  pins[pin].isrMode = mode;
+  pins[pin].pending = false;
+}
+
+void halDetachInterrupt(uint8_t pin)
+{
+  pins[pin].isr = NULL;
+}
+
+void halAttachCapture(void (*isr)(), int mode)
+{
+  capture_isr = isr;
+  capture_mode = mode;
+  capture_pending = false;
+  halCaptureClearWrapped();
+}
+
+void halDetachCapture()
+{
+  capture_isr = NULL;
+}
+
+uint16_t halCaptureTicks()
+{
+  return capture_ticks;
+}
+
+bool halCaptureWrapped()
+{
+  return (mcuTime() * HAL_CAPTURE_HZ / 1000000 >> 16) != capture_period;
+}
+
+void halCaptureClearWrapped()
+{
+  capture_period = mcuTime() * HAL_CAPTURE_HZ / 1000000 >> 16;
+}
+
+void halAttachAlarm(void (*isr)())
+{
+  alarm_isr = isr;
+  alarm_time = HOST_NEVER;
+  alarm_pending = false;
+}
+
+void halDetachAlarm()
+{
+  alarm_time = HOST_NEVER;
+  alarm_pending = false;
+}
+
+void halSetAlarm(uint16_t us)
+{
+  alarm_time = mcuTime() + us;
+  alarm_pending = false;
+}
+
+void halStorageRead(uint16_t address, void *data, uint16_t len)
+{
+  memcpy(data, storage + address, len);
+}
+
+void halStorageWrite(uint16_t address, const void *data, uint16_t len)
+{
+  // Each byte waits for the previous write, as eeprom_write_block()
+  for (uint16_t i = 0; i < len; i++)
+  {
+    if (storage_ready_time > now_us)
+      hostRunUntil(storage_ready_time);
+    storage[address + i] = ((const uint8_t *)data)[i];
+    storage_ready_time = now_us + STORAGE_WRITE_US;
+    storage_writes++;
+  }
+}
+
+bool halStorageReady()
+{
+  return now_us >= storage_ready_time;
+}
+
+void halSleep()
+{
+  uint64_t start = now_us;
+  uint64_t tick = (now_us / SLEEP_TICK_US + 1) * SLEEP_TICK_US;
+
+  // Interrupts pending since the caller disabled them wake it at once
+  isr_ran = false;
+  halInterrupts();
+  if (!isr_ran)
+    hostRunUntil(tick, &isr_ran);
+
+  sleep_us += now_us - start;
+  sleeps++;
+}
+
+void halNoInterrupts()
+{
+  interrupts_enabled = false;
+}
+
+void halInterrupts()
+{
+  interrupts_enabled = true;
+
+  for (uint8_t i = 0; i < HOST_PINS && interrupts_enabled; i++)
+  {
+    if (pins[i].pending && pins[i].isr)
+    {
+      pins[i].pending = false;
+      runIsr(pins[i].isr);
+    }
+  }
+
+  if (capture_pending && capture_isr && interrupts_enabled)
+  {
+    capture_pending = false;
+    runIsr(capture_isr);
+  }
+
+  if (alarm_pending && alarm_isr && interrupts_enabled)
+  {
+    alarm_pending = false;
+    runIsr(alarm_isr);
+  }
+}
+
+uint8_t halSaveInterrupts()
+{
+  uint8_t state = interrupts_enabled;
+  interrupts_enabled = false;
+  return state;
+}
+
+void halRestoreInterrupts(uint8_t state)
+{
+  // Runs any interrupt raised meanwhile, as SREG would
+  if (state)
+    halInterrupts();
+}
+
+/**
+ * @brief Transfers a byte in mode 0, MSB first, on the virtual pins.
+ *
+ * Aborts if the peripheral has not been enabled in master mode, where an AVR
+ * would never finish the transfer.
+ *
+ * @param c Byte sent
+ */
+HostSpiData &HostSpiData::operator=(uint8_t c)
+{
+  uint8_t sclk = m_usart ? HOST_XCK0_PIN : SCK;
+  uint8_t sdio = m_usart ? HOST_RXD0_PIN : MISO;
+  bool enabled =
+      m_usart ? (host_ucsr0b & (1 << TXEN0)) && (host_ucsr0b & (1 << RXEN0)) &&
+                    (host_ucsr0c & (1 << UMSEL01)) &&
+                    (host_ucsr0c & (1 << UMSEL00))
+              : (host_spcr & (1 << SPE)) && (host_spcr & (1 << MSTR));
+
+  if (!enabled)
+  {
+    fprintf(stderr, "%s written with the peripheral disabled\n",
+            m_usart ? "UDR0" : "SPDR");
+    abort();
+  }
+
+  if (m_usart)
+    host_ucsr0a &= ~(1 << RXC0);
+  else
+    host_spsr &= ~(1 << SPIF);
+
+  m_received = 0;
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    uint8_t bit = (c >> (7 - i)) & 1;
+
+    // Data out before the rising edge, where both sides sample
+    if (m_usart)
+      halPinMode(sdio, bit ? INPUT_PULLUP : INPUT);
+    else if (pins[MOSI].mode == OUTPUT)
+    {
+      halPinWrite(sdio, bit);
+      halPinMode(sdio, OUTPUT);
+    }
+    else
+      halPinMode(sdio, INPUT);
+
+    m_received = (m_received << 1) | halPinRead(sdio);
+    halPinWrite(sclk, HIGH);
+    halPinWrite(sclk, LOW);
+  }
+
+  // TXD0 idles high
+  if (m_usart)
+    halPinMode(sdio, INPUT_PULLUP);
+
+  hostAdvance(SPI_BYTE_US);
+
+  if (m_usart)
+    host_ucsr0a |= 1 << RXC0;
+  else
+    host_spsr |= 1 << SPIF;
+  return *this;
+}
+
+/**
+ * @brief Reads the byte received and clears the flag set with it.
+ */
+HostSpiData::operator uint8_t()
+{
+  if (m_usart)
+    host_ucsr0a &= ~(1 << RXC0);
+  else
+    host_spsr &= ~(1 << SPIF);
+  return m_received;
+}
@@ -0,0 +1,316 @@
+/** @file */
+
+#ifndef _HOST_PLATFORM_AYA_H_
+#define _HOST_PLATFORM_AYA_H_
+
+/*
+ * Host (Linux) platform for the library: a virtual clock, a set of virtual
+ * pins that simulated devices can watch and drive, and the subset of the
+ * Arduino API used by the library.
+ *
+ * Time only moves when the library waits (halDelay(), halDelayMicroseconds())
+ * or when the host advances it (hostAdvance(), hostRunUntil()), so a run is
+ * deterministic and limited only by CPU speed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#define constrain(amt, low, high)                                              \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+template <typename T, typename U> inline T min(T a, U b)
+{
+  return (a < (T)b) ? a : (T)b;
+}
+
+template <typename T, typename U> inline T max(T a, U b)
+{
+  return (a > (T)b) ? a : (T)b;
+}
+
+inline long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+/**
+ * @class HostSerial
+ * @brief Stand in for the Arduino Serial object.
+ *
+ * Output is discarded unless a stream is set with setOutput().
+ */
+class HostSerial
+{
+public:
+  HostSerial()
+      : m_out(NULL)
+  {
+  }
+
+  void setOutput(FILE *out)
+  {
+    m_out = out;
+  }
+
+  void begin(unsigned long)
+  {
+  }
+
+  void flush()
+  {
+    if (m_out)
+      fflush(m_out);
+  }
+
+  size_t write(uint8_t c)
+  {
+    if (m_out)
+      fputc(c, m_out);
+    return 1;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size)
+  {
+    if (m_out)
+      fwrite(buffer, 1, size, m_out);
+    return size;
+  }
+
+  int availableForWrite()
+  {
+    return 64;
+  }
+
+  void print(const char *s)
+  {
+    if (m_out)
+      fputs(s, m_out);
+  }
+
+  void print(char c)
+  {
+    write((uint8_t)c);
+  }
+
+  void print(long n, int base = DEC)
+  {
+    if (m_out)
+      fprintf(m_out, base == HEX ? "%lx" : "%ld", n);
+  }
+
+  void print(unsigned long n, int base = DEC)
+  {
+    if (m_out)
+      fprintf(m_out, base == HEX ? "%lx" : "%lu", n);
+  }
+
+  void print(int n, int base = DEC)
+  {
+    print((long)n, base);
+  }
+
+  void print(unsigned int n, int base = DEC)
+  {
+    print((unsigned long)n, base);
+  }
+
+  void print(double n, int digits = 2)
+  {
+    if (m_out)
+      fprintf(m_out, "%.*f", digits, n);
+  }
+
+  void println()
+  {
+    print('\n');
+  }
+
+  template <typename T> void println(T v)
+  {
+    print(v);
+    println();
+  }
+
+  template <typename T> void println(T v, int format)
+  {
+    print(v, format);
+    println();
+  }
+
+private:
+  FILE *m_out;
+};
+
+extern HostSerial Serial;
+
+/*
+ * The SPI peripheral and USART0 in master SPI mode of an ATmega328P, for the
+ * A7105_SPI_HARDWARE and A7105_SPI_USART transports. Writing a data register
+ * clocks the byte out in mode 0 on the virtual pins at once, so devices see
+ * the same edges as from the bit-banged transport.
+ *
+ * Pins are numbered as on an Uno. MISO and RXD0 each stand for the SDIO net of
+ * a 3-wire radio: MOSI drives MISO while it is an output, over any device,
+ * and devices only win once it is released. TXD0 drives RXD0 through its
+ * series resistor, weaker than any device, and has no pin of its own.
+ */
+#define SS 10
+#define MOSI 11
+#define MISO 12
+#define SCK 13
+
+/**
+ * @def HOST_RXD0_PIN
+ * @brief RXD0, the SDIO net driven by TXD0 through a resistor.
+ */
+#define HOST_RXD0_PIN 0
+
+/**
+ * @def HOST_XCK0_PIN
+ * @brief XCK0, the clock of USART0 in master SPI mode.
+ */
+#define HOST_XCK0_PIN 4
+
+#define SPE 6
+#define MSTR 4
+#define SPIF 7
+#define SPI2X 0
+
+#define RXC0 7
+#define UDRE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UMSEL01 7
+#define UMSEL00 6
+
+/**
+ * @class HostSpiData
+ * @brief Data register of the SPI peripheral or of USART0 in master SPI mode.
+ *
+ * Assigning a byte transfers it, reading gets the byte received with it.
+ */
+class HostSpiData
+{
+public:
+  explicit HostSpiData(bool usart)
+      : m_usart(usart)
+      , m_received(0)
+  {
+  }
+
+  HostSpiData &operator=(uint8_t c);
+  operator uint8_t();
+
+private:
+  bool m_usart;       //!< USART0 rather than the SPI peripheral
+  uint8_t m_received; //!< Byte received by the last transfer
+};
+
+extern uint8_t host_spcr;
+extern uint8_t host_spsr;
+extern HostSpiData host_spdr;
+extern uint8_t host_ucsr0a;
+extern uint8_t host_ucsr0b;
+extern uint8_t host_ucsr0c;
+extern uint16_t host_ubrr0;
+extern HostSpiData host_udr0;
+
+// Macros as on an AVR, so that the library can test for them
+#define SPCR host_spcr
+#define SPSR host_spsr
+#define SPDR host_spdr
+#define UCSR0A host_ucsr0a
+#define UCSR0B host_ucsr0b
+#define UCSR0C host_ucsr0c
+#define UBRR0 host_ubrr0
+#define UDR0 host_udr0
+
+/**
+ * @def HOST_NEVER
+ * @brief Event time of a device with nothing scheduled.
+ */
+#define HOST_NEVER UINT64_MAX
+
+/**
+ * @def HOST_PINS
+ * @brief Number of virtual pins.
+ */
+#define HOST_PINS 64
+
+/**
+ * @class HostDevice
+ * @brief A simulated device attached to the virtual pins and clock.
+ */
+class HostDevice
+{
+public:
+  virtual ~HostDevice(){};
+
+  /**
+   * @brief Called when the level of a watched pin changes.
+   * @param pin Pin number
+   * @param level New level
+   */
+  virtual void pinChanged(uint8_t pin, uint8_t level)
+  {
+  }
+
+  /**
+   * @brief Gets the time of the next event of this device.
+   * @return Time in microseconds, HOST_NEVER if nothing is scheduled
+   */
+  virtual uint64_t nextEvent()
+  {
+    return HOST_NEVER;
+  }
+
+  /**
+   * @brief Processes events that are due.
+   * @param now Current time in microseconds
+   */
+  virtual void update(uint64_t now)
+  {
+  }
+};
+
+void hostReset();
+uint64_t hostTime();
+void hostAdvance(uint32_t us);
+bool hostRunUntil(uint64_t time, volatile bool *wake = NULL);
+void hostSetMicrosResolution(uint8_t us);
+void hostSetInterruptLatency(uint16_t maxUs);
+
+uint64_t hostSleepTime(uint32_t *count = NULL);
+
+uint8_t *hostStorage();
+void hostEraseStorage();
+uint32_t hostStorageWrites();
+
+void hostAddDevice(HostDevice *device);
+void hostWatchPin(uint8_t pin, HostDevice *device);
+void hostDrivePin(uint8_t pin, uint8_t level);
+void hostReleasePin(uint8_t pin);
+uint8_t hostPinLevel(uint8_t pin);
+
+#endif
@@ -0,0 +1,48 @@
+/** @file */
+
+#include "HubsanFixture.h"
+
+HostSession::HostSession()
+{
+  hostReset();
+}
+
+HubsanFixture::HubsanFixture()
+    : radio(air, CS_PIN, SIM_SCLK_PIN, SIM_SDIO_PIN, SIM_GIO1_PIN)
+    , quad(air)
+    , next(hostTime())
+{
+  hostAddDevice(&radio);
+  hostAddDevice(&quad);
+}
+
+/**
+ * @brief Runs the devices until tx() is due or the radio ends TX/RX.
+ */
+void HubsanFixture::wait()
+{
+  hostRunUntil(next, &a7105_wtr_event);
+}
+
+/**
+ * @brief Calls tx() and schedules the next call from the delay it returns.
+ * @param hubsan Protocol flown
+ * @return Delay returned by tx()
+ */
+uint16_t HubsanFixture::tx(StaticHubsan &hubsan)
+{
+  uint16_t delayUs = hubsan.tx();
+  next = hostTime() + delayUs;
+  return delayUs;
+}
+
+/**
+ * @brief Waits for the next tx() and calls it, as loop() does.
+ * @param hubsan Protocol flown
+ * @return Delay returned by tx()
+ */
+uint16_t HubsanFixture::step(StaticHubsan &hubsan)
+{
+  wait();
+  return tx(hubsan);
+}
@@ -0,0 +1,77 @@
+/** @file */
+
+#ifndef _HUBSAN_FIXTURE_AYA_H_
+#define _HUBSAN_FIXTURE_AYA_H_
+
+#include "A7105Model.h"
+#include "Hubsan.h"
+#include "HubsanQuadModel.h"
+
+/**
+ * @def SIM_GIO1_PIN
+ * @brief GIO1 of the simulated radio, connected when built with GIO1_PIN.
+ */
+#if defined(GIO1_PIN)
+#define SIM_GIO1_PIN GIO1_PIN
+#else
+#define SIM_GIO1_PIN A7105_MODEL_NO_PIN
+#endif
+
+/**
+ * @def SIM_SCLK_PIN
+ * @brief SCK of the simulated radios, clocked by the transport built.
+ */
+/**
+ * @def SIM_SDIO_PIN
+ * @brief SDIO of the simulated radios, on the net the transport built reads.
+ */
+#if A7105_SPI_MODE == A7105_SPI_HARDWARE
+#define SIM_SCLK_PIN SCK
+#define SIM_SDIO_PIN MISO
+#elif A7105_SPI_MODE == A7105_SPI_USART
+#define SIM_SCLK_PIN HOST_XCK0_PIN
+#define SIM_SDIO_PIN HOST_RXD0_PIN
+#else
+#define SIM_SCLK_PIN SCLK_PIN
+#define SIM_SDIO_PIN SDIO_PIN
+#endif
+
+/**
+ * @def TX_ID
+ * @brief Transmitter ID used where a test needs a fixed one.
+ */
+#define TX_ID 0x35000001
+
+/**
+ * @class HostSession
+ * @brief Resets the virtual platform when constructed.
+ */
+class HostSession
+{
+public:
+  HostSession();
+};
+
+/**
+ * @class HubsanFixture
+ * @brief A fresh virtual platform with a radio and a Hubsan model on air.
+ *
+ * The platform is reset before the devices are built, so a fixture starts at
+ * time 0 and only one may exist at a time.
+ */
+class HubsanFixture : private HostSession
+{
+public:
+  HubsanFixture();
+
+  void wait();
+  uint16_t tx(StaticHubsan &hubsan);
+  uint16_t step(StaticHubsan &hubsan);
+
+  HostAir air;          //!< Medium the devices are attached to
+  A7105Model radio;     //!< Radio of the transmitter
+  HubsanQuadModel quad; //!< Model flown
+  uint64_t next;        //!< Time tx() is due
+};
+
+#endif
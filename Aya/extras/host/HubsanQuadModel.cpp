@@ -0,0 +1,244 @@
+/** @file */
+
+#include "HubsanQuadModel.h"
+#include "A7105.h"
+
+/**
+ * @def BIND_ID
+ * @brief A7105 ID used for the start of the bind handshake.
+ */
+#define BIND_ID 0x55201041
+
+/**
+ * @def DATA_RATE
+ * @brief A7105_0E_DATA_RATE used by the Hubsan protocol.
+ */
+#define DATA_RATE 0x04
+
+/**
+ * @var txTestByPower
+ * @brief A7105_28_TX_TEST for each A7105_TxPower, as a7105SetPower() sets it.
+ */
+const uint8_t txTestByPower[] = {0x00, 0x01, 0x02, 0x04,
+                                 0x0d, 0x17, 0x1f, 0x1f};
+
+/**
+ * @brief Computes the Hubsan checksum of a 16 byte packet.
+ */
+uint8_t hubsanChecksum(const uint8_t *data)
+{
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < 15; i++)
+    sum += data[i];
+  return 256 - sum;
+}
+
+/**
+ * @brief Creates a new, unbound model.
+ * @param air Medium to receive and reply on
+ */
+HubsanQuadModel::HubsanQuadModel(HostAir &air)
+    : dataPackets(0)
+    , badPackets(0)
+    , telemetryPackets(0)
+    , telemetryInterval(10)
+    , minPower(TXPOWER_100uW)
+    , dropPercent(0)
+    , corruptPercent(0)
+    , replyRssi(0x40)
+    , lostPackets(0)
+    , turnaroundUs(1500)
+    , vbat(42)
+    , rateOfClimb(0)
+    , m_air(air)
+    , m_state(UNBOUND)
+    , m_id(BIND_ID)
+    , m_channel(0)
+    , m_nextTagE1(false)
+    , m_random(1)
+{
+  memset(gyro, 0, sizeof(gyro));
+  memset(acc, 0, sizeof(acc));
+  memset(m_lastPacket, 0, sizeof(m_lastPacket));
+  m_reply.end = HOST_NEVER;
+  air.attach(this);
+}
+
+/**
+ * @brief Turns the model off and on again, forgetting the bind session.
+ */
+void HubsanQuadModel::powerCycle()
+{
+  m_state = UNBOUND;
+  m_id = BIND_ID;
+  m_channel = 0;
+  m_reply.end = HOST_NEVER;
+}
+
+/**
+ * @brief Turns the model off, it ignores the air until powerCycle().
+ */
+void HubsanQuadModel::powerOff()
+{
+  powerCycle();
+  m_state = OFF;
+}
+
+/**
+ * @copydoc HostDevice::nextEvent
+ */
+uint64_t HubsanQuadModel::nextEvent()
+{
+  return m_reply.end;
+}
+
+/**
+ * @copydoc HostDevice::update
+ */
+void HubsanQuadModel::update(uint64_t now)
+{
+  if (now < m_reply.end)
+    return;
+
+  AirPacket packet = m_reply;
+  m_reply.end = HOST_NEVER;
+  m_air.transmit(packet);
+}
+
+/**
+ * @brief Schedules a reply on the channel and ID of a received packet.
+ */
+void HubsanQuadModel::reply(const AirPacket &packet, const uint8_t *data)
+{
+  m_reply.id = m_id;
+  m_reply.channel = packet.channel;
+  m_reply.len = 16;
+  memcpy(m_reply.data, data, 16);
+  m_reply.data[15] = hubsanChecksum(m_reply.data);
+  m_reply.start = packet.end + turnaroundUs;
+  m_reply.end = m_reply.start + airTimeUs(16, DATA_RATE);
+  m_reply.power = txTestByPower[TXPOWER_150mW];
+  m_reply.rssi = replyRssi;
+  m_reply.source = this;
+}
+
+/**
+ * @copydoc AirNode::airReceive
+ */
+void HubsanQuadModel::airReceive(const AirPacket &packet)
+{
+  const uint8_t *data = packet.data;
+  uint8_t response[16];
+
+  if (packet.id != m_id || packet.len != 16)
+    return;
+
+  if (hubsanChecksum(data) != data[15])
+  {
+    if (m_state == BOUND)
+      badPackets++;
+    return;
+  }
+
+  memcpy(response, data, 16);
+
+  switch (m_state)
+  {
+  case OFF:
+    break;
+  case UNBOUND:
+    // Bind packets 1 and 3 use the bind ID on any channel
+    if (data[0] != 1 && data[0] != 3)
+      return;
+    m_channel = data[1];
+    response[0] = data[0] + 1;
+    reply(packet, response);
+    if (data[0] == 3)
+    {
+      // The transmitter switches to the session ID after this reply
+      m_id = ((uint32_t)data[2] << 24) | ((uint32_t)data[3] << 16) |
+             ((uint32_t)data[4] << 8) | data[5];
+      m_state = BINDING;
+    }
+    break;
+  case BINDING:
+    if (data[0] == 1)
+    {
+      response[0] = 2;
+      reply(packet, response);
+    }
+    else if (data[0] == 9)
+    {
+      response[0] = 0x0a;
+      response[1] = 9;
+      reply(packet, response);
+      m_state = BOUND;
+    }
+    break;
+  case BOUND:
+    if (packet.channel != m_channel && packet.channel != m_channel + 0x23)
+      return;
+    if (data[0] != 0x20 && data[0] != 0x40)
+      return;
+    if (packet.power < txTestByPower[minPower] || chance(dropPercent))
+    {
+      lostPackets++;
+      return;
+    }
+    memcpy(m_lastPacket, data, 16);
+    dataPackets++;
+    if (telemetryInterval && dataPackets % telemetryInterval == 0)
+    {
+      buildTelemetry(response);
+      reply(packet, response);
+      if (chance(corruptPercent))
+        m_reply.data[15] ^= 0xff;
+      telemetryPackets++;
+    }
+    break;
+  }
+}
+
+/**
+ * @brief Decides at random if something happens, the same on every run.
+ * @param percent Chance in percent
+ */
+bool HubsanQuadModel::chance(uint8_t percent)
+{
+  m_random = m_random * 1103515245 + 12345;
+  return percent && (m_random >> 16) % 100 < percent;
+}
+
+/**
+ * @brief Builds the next telemetry packet, alternating tags 0xe0 and 0xe1.
+ */
+void HubsanQuadModel::buildTelemetry(uint8_t *data)
+{
+  memset(data, 0, 16);
+
+  if (m_nextTagE1)
+  {
+    data[0] = 0xe1;
+    data[1] = acc[0] >> 8;
+    data[2] = acc[0] & 0xff;
+    data[3] = acc[1] >> 8;
+    data[4] = acc[1] & 0xff;
+    data[7] = gyro[0] >> 8;
+    data[8] = gyro[0] & 0xff;
+    data[9] = gyro[1] >> 8;
+    data[10] = gyro[1] & 0xff;
+  }
+  else
+  {
+    data[0] = 0xe0;
+    data[1] = rateOfClimb >> 8;
+    data[2] = rateOfClimb & 0xff;
+    data[9] = acc[2] >> 8;
+    data[10] = acc[2] & 0xff;
+    data[11] = gyro[2] >> 8;
+    data[12] = gyro[2] & 0xff;
+  }
+  data[13] = vbat;
+
+  m_nextTagE1 = !m_nextTagE1;
+}
@@ -0,0 +1,87 @@
+/** @file */
+
+#ifndef _HUBSAN_QUAD_MODEL_AYA_H_
+#define _HUBSAN_QUAD_MODEL_AYA_H_
+
+#include "HostAir.h"
+
+/**
+ * @class HubsanQuadModel
+ * @brief Simulated Hubsan model that binds to and is flown by the protocol.
+ *
+ * Answers the bind handshake, checks data packets and sends telemetry after
+ * every telemetryInterval data packets.
+ */
+class HubsanQuadModel : public HostDevice, public AirNode
+{
+public:
+  HubsanQuadModel(HostAir &air);
+
+  uint64_t nextEvent();
+  void update(uint64_t now);
+  void airReceive(const AirPacket &packet);
+  void powerCycle();
+  void powerOff();
+
+  /**
+   * @brief Checks if the bind handshake has completed.
+   */
+  bool bound() const
+  {
+    return m_state == BOUND;
+  }
+
+  /**
+   * @brief Gets the A7105 ID the model listens on, the session's once bound.
+   */
+  uint32_t id() const
+  {
+    return m_id;
+  }
+
+  /**
+   * @brief Gets the last valid data packet.
+   */
+  const uint8_t *lastPacket() const
+  {
+    return m_lastPacket;
+  }
+
+  uint32_t dataPackets;      //!< Valid data packets received
+  uint32_t badPackets;       //!< Data packets with a bad checksum
+  uint32_t telemetryPackets; //!< Telemetry packets sent
+
+  uint8_t telemetryInterval; //!< Data packets per telemetry packet, 0 for none
+  uint8_t minPower;          //!< Weakest A7105_TxPower heard once bound
+  uint8_t dropPercent;       //!< Data packets lost at random once bound
+  uint8_t corruptPercent;    //!< Telemetry packets sent with a bad checksum
+  uint8_t replyRssi;         //!< RSSI the transmitter reads for replies
+  uint32_t lostPackets;      //!< Data packets lost to minPower or dropPercent
+  uint16_t turnaroundUs;     //!< Time between end of RX and start of a reply
+  uint8_t vbat;              //!< Battery voltage in 0.1V
+  int16_t gyro[3];           //!< Pitch, roll and yaw gyro
+  int16_t acc[3];            //!< Pitch, roll and Z accelerometer
+  int16_t rateOfClimb;       //!< Rate of climb
+
+private:
+  void reply(const AirPacket &packet, const uint8_t *data);
+  void buildTelemetry(uint8_t *data);
+  bool chance(uint8_t percent);
+
+  HostAir &m_air;
+  enum
+  {
+    OFF,
+    UNBOUND,
+    BINDING,
+    BOUND
+  } m_state;
+  uint32_t m_id;
+  uint8_t m_channel;
+  uint8_t m_lastPacket[16];
+  bool m_nextTagE1;
+  uint32_t m_random;
+  AirPacket m_reply;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/** @file */
+
+#include "TraceDecoder.h"
+#include "A7105.h"
+#include "Hubsan.h"
+
+/**
+ * @def WAIT_WRITE
+ * @brief Flag on a Hubsan bind state waiting for the packet to be sent, as in
+ * Hubsan.cpp.
+ */
+#define WAIT_WRITE 0x80
+
+/**
+ * @brief Names of the Hubsan protocol states.
+ */
+static const char *const stateNames[] = {
+    "BIND_1", "BIND_2", "BIND_3", "BIND_4", "BIND_5",
+    "BIND_6", "BIND_7", "BIND_8", "DATA_1", "DATA_2",
+    "DATA_3", "DATA_4", "DATA_5", "RESUME", "SURVEY",
+};
+
+/**
+ * @brief Names of the Hubsan telemetry states, in the order of Hubsan.cpp.
+ */
+static const char *const telemetryNames[] = {"doTx", "waitTx", "pollRx",
+                                             "skipRx"};
+
+/**
+ * @brief Names of HubsanSetupState.
+ */
+static const char *const setupNames[] = {
+    "IDLE",    "WAKEUP",   "RESET", "IF_CAL",
+    "VCO_LOW", "VCO_HIGH", "READY", "FAILED",
+};
+
+/**
+ * @brief Gets a name from a table, or "?" if out of range.
+ */
+template <size_t N>
+static const char *name(const char *const (&names)[N], uint8_t index)
+{
+  return index < N ? names[index] : "?";
+}
+
+/**
+ * @brief Gets the name of an A7105 strobe command.
+ */
+static const char *strobeName(uint8_t command)
+{
+  switch (command)
+  {
+  case A7105_SLEEP:
+    return "SLEEP";
+  case A7105_IDLE:
+    return "IDLE";
+  case A7105_STANDBY:
+    return "STANDBY";
+  case A7105_PLL:
+    return "PLL";
+  case A7105_RX:
+    return "RX";
+  case A7105_TX:
+    return "TX";
+  case A7105_RST_WRPTR:
+    return "RST_WRPTR";
+  case A7105_RST_RDPTR:
+    return "RST_RDPTR";
+  default:
+    return "?";
+  }
+}
+
+TraceDecoder::TraceDecoder()
+    : records(0)
+    , lost(0)
+    , skipped(0)
+    , m_len(0)
+    , m_timeHigh(0)
+{
+}
+
+/**
+ * @brief Adds a byte of the stream.
+ * @param c Byte received
+ * @param record Record to fill
+ * @return True if a record was completed
+ */
+bool TraceDecoder::feed(uint8_t c, TraceRecord &record)
+{
+  if (m_len == 0 && c != TRACE_SYNC)
+  {
+    skipped++;
+    return false;
+  }
+
+  m_record[m_len++] = c;
+  if (m_len < TRACE_RECORD_SIZE)
+    return false;
+  m_len = 0;
+
+  record.type = m_record[1];
+  record.a = m_record[2];
+  record.b = m_record[3];
+
+  if (record.type == TRACE_TIME)
+    m_timeHigh = record.a | (record.b << 8);
+  else if (record.type == TRACE_LOST)
+    lost += record.a;
+
+  record.timeUs = ((uint32_t)m_timeHigh << 16) | m_record[4] |
+                  (m_record[5] << 8);
+  records++;
+
+  return true;
+}
+
+/**
+ * @brief Describes a record in words.
+ * @param record Record decoded
+ * @param text Buffer to write to
+ * @param size Size of the buffer
+ */
+void TraceDecoder::describe(const TraceRecord &record, char *text,
+                            size_t size)
+{
+  switch (record.type)
+  {
+  case TRACE_TIME:
+    snprintf(text, size, "time 0x%04X....", record.a | (record.b << 8));
+    break;
+  case TRACE_LOST:
+    snprintf(text, size, "%u events lost", record.a);
+    break;
+  case TRACE_SETUP:
+    snprintf(text, size, "tx() setup %s", name(setupNames, record.a));
+    break;
+  case TRACE_STATE:
+    // The telemetry state only means something in the data states
+    snprintf(text, size, "tx() %s%s %s",
+             name(stateNames, record.a & ~WAIT_WRITE),
+             record.a & WAIT_WRITE ? "+WAIT_WRITE" : "",
+             record.a >= DATA_1 && record.a <= DATA_5
+                 ? name(telemetryNames, record.b)
+                 : "");
+    break;
+  case TRACE_DELAY:
+    snprintf(text, size, "  next in %u us", record.a | (record.b << 8));
+    break;
+  case TRACE_STROBE:
+    snprintf(text, size, "  strobe %s", strobeName(record.a));
+    break;
+  case TRACE_WRITE_REG:
+    snprintf(text, size, "  write %02X = %02X", record.a, record.b);
+    break;
+  case TRACE_READ_REG:
+    snprintf(text, size, "  read %02X = %02X", record.a, record.b);
+    break;
+  case TRACE_WRITE_ID:
+    snprintf(text, size, "  write ID ....%02X%02X", record.a, record.b);
+    break;
+  case TRACE_WRITE_DATA:
+    snprintf(text, size, "  write packet %u bytes, channel %02X", record.a,
+             record.b);
+    break;
+  case TRACE_READ_DATA:
+    snprintf(text, size, "  read packet %u bytes, %02X...", record.a,
+             record.b);
+    break;
+  case TRACE_BUSY:
+    snprintf(text, size, "  busy %s (%s)", record.a ? "yes" : "no",
+             record.b ? "GIO1" : "MODE");
+    break;
+  default:
+    snprintf(text, size, "unknown %02X %02X %02X", record.type, record.a,
+             record.b);
+    break;
+  }
+}
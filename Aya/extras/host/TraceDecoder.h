@@ -0,0 +1,45 @@
+/** @file */
+
+#ifndef _TRACE_DECODER_AYA_H_
+#define _TRACE_DECODER_AYA_H_
+
+#include "Trace.h"
+
+/**
+ * @struct TraceRecord
+ * @brief An event decoded from the trace stream.
+ */
+struct TraceRecord
+{
+  uint32_t timeUs; //!< halMicros() time of the event
+  uint8_t type;    //!< TraceType
+  uint8_t a;       //!< First argument
+  uint8_t b;       //!< Second argument
+};
+
+/**
+ * @class TraceDecoder
+ * @brief Decodes the records sent by trace_drain().
+ *
+ * Rebuilds the full time of each event from the TRACE_TIME events and skips
+ * bytes up to the next TRACE_SYNC if the stream was cut.
+ */
+class TraceDecoder
+{
+public:
+  TraceDecoder();
+
+  bool feed(uint8_t c, TraceRecord &record);
+  static void describe(const TraceRecord &record, char *text, size_t size);
+
+  uint32_t records; //!< Records decoded
+  uint32_t lost;    //!< Events lost in the transmitter, from TRACE_LOST
+  uint32_t skipped; //!< Bytes skipped to find a record
+
+private:
+  uint8_t m_record[TRACE_RECORD_SIZE];
+  uint8_t m_len;
+  uint16_t m_timeHigh;
+};
+
+#endif
@@ -0,0 +1,224 @@
+/** @file */
+
+/*
+ * Decodes the same synthetic CPPM pulse train with the interrupt/micros()
+ * decoder and the input capture decoder, and compares their error. 12 and 7
+ * channel signals with a short frame gap check the channel count and frame
+ * period are learned and every channel comes through, and a signal of frame
+ * gaps only that no frame is published.
+ *
+ * halMicros() steps by 4us, as on a 16MHz AVR, and every ISR is delayed by up
+ * to a maximum latency standing in for other interrupts (timer 0, serial,
+ * the radio). The signal drops out for a while half way through and stops at
+ * the end.
+ *
+ * Usage: cppm_jitter [frames] [max ISR latency us]
+ *
+ * Exits non-zero if a decoder missed frames or channels, did not learn the
+ * signal or flag it stale, or the capture decoder was off by more than 1us.
+ */
+
+#include <math.h>
+
+#include "CPPM.h"
+#include "CppmSourceModel.h"
+
+/**
+ * @def INTERRUPT_PIN
+ * @brief Pin of external interrupt 1.
+ */
+#define INTERRUPT_PIN 3
+
+/**
+ * @brief Channel values sent, not aligned to the micros() step.
+ */
+const uint16_t sent[CPPM_NUM_CHANNELS] = {1000, 1137, 1250, 1333,
+                                          1501, 1667, 1779, 1999,
+                                          1100, 1400, 1600, 1900};
+
+/**
+ * @struct Scenario
+ * @brief Signal and decoder of one run.
+ */
+struct Scenario
+{
+  const char *name; //!< Name to print
+  bool capture;     //!< Use the input capture decoder
+  uint8_t channels; //!< Channels sent
+  uint16_t gapUs;   //!< Time between the last channel and the next frame
+};
+
+/**
+ * @struct JitterStats
+ * @brief Error of the decoded channel values.
+ */
+struct JitterStats
+{
+  uint32_t frames;   //!< Fresh frames decoded
+  uint32_t partial;  //!< Frames decoded with channels missing
+  uint32_t sent;     //!< Frames sent
+  uint16_t frameUs;  //!< Frame period sent
+  double sumSquares; //!< Sum of squared errors
+  int minError;      //!< Most negative error
+  int maxError;      //!< Most positive error
+  CppmStats decoder; //!< Statistics of the decoder
+  bool staleRunning; //!< cppm_stale() while the signal was present
+  bool staleStopped; //!< cppm_stale() after the signal stopped
+};
+
+/**
+ * @brief Runs one decoder against the pulse train.
+ * @param scenario Signal and decoder
+ * @param frames Frames to send
+ * @param latencyUs Maximum ISR latency
+ */
+JitterStats run(const Scenario &scenario, uint32_t frames, uint16_t latencyUs)
+{
+  hostReset();
+  hostSetMicrosResolution(4);
+  hostSetInterruptLatency(latencyUs);
+
+  CppmSourceModel source(scenario.capture ? HAL_CAPTURE_PIN : INTERRUPT_PIN);
+  memcpy(source.channels, sent, sizeof(sent));
+  source.channelCount = scenario.channels;
+  source.frameUs = scenario.gapUs;
+  for (uint8_t i = 0; i < scenario.channels; i++)
+    source.frameUs += sent[i];
+  hostAddDevice(&source);
+
+  if (scenario.capture)
+    cppm_init_capture(FALLING);
+  else
+    cppm_init(1, FALLING);
+
+  JitterStats stats = {0, 0, 0, source.frameUs, 0, 0, 0, CppmStats(), 0, 0};
+  bool paused = false;
+
+  // Skip the frames the decoder needs to find the frame start and lock
+  hostRunUntil(hostTime() + 5 * source.frameUs);
+  cppm_read();
+
+  uint32_t firstFrame = source.frames;
+  uint64_t limitUs = hostTime() + (frames + 10) * 50000ULL;
+
+  while (source.frames - firstFrame < frames && hostTime() < limitUs)
+  {
+    if (!paused && source.frames - firstFrame >= frames / 2)
+    {
+      // Just over the capture timer period, aliases to a 1500us pulse
+      source.pause(65536ULL * 1000000 / HAL_CAPTURE_HZ + 1500);
+      paused = true;
+    }
+
+    if (!hostRunUntil(limitUs, &cppm_fresh))
+      break;
+
+    CppmFrame frame;
+    cppm_read_frame(frame);
+    if (frame.channelCount != scenario.channels)
+      stats.partial++;
+
+    cppm_read();
+    stats.frames++;
+
+    for (uint8_t i = 0; i < scenario.channels; i++)
+    {
+      int error = cppm_channels[i] - sent[i];
+      stats.sumSquares += error * error;
+      stats.minError = min(stats.minError, error);
+      stats.maxError = max(stats.maxError, error);
+    }
+  }
+
+  stats.sent = source.frames - firstFrame;
+  stats.staleRunning = cppm_stale();
+  cppm_read_stats(stats.decoder);
+
+  source.pause(UINT32_MAX);
+  hostAdvance(100000);
+  stats.staleStopped = cppm_stale();
+
+  return stats;
+}
+
+/**
+ * @brief Prints the statistics of one run.
+ */
+void print(const Scenario &scenario, const JitterStats &stats)
+{
+  printf("%-10s %6u/%-6u %6.2f %+4d %+4d %4d %3u %6u/%-6u %4u %4u %s\n",
+         scenario.name, stats.frames, stats.sent,
+         sqrt(stats.sumSquares / max(stats.frames * scenario.channels, 1U)),
+         stats.minError, stats.maxError, stats.maxError - stats.minError,
+         stats.decoder.channels, stats.decoder.frameUs, stats.frameUs,
+         stats.decoder.badFrames, stats.decoder.dropped,
+         stats.staleStopped ? "yes" : "no");
+}
+
+/**
+ * @brief Checks a run against what was sent.
+ * @return True if the run passed
+ */
+bool check(const Scenario &scenario, const JitterStats &stats)
+{
+  int periodError = stats.decoder.frameUs - stats.frameUs;
+
+  if (!scenario.channels)
+  {
+    if (!stats.frames && !stats.decoder.frames && !stats.decoder.channels)
+      return true;
+
+    printf("FAIL: %s: frame without channels published\n", scenario.name);
+    return false;
+  }
+
+  // The frame sent as the signal drops out is lost, it has no closing gap
+  if (stats.frames + 1 < stats.sent || stats.decoder.dropped < 1)
+    printf("FAIL: %s: frames missed or dropout not seen\n", scenario.name);
+  else if (stats.decoder.channels != scenario.channels ||
+           abs(periodError) > 10)
+    printf("FAIL: %s: channel count or frame period not learned\n",
+           scenario.name);
+  else if (stats.partial)
+    printf("FAIL: %s: %u frames with channels missing\n", scenario.name,
+           stats.partial);
+  else if (stats.staleRunning || !stats.staleStopped)
+    printf("FAIL: %s: stale input not flagged\n", scenario.name);
+  else if (scenario.capture && (stats.minError < -1 || stats.maxError > 1))
+    printf("FAIL: %s: capture decoder error over 1us\n", scenario.name);
+  else
+    return true;
+
+  return false;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t frames = argc > 1 ? atoi(argv[1]) : 2000;
+  uint16_t latencyUs = argc > 2 ? atoi(argv[2]) : 8;
+
+  const Scenario scenarios[] = {
+      {"interrupt", false, 8, 10834},
+      {"capture", true, 8, 10834},
+      {"12ch/short", true, 12, 2300},
+      {"7ch/short", true, 7, 2300},
+      {"gaps only", true, 0, 22500},
+  };
+  const uint8_t count = sizeof(scenarios) / sizeof(scenarios[0]);
+  JitterStats stats[count];
+
+  for (uint8_t i = 0; i < count; i++)
+    stats[i] = run(scenarios[i], frames, latencyUs);
+
+  printf("micros() step 4 us, ISR latency 0-%u us\n", latencyUs);
+  printf("decoder    frames        rms us  min  max  p-p  ch frame us      "
+         " bad drop stale\n");
+  for (uint8_t i = 0; i < count; i++)
+    print(scenarios[i], stats[i]);
+
+  bool pass = true;
+  for (uint8_t i = 0; i < count; i++)
+    pass = check(scenarios[i], stats[i]) && pass;
+
+  return pass ? 0 : 1;
+}
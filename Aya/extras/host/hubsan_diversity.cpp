@@ -0,0 +1,178 @@
+/** @file */
+
+/*
+ * Flies Hubsan on two A7105s sharing SCLK and SDIO, with diversity, through
+ * phases that hamper one radio or the other:
+ *
+ *   clear      the second radio hears the model weaker, stay on the first
+ *   A blocked  the first radio's antenna is blocked, move to the second
+ *   B blocked  the second is blocked instead, move back to the first
+ *   A weak     the first hears the model weaker, move to the second
+ *
+ * Each phase settles for two link windows, then checks the model gets its data
+ * packets from the radio expected and every telemetry packet gets back.
+ *
+ * Usage: hubsan_diversity [seconds per phase]
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include "HubsanFixture.h"
+
+/**
+ * @def SECOND_CS_PIN
+ * @brief CS of the second radio, which has no GIO1.
+ */
+#define SECOND_CS_PIN 7
+
+/**
+ * @def WEAK_RSSI
+ * @brief RSSI lost by a radio that hears the model weaker.
+ */
+#define WEAK_RSSI 0x30
+
+/**
+ * @def SETTLE_US
+ * @brief Time given to each phase to settle, two link windows as the one it
+ * starts in still mostly has the phase before.
+ */
+#define SETTLE_US 1500000
+
+/**
+ * @struct Phase
+ * @brief Conditions of each radio and the radio expected to transmit.
+ */
+struct Phase
+{
+  const char *name;
+  bool blocked[2];
+  uint8_t rxLoss[2];
+  uint8_t txRadio;
+};
+
+static const Phase phases[] = {
+    {"clear", {false, false}, {0, WEAK_RSSI}, 0},
+    {"A blocked", {true, false}, {0, 0}, 1},
+    {"B blocked", {false, true}, {0, 0}, 0},
+    {"A weak", {false, false}, {WEAK_RSSI, 0}, 1},
+};
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 3;
+
+  HubsanFixture fixture;
+  A7105Model &radioA = fixture.radio;
+  A7105Model radioB(fixture.air, SECOND_CS_PIN, SIM_SCLK_PIN,
+                    SIM_SDIO_PIN);
+  A7105Model *radios[2] = {&radioA, &radioB};
+  HubsanQuadModel &quad = fixture.quad;
+  hostAddDevice(&radioB);
+
+  A7105Radio<SECOND_CS_PIN> second;
+  Hubsan hubsan;
+  HubsanTelemetry telemetry = HubsanTelemetry();
+  HubsanDiversity diversity = HubsanDiversity();
+  bool failed = false;
+
+  hubsan.setDiversity(a7105Default(), second);
+  if (!hubsan.setup())
+  {
+    printf("FAIL: radios not set up\n");
+    return 1;
+  }
+  hubsan.bind();
+
+  uint64_t limitUs = hostTime() + 5000000;
+
+  while (!quad.bound() && hostTime() < limitUs)
+    fixture.step(hubsan);
+
+  if (!quad.bound())
+  {
+    printf("FAIL: model did not bind\n");
+    return 1;
+  }
+
+  printf("%u s per phase, %.1f data packets/s expected\n", seconds,
+         1e6 / 13000);
+  printf("phase      tx radio  A pkts  B pkts  rate Hz  telemetry  "
+         "switches  rssi A/B\n");
+
+  for (uint8_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++)
+  {
+    const Phase &phase = phases[p];
+    uint64_t startUs = hostTime();
+    uint64_t endUs = startUs + seconds * 1000000ULL;
+    uint64_t settledUs = 0;
+    uint32_t frames = radioA.txPackets + radioB.txPackets;
+    bool frameStart = false;
+    bool replied = false;
+    uint32_t txStart[2] = {0, 0};
+    uint32_t dataStart = 0;
+    uint32_t sentStart = 0;
+    uint32_t receivedStart = 0;
+
+    for (uint8_t i = 0; i < 2; i++)
+    {
+      radios[i]->setBlocked(phase.blocked[i]);
+      radios[i]->setRxLoss(phase.rxLoss[i]);
+    }
+
+    // Count from the start of a frame to the start of another, when no
+    // telemetry is on its way: the model has not replied to the packet
+    while (hostTime() < endUs || !frameStart || replied)
+    {
+      uint32_t replies = quad.telemetryPackets;
+
+      fixture.step(hubsan);
+      frameStart = radioA.txPackets + radioB.txPackets != frames;
+      frames = radioA.txPackets + radioB.txPackets;
+      replied = quad.telemetryPackets != replies;
+
+      if (!settledUs && frameStart && !replied &&
+          hostTime() >= startUs + SETTLE_US)
+      {
+        settledUs = hostTime();
+        txStart[0] = radioA.txPackets;
+        txStart[1] = radioB.txPackets;
+        dataStart = quad.dataPackets;
+        sentStart = quad.telemetryPackets;
+        hubsan.getTelemetry(telemetry);
+        receivedStart = telemetry.packets;
+      }
+    }
+
+    hubsan.getTelemetry(telemetry);
+    hubsan.getDiversity(diversity);
+
+    double windowS = (hostTime() - settledUs) / 1e6;
+    uint32_t tx[2] = {radioA.txPackets - txStart[0],
+                      radioB.txPackets - txStart[1]};
+    uint32_t data = quad.dataPackets - dataStart;
+    uint32_t sent = quad.telemetryPackets - sentStart;
+    uint32_t received = telemetry.packets - receivedStart;
+
+    printf("%-10s %8c %7u %7u %8.1f %5u/%-4u %9u  %02X/%02X\n", phase.name,
+           'A' + diversity.txRadio, tx[0], tx[1], data / windowS, received,
+           sent, diversity.switches, diversity.rssi[0], diversity.rssi[1]);
+
+    if (diversity.txRadio != phase.txRadio || tx[phase.txRadio ^ 1])
+    {
+      printf("FAIL: %s: not transmitting on radio %c\n", phase.name,
+             'A' + phase.txRadio);
+      failed = true;
+    }
+
+    if (data / windowS < 0.95e6 / 13000 || received != sent)
+    {
+      printf("FAIL: %s: data packets or telemetry lost\n", phase.name);
+      failed = true;
+    }
+  }
+
+  printf("loss switches %u, model bad packets %u\n", diversity.lossSwitches,
+         quad.badPackets);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+/** @file */
+
+/*
+ * Flies Hubsan over simulated links and checks the link quality estimate and
+ * the TX power control:
+ *
+ *   lossy     fixed power, 20% of data packets lost and 10% of telemetry
+ *             corrupted, the estimate should follow
+ *   near      the model hears every power level, the control steps down to
+ *             the lowest
+ *   marginal  the model only hears 10mW and up, the control settles there
+ *             and rarely retries lower
+ *   degrading the model hears every level, then only 10mW and up from half
+ *             way, the control steps back up
+ *   far       weak telemetry RSSI, the control stays at full power
+ *   silent    a model without telemetry, the control stays at full power
+ *
+ * Usage: hubsan_link [seconds]
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include "HubsanFixture.h"
+
+/**
+ * @struct LinkStats
+ * @brief Results of one run.
+ */
+struct LinkStats
+{
+  HubsanLinkQuality last;   //!< Last window
+  uint32_t windows;         //!< Windows reported
+  uint32_t qualitySum;      //!< Sum of quality over the windows
+  uint32_t crcErrors;       //!< Checksum failures over the windows
+  uint32_t sent;            //!< Data packets sent
+  uint32_t lost;            //!< Data packets the model did not hear
+  uint32_t powerWindows[8]; //!< Windows spent at each A7105_TxPower
+  uint8_t degradedPower;    //!< Power when the link degraded
+  uint32_t riseMs;          //!< Time from then to a power the model hears
+};
+
+/**
+ * @brief Binds and flies a model for a time.
+ * @param fixture Model set up for the link to simulate
+ * @param control Enable the power control
+ * @param seconds Time to fly for
+ * @param degradeTo Weakest A7105_TxPower the model hears from half way, 0 to
+ * leave the link as it is
+ */
+LinkStats fly(HubsanFixture &fixture, bool control, uint32_t seconds,
+              uint8_t degradeTo = 0)
+{
+  Hubsan hubsan;
+  LinkStats stats = LinkStats();
+  HubsanLinkQuality link;
+  uint64_t endUs = hostTime() + seconds * 1000000ULL;
+  uint64_t degradeUs = hostTime() + seconds * 500000ULL;
+  bool degraded = false;
+  bool risen = false;
+
+  hubsan.setPowerControl(control);
+  hubsan.setup();
+  hubsan.bind();
+
+  while (hostTime() < endUs)
+  {
+    fixture.step(hubsan);
+
+    if (degradeTo && !degraded && hostTime() >= degradeUs)
+    {
+      degraded = true;
+      stats.degradedPower = stats.last.power;
+      fixture.quad.minPower = degradeTo;
+    }
+
+    if (degraded && !risen && hubsan.getLinkQuality(link) &&
+        link.power >= degradeTo)
+    {
+      risen = true;
+      stats.riseMs = (hostTime() - degradeUs) / 1000;
+    }
+
+    if (hubsan.getLinkQuality(link) && link.windows > stats.windows)
+    {
+      stats.windows = link.windows;
+      stats.qualitySum += link.quality;
+      stats.crcErrors += link.crcErrors;
+      stats.powerWindows[link.power]++;
+      stats.last = link;
+    }
+  }
+
+  stats.sent = fixture.quad.dataPackets + fixture.quad.lostPackets;
+  stats.lost = fixture.quad.lostPackets;
+
+  return stats;
+}
+
+/**
+ * @brief Prints the results of a run.
+ */
+void print(const char *name, const LinkStats &stats)
+{
+  printf("%-9s %7.1f %4u %5u %6.2f%% %6u  ", name,
+         (double)stats.qualitySum / max(stats.windows, 1U), stats.crcErrors,
+         stats.last.powerChanges, 100.0 * stats.lost / max(stats.sent, 1U),
+         stats.last.power);
+  for (uint8_t i = 0; i < 8; i++)
+    printf(" %3u", stats.powerWindows[i]);
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 60;
+  LinkStats lossy, near, marginal, degrading, far, silent;
+
+  {
+    HubsanFixture fixture;
+    fixture.quad.dropPercent = 20;
+    fixture.quad.corruptPercent = 10;
+    lossy = fly(fixture, false, seconds);
+  }
+
+  {
+    HubsanFixture fixture;
+    near = fly(fixture, true, seconds);
+  }
+
+  {
+    HubsanFixture fixture;
+    fixture.quad.minPower = TXPOWER_10mW;
+    marginal = fly(fixture, true, seconds);
+  }
+
+  {
+    HubsanFixture fixture;
+    degrading = fly(fixture, true, seconds, TXPOWER_10mW);
+  }
+
+  {
+    HubsanFixture fixture;
+    fixture.quad.replyRssi = 0xb0;
+    far = fly(fixture, true, seconds);
+  }
+
+  {
+    HubsanFixture fixture;
+    fixture.quad.telemetryInterval = 0;
+    silent = fly(fixture, true, seconds);
+  }
+
+  printf("%u s per run, power levels 0 (100uW) to 7 (150mW)\n", seconds);
+  printf("link      quality  crc steps   lost power   windows at each "
+         "level\n");
+  print("lossy", lossy);
+  print("near", near);
+  print("marginal", marginal);
+  print("degrading", degrading);
+  print("far", far);
+  print("silent", silent);
+
+  // 80% of packets heard, 90% of the replies intact
+  double lossyQuality = (double)lossy.qualitySum / max(lossy.windows, 1U);
+  if (lossyQuality < 60 || lossyQuality > 85 || !lossy.crcErrors ||
+      lossy.last.power != TXPOWER_150mW || lossy.last.powerChanges)
+  {
+    printf("FAIL: estimate does not follow a lossy link\n");
+    return 1;
+  }
+
+  if (near.last.power != TXPOWER_100uW || near.lost)
+  {
+    printf("FAIL: power not lowered on a strong link\n");
+    return 1;
+  }
+
+  uint32_t settled = marginal.powerWindows[TXPOWER_10mW] +
+                     marginal.powerWindows[TXPOWER_30mW];
+  if (marginal.last.power < TXPOWER_10mW ||
+      settled < marginal.windows * 3 / 4 || marginal.lost * 20 > marginal.sent)
+  {
+    printf("FAIL: power did not settle at the weakest level heard\n");
+    return 1;
+  }
+
+  // Four steps up, each after three telemetry intervals without telemetry
+  printf("degrading: %u ms to step up from level %u\n", degrading.riseMs,
+         degrading.degradedPower);
+  if (degrading.degradedPower > TXPOWER_1mW || !degrading.riseMs ||
+      degrading.riseMs > 2500 || degrading.last.power < TXPOWER_10mW)
+  {
+    printf("FAIL: power not raised when the link degraded\n");
+    return 1;
+  }
+
+  if (far.last.power != TXPOWER_150mW || far.last.powerChanges ||
+      silent.last.power != TXPOWER_150mW || silent.last.powerChanges ||
+      silent.last.telemetryGap)
+  {
+    printf("FAIL: power lowered without a margin or telemetry\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+/** @file */
+
+/*
+ * Checks every Hubsan data packet sent on air, byte for byte, against a
+ * reference that builds each packet from scratch the way the protocol always
+ * has: map() stick conversion and a checksum over the whole packet. The bytes
+ * of the bind packets that do not depend on the session, the transmitter ID
+ * among them, are checked the same way.
+ *
+ * Commands are changed between packets (all at once, one at a time or not at
+ * all) so both prebuilt and rebuilt packets, and both TX buffers, are covered.
+ *
+ * Usage: hubsan_packets [packets]
+ *
+ * Exits non-zero on the first packet that differs.
+ */
+
+#include "HubsanFixture.h"
+
+#define VTX_FREQ 5885
+
+/**
+ * @class PacketRecorder
+ * @brief Keeps the data packets sent by the transmitter.
+ */
+class PacketRecorder : public AirNode
+{
+public:
+  PacketRecorder(const AirNode *transmitter)
+      : m_transmitter(transmitter)
+  {
+  }
+
+  void airReceive(const AirPacket &packet)
+  {
+    if (packet.source != m_transmitter || packet.len != 16)
+      return;
+
+    std::vector<uint8_t> data(packet.data, packet.data + 16);
+
+    // Bind packets start with the bind state (1-9)
+    if (packet.data[0] == 0x20 || packet.data[0] == 0x40)
+      packets.push_back(data);
+    else
+      binds.push_back(data);
+  }
+
+  std::vector<std::vector<uint8_t>> packets; //!< Data packets in order sent
+  std::vector<std::vector<uint8_t>> binds;   //!< Bind packets in order sent
+
+private:
+  const AirNode *m_transmitter;
+};
+
+/**
+ * @brief Arduino map(), as the sticks were converted before StickScale.
+ */
+long arduinoMap(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+/**
+ * @brief Builds the packet expected for a set of commands.
+ * @param packet Buffer to build into
+ * @param commands Commands in effect when the packet was sent
+ * @param count Data packets sent before this one
+ * @param vtx True for the video transmitter packet
+ */
+void referencePacket(uint8_t *packet, const uint16_t *commands, uint32_t count,
+                     bool vtx)
+{
+  uint16_t id = (uint16_t)TX_ID; // Hubsan sends the ID as 16 bits
+  uint16_t throttle = max(commands[COMMAND_THROTTLE], (uint16_t)1100);
+  int16_t sum = 0;
+
+  memset(packet, 0, 16);
+
+  if (vtx)
+  {
+    packet[0] = 0x40;
+    packet[1] = (VTX_FREQ >> 8) & 0xff;
+    packet[2] = VTX_FREQ & 0xff;
+    packet[3] = 0x82;
+  }
+  else
+  {
+    packet[0] = 0x20;
+    packet[2] = arduinoMap(throttle, 1100, 2000, 0, 255);
+  }
+  packet[4] = arduinoMap(commands[COMMAND_YAW], 1000, 2000, 0, 255);
+  packet[6] = arduinoMap(commands[COMMAND_PITCH], 1000, 2000, 255, 0);
+  packet[8] = arduinoMap(commands[COMMAND_ROLL], 1000, 2000, 255, 0);
+
+  if (count > 100 || vtx)
+  {
+    packet[9] = 0x20;
+    if (commands[COMMAND_LIGHTS] <= 1800)
+      packet[9] |= 0x04;
+    if (commands[COMMAND_FLIPS] > 1800)
+      packet[9] |= 0x08;
+    if (commands[COMMAND_VIDEO] > 1800)
+      packet[9] |= 0x01;
+  }
+  else
+  {
+    packet[9] = 0x2c;
+  }
+
+  packet[10] = 0x64;
+  packet[11] = (id >> 24) & 0xff;
+  packet[12] = (id >> 16) & 0xff;
+  packet[13] = (id >> 8) & 0xff;
+  packet[14] = (id >> 0) & 0xff;
+
+  for (uint8_t i = 0; i < 15; i++)
+    sum += packet[i];
+  packet[15] = (256 - (sum % 256)) & 0xff;
+}
+
+/**
+ * @brief Gets a pseudo-random number, the same sequence on every run.
+ */
+uint16_t nextRandom()
+{
+  static uint32_t state = 1;
+  state = state * 1103515245 + 12345;
+  return state >> 16;
+}
+
+/**
+ * @brief Changes the commands in a way picked at random.
+ * @param hubsan Protocol to set the commands on
+ * @param commands Commands in effect, updated
+ */
+void changeCommands(StaticHubsan &hubsan, uint16_t *commands)
+{
+  switch (nextRandom() % 4)
+  {
+  case 0: // Unchanged, the packet built in advance is sent
+    break;
+  case 1:
+  {
+    uint8_t command = nextRandom() % COMMAND_COUNT;
+    commands[command] = 1000 + nextRandom() % 1001;
+    hubsan.setCommand((ProtocolCommand)command, commands[command]);
+    break;
+  }
+  default:
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+      commands[i] = 1000 + nextRandom() % 1001;
+    hubsan.setCommands(commands);
+    break;
+  }
+}
+
+/**
+ * @brief Prints a packet.
+ */
+void printPacket(const char *name, const uint8_t *packet)
+{
+  printf("%-10s", name);
+  for (uint8_t i = 0; i < 16; i++)
+    printf(" %02x", packet[i]);
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t packets = argc > 1 ? atoi(argv[1]) : 2000;
+
+  HubsanFixture fixture;
+  PacketRecorder recorder(&fixture.radio);
+  fixture.air.attach(&recorder);
+
+  StaticHubsan hubsan(TX_ID, false, VTX_FREQ);
+  uint16_t commands[COMMAND_COUNT];
+  for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+    commands[i] = 1500;
+  hubsan.setCommands(commands);
+
+  if (!hubsan.setup())
+  {
+    printf("setup() failed\n");
+    return 1;
+  }
+
+  hubsan.bind();
+
+  uint64_t limitUs = hostTime() + 2000000 + packets * 20000ULL;
+  uint32_t checked = 0;
+  uint8_t expected[16];
+
+  while (checked < packets && hostTime() < limitUs)
+  {
+    fixture.step(hubsan);
+
+    // Check each new packet and change the commands for the next one
+    if (recorder.packets.size() > checked)
+    {
+      const uint8_t *packet = recorder.packets[checked].data();
+      bool vtx = checked == 100 && packet[0] == 0x40;
+
+      referencePacket(expected, commands, checked, vtx);
+      if (memcmp(packet, expected, 16))
+      {
+        printf("FAIL: data packet %u differs\n", checked);
+        printPacket("sent", packet);
+        printPacket("expected", expected);
+        return 1;
+      }
+
+      checked++;
+      changeCommands(hubsan, commands);
+    }
+  }
+
+  printf("data packets checked: %u\n", checked);
+
+  // Bytes 6-14 of a bind packet, the ID sent as 16 bits
+  const uint8_t bindTail[] = {0x08, 0xe4, 0xea, 0x9e, 0x50, 0x00,
+                              0x00, (TX_ID >> 8) & 0xff, TX_ID & 0xff};
+
+  for (uint32_t i = 0; i < recorder.binds.size(); i++)
+  {
+    const uint8_t *packet = recorder.binds[i].data();
+
+    if (memcmp(packet + 6, bindTail, sizeof(bindTail)))
+    {
+      printf("FAIL: bind packet %u differs\n", i);
+      printPacket("sent", packet);
+      return 1;
+    }
+  }
+
+  printf("bind packets checked: %u\n", (unsigned)recorder.binds.size());
+
+  if (recorder.binds.empty())
+  {
+    printf("FAIL: no bind packets sent\n");
+    return 1;
+  }
+
+  if (checked < packets)
+  {
+    printf("FAIL: only %u of %u data packets sent\n", checked, packets);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,208 @@
+/** @file */
+
+/*
+ * Binds and flies Hubsan from the scheduler with three idle strategies and
+ * reports the duty cycle of the MCU and the A7105 and an estimated supply
+ * current:
+ *
+ *   busy       loop() spins, the radio is never put to sleep
+ *   idle       loop() calls scheduler_idle(), the MCU sleeps between runs
+ *   low power  as idle, with Hubsan::setLowPower() sleeping the radio
+ *              through bind waits and telemetry windows with none due
+ *
+ * The currents are typical datasheet figures (ATmega328P at 16MHz, A7105 at
+ * full TX power), for comparing the strategies rather than measuring a board.
+ *
+ * Usage: hubsan_power [seconds]
+ *
+ * Exits non-zero if low power loses data packets or telemetry, strobes the
+ * radio before it is ready or does not halve the radio current.
+ */
+
+#include "HubsanFixture.h"
+#include "Scheduler.h"
+
+/*
+ * Typical supply currents in mA.
+ */
+#define MCU_ACTIVE_MA 9.0
+#define MCU_IDLE_MA 2.5
+#define RADIO_SLEEP_MA 0.0015
+#define RADIO_IDLE_MA 0.3
+#define RADIO_STANDBY_MA 1.5
+#define RADIO_PLL_MA 7.5
+#define RADIO_RX_MA 16.0
+#define RADIO_TX_MA 20.0
+
+/**
+ * @enum IdleMode
+ * @brief What loop() does between scheduler runs.
+ */
+enum IdleMode
+{
+  IDLE_BUSY,
+  IDLE_SLEEP,
+  IDLE_LOW_POWER,
+};
+
+/**
+ * @struct PowerStats
+ * @brief Results of one run.
+ */
+struct PowerStats
+{
+  double seconds;        //!< Length of the run
+  double mcuTask;        //!< Fraction of the time running the task
+  double mcuAsleep;      //!< Fraction of the time the MCU slept
+  uint32_t sleeps;       //!< Sleeps per second
+  double radio[6];       //!< Fraction of the time in each A7105 state
+  double mcuMa;          //!< Estimated mean MCU current
+  double radioMa;        //!< Estimated mean A7105 current
+  uint32_t dataPackets;  //!< Data packets the model received
+  uint32_t telemetry;    //!< Telemetry packets received by the transmitter
+  uint32_t earlyStrobes; //!< TX or RX strobed before the radio was ready
+  bool bound;            //!< The model bound
+};
+
+Hubsan *running;
+
+/**
+ * @brief Task run by the scheduler.
+ */
+uint16_t hubsanTx()
+{
+  return running->tx();
+}
+
+/**
+ * @brief Sets up, binds and flies for a time.
+ * @param mode Idle strategy
+ * @param seconds Time to fly for
+ */
+PowerStats fly(IdleMode mode, uint32_t seconds)
+{
+  static const uint8_t states[6] = {A7105_SLEEP, A7105_IDLE, A7105_STANDBY,
+                                    A7105_PLL,   A7105_RX,   A7105_TX};
+  static const double currents[6] = {RADIO_SLEEP_MA, RADIO_IDLE_MA,
+                                     RADIO_STANDBY_MA, RADIO_PLL_MA,
+                                     RADIO_RX_MA, RADIO_TX_MA};
+
+  HubsanFixture fixture;
+  A7105Model &radio = fixture.radio;
+  HubsanQuadModel &quad = fixture.quad;
+
+  Hubsan hubsan;
+  PowerStats stats = PowerStats();
+  HubsanTelemetry telemetry = HubsanTelemetry();
+  SchedulerStats scheduler;
+  uint32_t sleeps;
+  running = &hubsan;
+
+  hubsan.setLowPower(mode == IDLE_LOW_POWER);
+  hubsan.setup();
+  hubsan.bind();
+
+  uint64_t startUs = hostTime();
+  uint64_t endUs = startUs + seconds * 1000000ULL;
+  uint32_t idleStartUs = scheduler_idle_us();
+  uint64_t radioStart[6];
+  for (uint8_t i = 0; i < 6; i++)
+    radioStart[i] = radio.stateTime(states[i]);
+
+  a7105_wtr_handler = scheduler_wake;
+  scheduler_start(hubsanTx);
+
+  while (hostTime() < endUs)
+  {
+    if (mode == IDLE_BUSY)
+      hostAdvance(100);
+    else
+      scheduler_idle();
+  }
+
+  scheduler_read_stats(scheduler);
+  scheduler_stop();
+  a7105_wtr_handler = NULL;
+  hostSleepTime(&sleeps);
+  hubsan.getTelemetry(telemetry);
+
+  double totalUs = hostTime() - startUs;
+  uint32_t idleUs = scheduler_idle_us() - idleStartUs;
+
+  stats.seconds = totalUs / 1e6;
+  stats.mcuTask = scheduler.taskUs / totalUs;
+  stats.mcuAsleep = idleUs > scheduler.taskUs
+                        ? (idleUs - scheduler.taskUs) / totalUs
+                        : 0;
+  stats.sleeps = sleeps / stats.seconds;
+  stats.mcuMa = MCU_ACTIVE_MA * (1 - stats.mcuAsleep) +
+                MCU_IDLE_MA * stats.mcuAsleep;
+  for (uint8_t i = 0; i < 6; i++)
+  {
+    stats.radio[i] = (radio.stateTime(states[i]) - radioStart[i]) / totalUs;
+    stats.radioMa += currents[i] * stats.radio[i];
+  }
+  stats.dataPackets = quad.dataPackets;
+  stats.telemetry = telemetry.packets;
+  stats.earlyStrobes = radio.earlyStrobes;
+  stats.bound = quad.bound();
+
+  return stats;
+}
+
+/**
+ * @brief Prints the results of a run.
+ */
+void print(const char *name, const PowerStats &stats)
+{
+  printf("%-9s %5.1f %5.1f %6u  ", name, 100 * stats.mcuTask,
+         100 * stats.mcuAsleep, stats.sleeps);
+  for (uint8_t i = 0; i < 6; i++)
+    printf(" %5.1f", 100 * stats.radio[i]);
+  printf("  %5.2f %5.2f %6.2f\n", stats.mcuMa, stats.radioMa,
+         stats.mcuMa + stats.radioMa);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 10;
+
+  PowerStats busy = fly(IDLE_BUSY, seconds);
+  PowerStats idle = fly(IDLE_SLEEP, seconds);
+  PowerStats low = fly(IDLE_LOW_POWER, seconds);
+
+  printf("%u s from bind, %% of the time, currents in mA\n", seconds);
+  printf("          --- mcu ---------  --- radio ---------------------------"
+         "  --- estimate -----\n");
+  printf("          task asleep  wakes/s sleep  idle stdby   pll    rx    tx"
+         "    mcu radio  total\n");
+  print("busy", busy);
+  print("idle", idle);
+  print("low power", low);
+  printf("data packets %u / %u / %u, telemetry %u / %u / %u, early strobes "
+         "%u\n",
+         busy.dataPackets, idle.dataPackets, low.dataPackets, busy.telemetry,
+         idle.telemetry, low.telemetry, low.earlyStrobes);
+
+  if (!idle.bound || idle.mcuAsleep < 0.9 || idle.mcuMa >= busy.mcuMa)
+  {
+    printf("FAIL: MCU not asleep between scheduler runs\n");
+    return 1;
+  }
+
+  if (!low.bound || low.earlyStrobes ||
+      low.dataPackets + 1 < idle.dataPackets ||
+      low.telemetry * 100 < idle.telemetry * 95)
+  {
+    printf("FAIL: low power lost packets or strobed a sleeping radio\n");
+    return 1;
+  }
+
+  if (low.radioMa > idle.radioMa / 2)
+  {
+    printf("FAIL: low power did not halve the radio current\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,216 @@
+/** @file */
+
+/*
+ * Restarts the transmitter while the simulated model stays bound and checks
+ * the stored session is resumed without binding:
+ *
+ *   cold       erased storage, full setup and bind, the session is saved
+ *   resume     new transmitter, data packets from the stored session
+ *   model off  the model was restarted too, the resume times out and binds
+ *   corrupted  a damaged record is not resumed, nor one from an ID that only
+ *              differs in its high 16 bits
+ *   forgotten  forgetSession() clears the record at once
+ *
+ * Times are from the start of setup to the first data packet the model
+ * receives.
+ *
+ * Usage: hubsan_resume
+ *
+ * Exits non-zero if a step does not behave as above.
+ */
+
+#include <stddef.h>
+
+#include "HubsanFixture.h"
+
+/**
+ * @def STORAGE_ADDRESS
+ * @brief Where the session is stored, not at 0 to catch address mistakes.
+ */
+#define STORAGE_ADDRESS 16
+
+/**
+ * @class BindCounter
+ * @brief Counts the bind packets sent by the transmitter.
+ */
+class BindCounter : public AirNode
+{
+public:
+  BindCounter(const AirNode *transmitter)
+      : packets(0)
+      , m_transmitter(transmitter)
+  {
+  }
+
+  void airReceive(const AirPacket &packet)
+  {
+    // Bind packets start with the bind state (1-9)
+    if (packet.source == m_transmitter && packet.len == 16 &&
+        packet.data[0] >= 1 && packet.data[0] <= 9)
+      packets++;
+  }
+
+  uint32_t packets; //!< Bind packets sent
+
+private:
+  const AirNode *m_transmitter;
+};
+
+/**
+ * @struct StartStats
+ * @brief Results of starting a transmitter.
+ */
+struct StartStats
+{
+  bool resumed;         //!< resume() found a session
+  uint32_t setupUs;     //!< Time the radio setup took
+  uint32_t firstDataUs; //!< Time to the first data packet received
+  uint32_t bindPackets; //!< Bind packets sent
+  bool manualCal;       //!< Radio left with the stored IF calibration
+};
+
+/**
+ * @brief Starts a new transmitter and flies until the model has received
+ * data packets for a second.
+ * @param fixture Radio and model, kept across restarts
+ * @param binds Bind packet counter
+ */
+StartStats start(HubsanFixture &fixture, BindCounter &binds)
+{
+  HubsanQuadModel &quad = fixture.quad;
+  Hubsan hubsan(TX_ID);
+  StartStats stats = StartStats();
+  HubsanSetupStatus status;
+
+  hubsan.setStorage(STORAGE_ADDRESS);
+
+  uint64_t startUs = hostTime();
+  uint64_t firstDataUs = 0;
+  fixture.next = startUs;
+  uint32_t dataPackets = quad.dataPackets;
+  uint32_t bindPackets = binds.packets;
+
+  hubsan.beginSetup();
+  stats.resumed = hubsan.resume();
+  if (!stats.resumed)
+    hubsan.bind();
+
+  while (hostTime() < startUs + 5000000 &&
+         (!firstDataUs || hostTime() < firstDataUs + 1000000))
+  {
+    fixture.step(hubsan);
+
+    if (!firstDataUs && quad.dataPackets > dataPackets)
+      firstDataUs = hostTime();
+  }
+
+  hubsan.getSetupStatus(status);
+  stats.setupUs = status.elapsedUs;
+  stats.firstDataUs = firstDataUs ? firstDataUs - startUs : 0;
+  stats.bindPackets = binds.packets - bindPackets;
+  stats.manualCal = fixture.radio.reg(A7105_22_IF_CALIB_I) & A7105_MASK_MFBS;
+
+  return stats;
+}
+
+/**
+ * @brief Prints the results of a start.
+ */
+void print(const char *name, const StartStats &stats)
+{
+  printf("%-10s %-7s %8lu %12lu %11u %s\n", name,
+         stats.resumed ? "yes" : "no", (unsigned long)stats.setupUs,
+         (unsigned long)stats.firstDataUs, stats.bindPackets,
+         stats.manualCal ? "stored" : "run");
+}
+
+int main()
+{
+  HubsanFixture fixture;
+  hostEraseStorage();
+  HubsanQuadModel &quad = fixture.quad;
+  BindCounter binds(&fixture.radio);
+  fixture.air.attach(&binds);
+
+  StartStats cold = start(fixture, binds);
+  uint32_t coldWrites = hostStorageWrites();
+
+  StartStats warm = start(fixture, binds);
+  uint32_t warmWrites = hostStorageWrites() - coldWrites;
+
+  quad.powerCycle();
+  StartStats modelOff = start(fixture, binds);
+
+  Hubsan otherID(TX_ID ^ 0x01000000);
+  otherID.setStorage(STORAGE_ADDRESS);
+  bool otherIDResumed = otherID.resume();
+
+  // Damage the session ID, the checksum no longer matches
+  uint8_t *damaged =
+      &hostStorage()[STORAGE_ADDRESS + offsetof(HubsanSession, sessionID)];
+  *damaged ^= 0x01;
+  Hubsan corrupted(TX_ID);
+  corrupted.setStorage(STORAGE_ADDRESS);
+  bool corruptedResumed = corrupted.resume();
+  *damaged ^= 0x01;
+
+  Hubsan unstored(TX_ID);
+  bool unstoredResumed = unstored.resume();
+
+  // Nothing else runs after forgetSession(), so it must write straight away
+  Hubsan forgetter(TX_ID);
+  forgetter.setStorage(STORAGE_ADDRESS);
+  bool validResumed = forgetter.resume();
+  forgetter.forgetSession();
+  Hubsan forgotten(TX_ID);
+  forgotten.setStorage(STORAGE_ADDRESS);
+  bool forgottenResumed = forgotten.resume();
+
+  printf("start      resumed setup us  first data us bind packets cal\n");
+  print("cold", cold);
+  print("resume", warm);
+  print("model off", modelOff);
+  printf("storage bytes written: %u binding, %u resuming\n", coldWrites,
+         warmWrites);
+  printf("corrupted record resumed: %s, other ID: %s, without storage: %s\n",
+         corruptedResumed ? "yes" : "no", otherIDResumed ? "yes" : "no",
+         unstoredResumed ? "yes" : "no");
+  printf("forgotten record resumed: %s\n", forgottenResumed ? "yes" : "no");
+
+  // The telemetry flag and checksum are written again if the model answers
+  // before the record is complete
+  if (cold.resumed || !cold.firstDataUs || !coldWrites ||
+      coldWrites > sizeof(HubsanSession) + 2)
+  {
+    printf("FAIL: cold start did not bind and save the session\n");
+    return 1;
+  }
+
+  if (!warm.resumed || warm.bindPackets || !warm.manualCal ||
+      !warm.firstDataUs || warm.firstDataUs >= cold.firstDataUs || warmWrites)
+  {
+    printf("FAIL: session not resumed\n");
+    return 1;
+  }
+
+  if (!modelOff.resumed || !modelOff.firstDataUs || !modelOff.bindPackets ||
+      modelOff.manualCal || !quad.bound())
+  {
+    printf("FAIL: restarted model was not bound again\n");
+    return 1;
+  }
+
+  if (corruptedResumed || otherIDResumed || unstoredResumed)
+  {
+    printf("FAIL: resumed without a valid stored session\n");
+    return 1;
+  }
+
+  if (!validResumed || forgottenResumed)
+  {
+    printf("FAIL: forgotten session resumed\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,202 @@
+/** @file */
+
+/*
+ * Sets up the radio from tx(), binds the Hubsan protocol to a simulated model
+ * through the A7105 model and flies it for a number of data frames on the
+ * virtual clock, with the commands set through IProtocol. Then checks that
+ * setup with a radio failing every calibration gives up without blocking.
+ *
+ * Usage: hubsan_sim [frames]
+ *
+ * Exits non-zero if the model did not bind, did not receive the expected
+ * stick values or its telemetry was not decoded, or if setup blocked tx() for
+ * more than 2ms or did not report the failing radio.
+ */
+
+#include <time.h>
+
+#include "HubsanFixture.h"
+
+/**
+ * @brief Gets the wall clock time.
+ * @return Time in seconds
+ */
+double wallTime()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Sets up with a radio whose calibrations all fail.
+ * @return True if setup gave up and reported why
+ */
+bool checkFailedSetup()
+{
+  HubsanFixture fixture;
+  A7105Model &radio = fixture.radio;
+  radio.setCalibrationFailures(255);
+
+  Hubsan hubsan;
+  HubsanSetupStatus status;
+  uint32_t longestUs = 0;
+
+  hubsan.beginSetup();
+
+  while (hubsan.getSetupStatus(status) &&
+         status.state != HUBSAN_SETUP_FAILED && hostTime() < 10000000)
+  {
+    fixture.wait();
+    uint64_t start = hostTime();
+    fixture.tx(hubsan);
+    longestUs = max(longestUs, (uint32_t)(hostTime() - start));
+  }
+
+  printf("failing radio:      gave up after %lu us, %u attempts, error %u, "
+         "longest tx() %lu us\n",
+         (unsigned long)status.elapsedUs, status.attempts, status.error,
+         (unsigned long)longestUs);
+
+  return status.state == HUBSAN_SETUP_FAILED &&
+         status.error == HUBSAN_SETUP_IF_FAILED && status.attempts == 100 &&
+         radio.txPackets == 0 && longestUs <= 2000;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t frames = argc > 1 ? atoi(argv[1]) : 5000;
+
+  HubsanFixture fixture;
+  A7105Model &radio = fixture.radio;
+  HubsanQuadModel &quad = fixture.quad;
+  quad.vbat = 37;
+  quad.rateOfClimb = -120;
+  quad.gyro[HUBSAN_PITCH] = 300;
+  quad.gyro[HUBSAN_ROLL] = -301;
+  quad.gyro[HUBSAN_YAW] = 302;
+  quad.acc[HUBSAN_PITCH] = -1000;
+  quad.acc[HUBSAN_ROLL] = 1001;
+  quad.acc[HUBSAN_YAW] = -1002;
+
+  Hubsan hubsan(TX_ID, false, 5885);
+  uint16_t commands[COMMAND_COUNT];
+  commands[COMMAND_THROTTLE] = 1500;
+  commands[COMMAND_YAW] = 1250;
+  commands[COMMAND_PITCH] = 1000;
+  commands[COMMAND_ROLL] = 2000;
+  commands[COMMAND_VIDEO] = 1000;
+  commands[COMMAND_FLIPS] = 2000;
+  commands[COMMAND_LIGHTS] = 1000;
+
+  // Through IProtocol, as a sketch passing Hubsan on would
+  IProtocol &protocol = hubsan;
+  protocol.setCommands(commands);
+
+  double wallStart = wallTime();
+
+  // Set up from tx(), then survey the channels and bind
+  hubsan.setSurveyBudget(20000);
+  hubsan.beginSetup();
+  hubsan.bind();
+
+  // Give up after a generous 20ms per frame
+  uint64_t limitUs = hostTime() + 2000000 + frames * 20000ULL;
+  uint64_t boundUs = 0;
+  uint64_t firstBindUs = 0;
+  uint32_t longestSetupUs = 0;
+  uint32_t txCalls = 0;
+
+  while (quad.dataPackets < frames && hostTime() < limitUs)
+  {
+    fixture.wait();
+
+    // The first call after the channel survey sends the first bind packet
+    HubsanSurvey survey;
+    uint64_t start = hostTime();
+    if (!firstBindUs && hubsan.getSurvey(survey))
+      firstBindUs = start;
+
+    fixture.tx(hubsan);
+    txCalls++;
+
+    if (!firstBindUs)
+      longestSetupUs = max(longestSetupUs, (uint32_t)(hostTime() - start));
+
+    if (!boundUs && quad.bound())
+      boundUs = hostTime();
+  }
+
+  double wallS = wallTime() - wallStart;
+  double virtualS = hostTime() * 1e-6;
+  const uint8_t *last = quad.lastPacket();
+  HubsanSetupStatus setup;
+  hubsan.getSetupStatus(setup);
+  HubsanSurvey survey = HubsanSurvey();
+  hubsan.getSurvey(survey);
+
+  printf("setup:              %lu us, %u attempts, longest tx() %lu us\n",
+         (unsigned long)setup.elapsedUs, setup.attempts,
+         (unsigned long)longestSetupUs);
+  printf("channel survey:     %lu us, %u rounds, channel 0x%02x\n",
+         (unsigned long)survey.elapsedUs, survey.rounds, survey.channel);
+  printf("first bind packet:  %lu us\n", (unsigned long)firstBindUs);
+  printf("bound after:        %lu us\n", (unsigned long)boundUs);
+  printf("data packets:       %u (%u bad)\n", quad.dataPackets,
+         quad.badPackets);
+  printf("telemetry sent:     %u\n", quad.telemetryPackets);
+  HubsanTelemetry telemetry;
+  bool haveTelemetry = hubsan.getTelemetry(telemetry);
+  printf("telemetry received: %u, every %u ms\n", telemetry.packets,
+         telemetry.intervalMs);
+  printf("radio TX/RX:        %u / %u\n", radio.txPackets, radio.rxPackets);
+  printf("tx() calls:         %u\n", txCalls);
+  printf("SPI transactions:   %u (%.1f per data packet)\n",
+         radio.spiTransactions,
+         (double)radio.spiTransactions / max(quad.dataPackets, 1U));
+  printf("SPI bytes:          %u (%.1f per data packet)\n", radio.spiBytes,
+         (double)radio.spiBytes / max(quad.dataPackets, 1U));
+  printf("register writes:    %u sent, %u skipped\n",
+         a7105_shadow_stats.writes, a7105_shadow_stats.skipped);
+  printf("virtual time:       %.3f s\n", virtualS);
+  printf("wall time:          %.3f s (%.0fx real time)\n", wallS,
+         virtualS / wallS);
+
+  if (setup.state != HUBSAN_SETUP_READY || longestSetupUs > 2000)
+  {
+    printf("FAIL: setup did not finish or blocked tx()\n");
+    return 1;
+  }
+
+  if (!quad.bound() || quad.dataPackets < frames)
+  {
+    printf("FAIL: model did not bind or receive %u data packets\n", frames);
+    return 1;
+  }
+
+  if (last[2] != 113 || last[4] != 63 || last[6] != 255 || last[8] != 0)
+  {
+    printf("FAIL: unexpected sticks %u %u %u %u\n", last[2], last[4], last[6],
+           last[8]);
+    return 1;
+  }
+
+  if (!haveTelemetry || telemetry.vbat != 37 || telemetry.rateOfClimb != -120 ||
+      telemetry.gyro[HUBSAN_PITCH] != 300 ||
+      telemetry.gyro[HUBSAN_ROLL] != -301 ||
+      telemetry.gyro[HUBSAN_YAW] != 302 ||
+      telemetry.acc[HUBSAN_PITCH] != -1000 ||
+      telemetry.acc[HUBSAN_ROLL] != 1001 || telemetry.acc[HUBSAN_YAW] != -1002)
+  {
+    printf("FAIL: telemetry not decoded\n");
+    return 1;
+  }
+
+  if (!checkFailedSetup())
+  {
+    printf("FAIL: failing radio not reported\n");
+    return 1;
+  }
+
+  return 0;
+}
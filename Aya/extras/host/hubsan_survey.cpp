@@ -0,0 +1,166 @@
+/** @file */
+
+/*
+ * Binds Hubsan at a simulated crowded site, with noise set on the A7105 model
+ * for most channels, and checks the survey at bind picks the quietest
+ * channel pair within its time budget:
+ *
+ *   0x32  quiet, alternate 0x55 a little noisy     expected pick
+ *   0x46  quiet, alternate 0x69 loud
+ *   0x78  quiet, alternate 0x9b noisier than 0x55
+ *   rest  loud
+ *
+ * Then checks a short budget still binds, that with no noise binds spread
+ * over the channels and that a budget of 0 skips the survey.
+ *
+ * Usage: hubsan_survey
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include "HubsanFixture.h"
+
+#define QUIET 0xE0
+#define NOISY 0xC0
+#define NOISIER 0xA0
+#define LOUD 0x30
+
+/**
+ * @struct BindStats
+ * @brief Results of one bind.
+ */
+struct BindStats
+{
+  bool surveyed;       //!< A survey finished
+  HubsanSurvey survey; //!< Noise table
+  uint32_t longestUs;  //!< Longest tx() call before the first bind packet
+  bool bound;          //!< The model bound and received data packets
+};
+
+/**
+ * @brief Sets up, surveys and binds, then flies for a few frames.
+ * @param noisy Set noise on the channels as in the table above
+ * @param budgetUs Survey time budget
+ */
+BindStats bindAt(bool noisy, uint16_t budgetUs)
+{
+  HubsanFixture fixture;
+  A7105Model &radio = fixture.radio;
+  HubsanQuadModel &quad = fixture.quad;
+
+  if (noisy)
+  {
+    for (uint16_t channel = 0; channel < 256; channel++)
+      radio.setNoise(channel, LOUD);
+    radio.setNoise(0x32, QUIET);
+    radio.setNoise(0x32 + 0x23, NOISY);
+    radio.setNoise(0x46, QUIET);
+    radio.setNoise(0x46 + 0x23, LOUD);
+    radio.setNoise(0x78, QUIET);
+    radio.setNoise(0x78 + 0x23, NOISIER);
+  }
+
+  Hubsan hubsan;
+  BindStats stats = BindStats();
+
+  hubsan.setSurveyBudget(budgetUs);
+  hubsan.beginSetup();
+  hubsan.bind();
+
+  while (quad.dataPackets < 20 && hostTime() < 2000000)
+  {
+    fixture.wait();
+    uint64_t start = hostTime();
+    bool surveyed = hubsan.getSurvey(stats.survey);
+    fixture.tx(hubsan);
+
+    if (!surveyed)
+      stats.longestUs = max(stats.longestUs, (uint32_t)(hostTime() - start));
+  }
+
+  stats.surveyed = hubsan.getSurvey(stats.survey);
+  stats.bound = quad.bound() && quad.dataPackets >= 20;
+
+  return stats;
+}
+
+/**
+ * @brief Prints the noise table of a survey.
+ */
+void printSurvey(const HubsanSurvey &survey)
+{
+  printf("channel   ");
+  for (uint8_t i = 0; i < HUBSAN_CHANNEL_COUNT; i++)
+    printf(" %02x", survey.channels[i]);
+  printf("\nrssi      ");
+  for (uint8_t i = 0; i < HUBSAN_CHANNEL_COUNT; i++)
+    printf(" %02x", survey.rssi[i]);
+  printf("\nrssi +0x23");
+  for (uint8_t i = 0; i < HUBSAN_CHANNEL_COUNT; i++)
+    printf(" %02x", survey.rssiAlt[i]);
+  printf("\n");
+}
+
+int main()
+{
+  BindStats crowded = bindAt(true, 20000);
+  BindStats brief = bindAt(true, 3000);
+  BindStats none = bindAt(true, 0);
+
+  printSurvey(crowded.survey);
+  printf("budget 20000 us: %lu us, %u rounds, channel 0x%02x, longest tx() "
+         "%lu us\n",
+         (unsigned long)crowded.survey.elapsedUs, crowded.survey.rounds,
+         crowded.survey.channel, (unsigned long)crowded.longestUs);
+  printf("budget 3000 us:  %lu us, %u rounds, channel 0x%02x\n",
+         (unsigned long)brief.survey.elapsedUs, brief.survey.rounds,
+         brief.survey.channel);
+
+  // Transmitters binding at a quiet site should not all pick one channel
+  uint32_t picked = 0;
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    BindStats quiet = bindAt(false, 20000);
+    if (quiet.bound)
+      picked |= 1UL << (quiet.survey.channel / 10);
+  }
+
+  uint8_t distinct = 0;
+  for (; picked; picked &= picked - 1)
+    distinct++;
+  printf("quiet site: %u different channels in 8 binds\n", distinct);
+
+  if (!crowded.surveyed || !crowded.bound || crowded.survey.channel != 0x32 ||
+      crowded.survey.elapsedUs > 20000 || !crowded.survey.rounds ||
+      crowded.longestUs > 500)
+  {
+    printf("FAIL: survey did not pick 0x32 within budget and bind\n");
+    return 1;
+  }
+
+  if (crowded.survey.rssi[5] != QUIET || crowded.survey.rssiAlt[5] != LOUD)
+  {
+    printf("FAIL: noise table does not match the site\n");
+    return 1;
+  }
+
+  if (!brief.surveyed || !brief.bound || brief.survey.elapsedUs > 3000)
+  {
+    printf("FAIL: short survey overran or did not bind\n");
+    return 1;
+  }
+
+  if (none.surveyed || !none.bound)
+  {
+    printf("FAIL: survey not skipped with no budget\n");
+    return 1;
+  }
+
+  if (distinct < 3)
+  {
+    printf("FAIL: binds at a quiet site do not spread over the channels\n");
+    return 1;
+  }
+
+  return 0;
+}
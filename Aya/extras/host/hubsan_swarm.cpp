@@ -0,0 +1,213 @@
+/** @file */
+
+/*
+ * Flies three Hubsan models from one A7105 with HubsanSlots. The models are
+ * switched on one at a time, each with a Hubsan added to the slots for it,
+ * which surveys the channels and binds while those already bound keep
+ * flying. Each Hubsan sends its own throttle, so packets
+ * reaching the wrong model would show.
+ *
+ * Once all are bound, checks every model gets a data packet every three
+ * slots, with no gap much over that, and its telemetry gets back. The first
+ * model must keep its packets going the same way while the others survey
+ * the channels and bind.
+ *
+ * Usage: hubsan_swarm [seconds]
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include "HubsanFixture.h"
+#include "HubsanSlots.h"
+#include "Scheduler.h"
+
+#define MODELS 3
+
+/**
+ * @class GapRecorder
+ * @brief Measures the time between data packets to each model.
+ */
+class GapRecorder : public AirNode
+{
+public:
+  GapRecorder(const AirNode *transmitter)
+      : startUs(HOST_NEVER)
+      , m_transmitter(transmitter)
+  {
+    memset(ids, 0, sizeof(ids));
+    memset(packets, 0, sizeof(packets));
+    memset(maxGapUs, 0, sizeof(maxGapUs));
+    memset(bindGapUs, 0, sizeof(bindGapUs));
+    memset(m_last, 0, sizeof(m_last));
+  }
+
+  void airReceive(const AirPacket &packet)
+  {
+    if (packet.source != m_transmitter || packet.len != 16 ||
+        (packet.data[0] != 0x20 && packet.data[0] != 0x40))
+      return;
+
+    for (uint8_t i = 0; i < MODELS; i++)
+    {
+      if (!ids[i] || packet.id != ids[i])
+        continue;
+
+      uint32_t gapUs = m_last[i] ? packet.start - m_last[i] : 0;
+      m_last[i] = packet.start;
+
+      if (packet.start < startUs)
+        bindGapUs[i] = max(bindGapUs[i], gapUs);
+      else if (packets[i]++)
+        maxGapUs[i] = max(maxGapUs[i], gapUs);
+    }
+  }
+
+  uint64_t startUs;           //!< Time to start recording from
+  uint32_t ids[MODELS];       //!< A7105 ID of each model
+  uint32_t packets[MODELS];   //!< Data packets to each model
+  uint32_t maxGapUs[MODELS];  //!< Longest time between them
+  uint32_t bindGapUs[MODELS]; //!< Longest before startUs, others binding
+
+private:
+  const AirNode *m_transmitter;
+  uint64_t m_last[MODELS];
+};
+
+HubsanSlots slots;
+
+/**
+ * @brief Task run by the scheduler.
+ */
+uint16_t slotsTx()
+{
+  return slots.tx();
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 10;
+
+  HubsanFixture fixture;
+  GapRecorder recorder(&fixture.radio);
+  fixture.air.attach(&recorder);
+
+  // The fixture's model is the first, the others start switched off
+  HubsanQuadModel *quads[MODELS] = {&fixture.quad};
+  Hubsan *hubsans[MODELS];
+  for (uint8_t i = 0; i < MODELS; i++)
+  {
+    if (i)
+    {
+      quads[i] = new HubsanQuadModel(fixture.air);
+      hostAddDevice(quads[i]);
+      quads[i]->powerOff();
+    }
+
+    hubsans[i] = new Hubsan();
+    hubsans[i]->setCommand(COMMAND_THROTTLE, 1200 + 300 * i);
+    // Beside models in flight the survey only samples in its own slots
+    hubsans[i]->setSurveyBudget(20000);
+  }
+
+  slots.add(*hubsans[0]);
+  hubsans[0]->setup();
+  hubsans[0]->bind();
+
+  a7105_wtr_handler = scheduler_wake;
+  scheduler_start(slotsTx);
+
+  uint64_t allBoundUs = 0;
+  uint64_t limitUs = hostTime() + 5000000;
+  uint64_t boundUs[MODELS] = {0};
+
+  while (allBoundUs ? hostTime() < allBoundUs + seconds * 1000000ULL
+                    : hostTime() < limitUs)
+  {
+    scheduler_idle();
+
+    // Switch the next model on once the last has bound
+    for (uint8_t i = 0; i < MODELS && !allBoundUs; i++)
+    {
+      if (boundUs[i] || !quads[i]->bound() || !hubsans[i]->bound())
+        continue;
+
+      boundUs[i] = hostTime();
+      recorder.ids[i] = quads[i]->id();
+      if (i + 1 < MODELS)
+      {
+        // The next Hubsan surveys and binds beside the models in flight
+        scheduler_stop();
+        slots.add(*hubsans[i + 1]);
+        hubsans[i + 1]->bind();
+        scheduler_start(slotsTx);
+        quads[i + 1]->powerCycle();
+      }
+      else
+      {
+        allBoundUs = hostTime();
+        recorder.startUs = allBoundUs + 100000;
+      }
+    }
+  }
+
+  scheduler_stop();
+  a7105_wtr_handler = NULL;
+
+  double windowS = (hostTime() - recorder.startUs) / 1e6;
+  double expectedHz = 1e6 / (MODELS * HUBSAN_SLOT_US);
+  bool failed = !allBoundUs;
+
+  printf("%u models, %u us slots, %.1f Hz each at most\n", MODELS,
+         HUBSAN_SLOT_US, expectedHz);
+  printf("model  bound ms  throttle  slots frames  rate Hz  max gap us  "
+         "telemetry  bad\n");
+
+  for (uint8_t i = 0; i < MODELS; i++)
+  {
+    HubsanSlotStats stats = HubsanSlotStats();
+    HubsanTelemetry telemetry = HubsanTelemetry();
+    const HubsanQuadModel &quad = *quads[i];
+    double rateHz = recorder.packets[i] / max(windowS, 1e-6);
+
+    slots.getStats(i, stats);
+    hubsans[i]->getTelemetry(telemetry);
+
+    printf("%5u %9.1f %9u %6u %6u %8.1f %11u %5u/%-4u %4u\n", i,
+           boundUs[i] / 1000.0, quad.lastPacket()[2], stats.slots,
+           stats.frames, rateHz, recorder.maxGapUs[i], telemetry.packets,
+           quad.telemetryPackets, quad.badPackets);
+
+    // Throttle 1200, 1500 and 1800us, 0 up to 1100us
+    uint8_t throttle = map(1200 + 300 * i, 1100, 2000, 0, 255);
+    if (!boundUs[i] || quad.badPackets ||
+        abs(quad.lastPacket()[2] - throttle) > 1)
+    {
+      printf("FAIL: model %u not bound or sent another model's packets\n", i);
+      failed = true;
+    }
+
+    if (rateHz < expectedHz * 0.9 ||
+        recorder.maxGapUs[i] > MODELS * HUBSAN_SLOT_US + 1500)
+    {
+      printf("FAIL: model %u not served every %u slots\n", i, MODELS);
+      failed = true;
+    }
+
+    if (telemetry.packets * 100 < quad.telemetryPackets * 95)
+    {
+      printf("FAIL: telemetry from model %u lost\n", i);
+      failed = true;
+    }
+  }
+
+  // Surveys and bind exchanges of the others stretch their slots a little
+  printf("model 0 longest gap while the others bound: %u us\n",
+         recorder.bindGapUs[0]);
+  if (recorder.bindGapUs[0] > MODELS * HUBSAN_SLOT_US + 3000)
+  {
+    printf("FAIL: model 0 starved while the others bound\n");
+    failed = true;
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+/** @file */
+
+/*
+ * Sets up, binds and flies Hubsan with tracing, draining the trace to Serial
+ * after every tx(), and decodes what was sent:
+ *
+ *   drained  every event gets out: one packet write per packet on air, the
+ *            time rebuilt across the 16 bit wraps and no events lost
+ *   stalled  loop() only drains every 200ms, the buffer overflows and the
+ *            losses are counted in the stream
+ *
+ * The drained trace is left in hubsan_trace.bin (or the file given) for
+ * trace_decode.
+ *
+ * Usage: hubsan_trace [seconds] [file]
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include "HubsanFixture.h"
+#include "TraceDecoder.h"
+
+/**
+ * @def STALL_US
+ * @brief Time between drains in the stalled run.
+ */
+#define STALL_US 200000
+
+/**
+ * @struct TraceStats
+ * @brief What was decoded from one run.
+ */
+struct TraceStats
+{
+  uint32_t records;    //!< Records decoded
+  uint32_t lost;       //!< Events lost in the buffer
+  uint32_t skipped;    //!< Bytes skipped to find a record
+  uint32_t counts[16]; //!< Records of each TraceType
+  uint32_t maxGapUs;   //!< Longest time between two records
+  bool backwards;      //!< A record was earlier than the one before
+  uint32_t lastUs;     //!< Time of the last record
+  uint32_t txPackets;  //!< Packets the radio sent
+  bool bound;          //!< The model bound
+};
+
+/**
+ * @brief Flies Hubsan with tracing, draining into a file.
+ * @param out File Serial writes to, rewound and decoded at the end
+ * @param seconds Time to fly for
+ * @param drainUs Time between drains, 0 after every tx()
+ */
+TraceStats run(FILE *out, uint32_t seconds, uint32_t drainUs)
+{
+  TraceStats stats = TraceStats();
+
+  HubsanFixture fixture;
+
+  Serial.setOutput(out);
+
+  Hubsan hubsan;
+  hubsan.beginSetup();
+  hubsan.bind();
+
+  uint64_t nextDrain = hostTime();
+  uint64_t endUs = hostTime() + seconds * 1000000ULL;
+
+  while (hostTime() < endUs)
+  {
+    fixture.step(hubsan);
+
+    if (hostTime() >= nextDrain)
+    {
+      trace_drain();
+      nextDrain = hostTime() + drainUs;
+    }
+  }
+
+  // Everything the radio sent has been traced, let the rest out
+  trace_drain();
+  Serial.setOutput(NULL);
+
+  stats.txPackets = fixture.radio.txPackets;
+  stats.bound = fixture.quad.bound();
+
+  TraceDecoder decoder;
+  TraceRecord record;
+  bool first = true;
+  int c;
+
+  fflush(out);
+  rewind(out);
+  while ((c = fgetc(out)) != EOF)
+  {
+    if (!decoder.feed(c, record))
+      continue;
+
+    stats.counts[record.type & 15]++;
+    if (!first)
+    {
+      if ((int32_t)(record.timeUs - stats.lastUs) < 0)
+        stats.backwards = true;
+      else
+        stats.maxGapUs = max(stats.maxGapUs, record.timeUs - stats.lastUs);
+    }
+    stats.lastUs = record.timeUs;
+    first = false;
+  }
+
+  stats.records = decoder.records;
+  stats.lost = decoder.lost;
+  stats.skipped = decoder.skipped;
+
+  return stats;
+}
+
+/**
+ * @brief Prints the results of one run.
+ */
+void print(const char *name, const TraceStats &stats)
+{
+  printf("%-8s %7u %5u %6u %5u/%-5u %7u %6u %6u  %s\n", name, stats.records,
+         stats.lost, stats.skipped, stats.counts[TRACE_WRITE_DATA],
+         stats.txPackets, stats.counts[TRACE_STATE],
+         stats.counts[TRACE_BUSY], stats.maxGapUs,
+         stats.backwards ? "yes" : "no");
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 2;
+  const char *path = argc > 2 ? argv[2] : "hubsan_trace.bin";
+
+  FILE *drainedOut = fopen(path, "w+b");
+  FILE *stalledOut = tmpfile();
+  if (!drainedOut || !stalledOut)
+  {
+    perror(path);
+    return 1;
+  }
+
+  TraceStats drained = run(drainedOut, seconds, 0);
+  TraceStats stalled = run(stalledOut, seconds, STALL_US);
+  fclose(drainedOut);
+  fclose(stalledOut);
+
+  printf("%u event buffer, %u bytes per event\n", TRACE_EVENTS,
+         TRACE_RECORD_SIZE);
+  printf("run      records  lost skipped  packets   states  busys max gap  "
+         "backwards\n");
+  print("drained", drained);
+  print("stalled", stalled);
+
+  bool failed = false;
+
+  if (!drained.bound || !stalled.bound)
+  {
+    printf("FAIL: model did not bind\n");
+    failed = true;
+  }
+
+  if (drained.lost || drained.skipped || drained.backwards ||
+      drained.counts[TRACE_WRITE_DATA] != drained.txPackets ||
+      !drained.counts[TRACE_SETUP])
+  {
+    printf("FAIL: drained: events lost or packets not all traced\n");
+    failed = true;
+  }
+
+  // A time rebuilt across a 16 bit wrap wrongly jumps 65536us
+  if (drained.maxGapUs > 50000 ||
+      drained.lastUs / 1000000 + 1 < seconds)
+  {
+    printf("FAIL: drained: time not rebuilt\n");
+    failed = true;
+  }
+
+  if (!stalled.lost || stalled.skipped || stalled.backwards)
+  {
+    printf("FAIL: stalled: losses not counted or records out of order\n");
+    failed = true;
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+/** @file */
+
+/*
+ * Flies the Hubsan protocol with hubsan.tx() called two ways and compares the
+ * jitter of the data packet period on air:
+ *
+ *   loop       polled from loop() with micros() >= next, as the example
+ *              sketches did, after other work of random length
+ *   scheduler  run from the alarm interrupt by the scheduler, with loop()
+ *              busy with the same work
+ *
+ * halMicros() steps by 4us and ISRs are delayed by up to 8us, as in
+ * cppm_jitter. The clock starts 10s before halMicros() wraps around, so both
+ * runs cross the wrap.
+ *
+ * Usage: scheduler_jitter [packets] [max loop work us]
+ *
+ * Exits non-zero if the scheduler run missed packets, did not cross the wrap
+ * or its period jitter is over 50us.
+ */
+
+#include <math.h>
+
+#include "HubsanFixture.h"
+#include "Scheduler.h"
+
+/**
+ * @def START_US
+ * @brief Virtual time the runs start at, 10s before halMicros() wraps.
+ */
+#define START_US (0x100000000ULL - 10000000)
+
+/**
+ * @class PeriodRecorder
+ * @brief Measures the time between data packets sent by the transmitter.
+ */
+class PeriodRecorder : public AirNode
+{
+public:
+  PeriodRecorder(const AirNode *transmitter)
+      : packets(0)
+      , sum(0)
+      , sumSquares(0)
+      , minUs(UINT32_MAX)
+      , maxUs(0)
+      , m_transmitter(transmitter)
+      , m_last(0)
+  {
+  }
+
+  void airReceive(const AirPacket &packet)
+  {
+    if (packet.source != m_transmitter || packet.len != 16 ||
+        (packet.data[0] != 0x20 && packet.data[0] != 0x40))
+      return;
+
+    if (packets++)
+    {
+      uint32_t periodUs = packet.start - m_last;
+      sum += periodUs;
+      sumSquares += (double)periodUs * periodUs;
+      minUs = min(minUs, periodUs);
+      maxUs = max(maxUs, periodUs);
+    }
+    m_last = packet.start;
+  }
+
+  /**
+   * @brief Gets the mean period.
+   */
+  double mean() const
+  {
+    return packets > 1 ? sum / (packets - 1) : 0;
+  }
+
+  /**
+   * @brief Gets the RMS deviation of the period from its mean.
+   */
+  double rms() const
+  {
+    double m = mean();
+    return packets > 1 ? sqrt(sumSquares / (packets - 1) - m * m) : 0;
+  }
+
+  uint32_t packets;  //!< Data packets sent
+  double sum;        //!< Sum of periods
+  double sumSquares; //!< Sum of squared periods
+  uint32_t minUs;    //!< Shortest period
+  uint32_t maxUs;    //!< Longest period
+
+private:
+  const AirNode *m_transmitter;
+  uint64_t m_last;
+};
+
+/**
+ * @struct RunStats
+ * @brief Results of one run.
+ */
+struct RunStats
+{
+  uint32_t packets;         //!< Data packets sent
+  double meanUs;            //!< Mean period
+  double rmsUs;             //!< RMS deviation of the period
+  uint32_t minUs;           //!< Shortest period
+  uint32_t maxUs;           //!< Longest period
+  uint32_t txCalls;         //!< Calls to tx()
+  bool wrapped;             //!< halMicros() wrapped during the run
+  SchedulerStats scheduler; //!< Deadline offsets, scheduler run only
+};
+
+Hubsan *running;
+
+/**
+ * @brief Task run by the scheduler.
+ */
+uint16_t hubsanTx()
+{
+  return running->tx();
+}
+
+/**
+ * @brief Gets a pseudo-random number, the same sequence on every run.
+ */
+uint16_t nextRandom()
+{
+  static uint32_t state = 1;
+  state = state * 1103515245 + 12345;
+  return state >> 16;
+}
+
+/**
+ * @brief Runs Hubsan until a number of data packets have been sent.
+ * @param scheduled Run tx() from the scheduler instead of loop()
+ * @param packets Data packets to send
+ * @param workUs Longest time loop() is busy with other work
+ */
+RunStats run(bool scheduled, uint32_t packets, uint16_t workUs)
+{
+  HubsanFixture fixture;
+  hostAdvance(START_US);
+  hostSetMicrosResolution(4);
+  hostSetInterruptLatency(8);
+
+  PeriodRecorder recorder(&fixture.radio);
+  fixture.air.attach(&recorder);
+
+  Hubsan hubsan;
+  RunStats stats = RunStats();
+  running = &hubsan;
+
+  hubsan.setup();
+  hubsan.bind();
+
+  uint32_t startUs = halMicros();
+  uint64_t limitUs = hostTime() + 2000000 + packets * 20000ULL;
+  uint32_t next_update_us = 0;
+
+  if (scheduled)
+  {
+    a7105_wtr_handler = scheduler_wake;
+    scheduler_start(hubsanTx);
+  }
+
+  while (recorder.packets < packets && hostTime() < limitUs)
+  {
+    // Other work done by loop()
+    hostAdvance(nextRandom() % (workUs + 1));
+
+    if (!scheduled)
+    {
+      uint32_t now_us = halMicros();
+      if (a7105_wtr_event || now_us >= next_update_us)
+      {
+        next_update_us = now_us + hubsan.tx();
+        stats.txCalls++;
+      }
+    }
+  }
+
+  if (scheduled)
+  {
+    scheduler_read_stats(stats.scheduler);
+    stats.txCalls = stats.scheduler.runs + stats.scheduler.wakes;
+    scheduler_stop();
+    a7105_wtr_handler = NULL;
+  }
+
+  stats.packets = recorder.packets;
+  stats.meanUs = recorder.mean();
+  stats.rmsUs = recorder.rms();
+  stats.minUs = recorder.minUs;
+  stats.maxUs = recorder.maxUs;
+  stats.wrapped = halMicros() < startUs;
+
+  return stats;
+}
+
+/**
+ * @brief Prints the results of one run.
+ */
+void print(const char *name, const RunStats &stats)
+{
+  printf("%-10s %6u %9.1f %7.2f %6u %6u %5u %8u  %s\n", name, stats.packets,
+         stats.meanUs, stats.rmsUs, stats.minUs, stats.maxUs,
+         stats.maxUs - stats.minUs, stats.txCalls,
+         stats.wrapped ? "yes" : "no");
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t packets = argc > 1 ? atoi(argv[1]) : 1500;
+  uint16_t workUs = argc > 2 ? atoi(argv[2]) : 1000;
+
+  RunStats loop = run(false, packets, workUs);
+  RunStats scheduled = run(true, packets, workUs);
+
+  printf("micros() step 4 us, ISR latency 0-8 us, loop() work 0-%u us\n",
+         workUs);
+  printf("tx() from  packets period us  rms us    min    max   p-p tx() "
+         "calls wrap\n");
+  print("loop", loop);
+  print("scheduler", scheduled);
+
+  const SchedulerStats &s = scheduled.scheduler;
+  printf("scheduler: %u runs at a deadline, %u woken, start %+d to %+d us "
+         "(mean %+.2f, rms %.2f)\n",
+         s.runs, s.wakes, s.offsetMinUs, s.offsetMaxUs,
+         (double)s.offsetSumUs / max(s.runs, 1U),
+         sqrt((double)s.offsetSqSum / max(s.runs, 1U)));
+
+  if (scheduled.packets < packets || !scheduled.wrapped)
+  {
+    printf("FAIL: scheduler missed packets or did not cross the wrap\n");
+    return 1;
+  }
+
+  if (scheduled.maxUs - scheduled.minUs > 50)
+  {
+    printf("FAIL: scheduler period jitter over 50us\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+/** @file */
+
+/*
+ * Turns a trace captured from the serial port into a timeline, one event per
+ * line with its time and the time since the event before:
+ *
+ *   stty -F /dev/ttyUSB0 115200 raw && cat /dev/ttyUSB0 > trace.bin
+ *   trace_decode trace.bin
+ *
+ * Usage: trace_decode [file]
+ *
+ * Reads standard input without a file. Exits non-zero if the file can not
+ * be read.
+ */
+
+#include "TraceDecoder.h"
+
+int main(int argc, char **argv)
+{
+  FILE *in = argc > 1 ? fopen(argv[1], "rb") : stdin;
+
+  if (!in)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  TraceDecoder decoder;
+  TraceRecord record;
+  bool first = true;
+  uint32_t lastUs = 0;
+  char text[64];
+  int c;
+
+  printf("    time us   +us  event\n");
+
+  while ((c = fgetc(in)) != EOF)
+  {
+    if (!decoder.feed(c, record) || record.type == TRACE_TIME)
+      continue;
+
+    TraceDecoder::describe(record, text, sizeof(text));
+    printf("%11u %5u  %s\n", record.timeUs,
+           first ? 0 : record.timeUs - lastUs, text);
+    lastUs = record.timeUs;
+    first = false;
+  }
+
+  printf("%u records, %u events lost, %u bytes skipped\n", decoder.records,
+         decoder.lost, decoder.skipped);
+
+  if (in != stdin)
+    fclose(in);
+
+  return 0;
+}